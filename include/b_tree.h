@@ -9,9 +9,22 @@
 #include <exception>
 #include <execution>
 #include <iostream>
+#include <sstream>
+#include <vector>
+#include <unordered_map>
+#include <atomic>
+#include <thread>
+#include <optional>
+#include <mutex>
+#include <chrono>
+
+#include "details/digest_search.h"
+#include "details/slab_allocator.h"
+#include "details/flat_combiner.h"
 
 #include <boost/container/static_vector.hpp>
 #include <boost/thread/shared_mutex.hpp>
+#include <boost/thread/locks.hpp>
 
 #ifndef BOOST_ENDIAN_DEPRECATED_NAMES
 #define BOOST_ENDIAN_DEPRECATED_NAMES
@@ -48,19 +61,49 @@ namespace jb
         //
         // few aliases
         //
-        using Storage = Storage< Policies >;
+        using Key = typename Storage::Key;
         using Value = typename Storage::Value;
         using Digest = typename Bloom::Digest;
         using StorageFile = typename PhysicalVolumeImpl::StorageFile;
         using Transaction = typename StorageFile::Transaction;
         using BlobUid = typename StorageFile::ChunkUid;
         using big_uint64_t = boost::endian::big_uint64_at;
+        using big_uint32_t = boost::endian::big_uint32_at;
 
-        static constexpr auto BTreeMinPower = Policies::PhysicalVolumePolicy::BTreeMinPower;
-        static_assert( BTreeMinPower >= 2, "B-tree power must be > 1" );
-        static constexpr auto BTreeMin = BTreeMinPower - 1;
-        static constexpr auto BTreeMax = 2 * BTreeMinPower - 1;
+        static constexpr auto BTreeMaxPower = Policies::PhysicalVolumePolicy::BTreeMaxPower;
+        static_assert( BTreeMaxPower >= 2, "B-tree power must be > 1" );
+
+        // capacity of in-memory node: overflown node of a file with the maximum power
+        static constexpr auto BTreeCapacity = 2 * BTreeMaxPower - 1;
         static constexpr auto BTreeMaxDepth = Policies::PhysicalVolumePolicy::BTreeMaxDepth;
+        static constexpr auto BTreeBulkLoadFill = Policies::PhysicalVolumePolicy::BTreeBulkLoadFill;
+        static_assert( 0 < BTreeBulkLoadFill && BTreeBulkLoadFill <= 100, "Invalid bulk load fill factor" );
+        static constexpr auto BTreeTopDown = Policies::PhysicalVolumePolicy::BTreeTopDown;
+        static constexpr auto BTreeEytzinger = Policies::PhysicalVolumePolicy::BTreeEytzinger;
+        static constexpr auto BTreeHotLevels = Policies::PhysicalVolumePolicy::BTreeHotLevels;
+        static constexpr auto PreservedChunkNumber = Policies::PhysicalVolumePolicy::PreservedChunkNumber;
+        static constexpr auto BTreeLazyErase = Policies::PhysicalVolumePolicy::BTreeLazyErase;
+
+        // expiration mark of erased element awaiting for collapsing, looks expired to any reader
+        static constexpr uint64_t Tombstone = 1;
+
+        // digest of expiration index entry is expiration mark followed by bits distinguishing entries of the same msec
+        static constexpr auto ExpirationIndex = Policies::PhysicalVolumePolicy::ExpirationIndex;
+        static constexpr size_t ExpirationShift = 20;
+        static constexpr uint64_t ExpirationLimit = 1ULL << ( 64 - ExpirationShift );
+        static constexpr size_t ExpirationNameSize = 48;
+
+        // initial portion of subkey name read from a node, see operator >> ()
+        static constexpr size_t NameSlice = 0x1000;
+
+        // concurrent modifications of a b-tree are applied by batches of this size
+        static constexpr auto BTreeCombineBatch = Policies::PhysicalVolumePolicy::BTreeCombineBatch;
+
+        // number of lock-free search attempts before readers start waiting on node latches
+        static constexpr size_t OptimisticAttempts = 8;
+
+        // maximum number of nodes loaded in background by one batch of interleaved lookups
+        static constexpr size_t InterleavedLoads = 16;
 
         template < typename T, size_t C > using static_vector = boost::container::static_vector< T, C >;
 
@@ -79,6 +122,8 @@ namespace jb
         // more aliases
         //
         using BTreeP = std::shared_ptr< BTree >;
+        class BlobReader;
+        class Cursor;
         using NodeUid = typename StorageFile::ChunkUid;
         static constexpr auto RootNodeUid = StorageFile::RootChunkUid;
         static constexpr auto InvalidNodeUid = StorageFile::InvalidChunkUid;
@@ -95,6 +140,42 @@ namespace jb
         using BTreePath = static_vector< std::pair< NodeUid, Pos >, BTreeMaxDepth >;
 
 
+        /** Represents subkey to be loaded: digest, value, expiration mark, and subkey name
+        */
+        using BulkItem = std::tuple< Digest, Value, uint64_t, Key >;
+
+
+        /** Represents subkeys to be registered in expiration index: digest and expiration mark
+        */
+        using ExpiringSubkeys = std::vector< std::pair< Digest, uint64_t > >;
+
+
+        /** Numeric operations applied to inline values in place, see update_value()
+        */
+        enum class NumericOp
+        {
+            Add,                ///< adds the operand
+            Min,                ///< keeps the least of the value and the operand
+            Max,                ///< keeps the greatest of the value and the operand
+            CompareExchange     ///< replaces the value with the operand if it equals expected one
+        };
+
+
+        /** Represents modification of a subkey applied by combining with concurrent ones
+        */
+        struct Modification
+        {
+            enum class Kind { Insert, Erase };
+
+            Kind kind_;
+            Digest digest_;
+            Key name_;
+            Value value_;
+            uint64_t good_before_;
+            bool overwrite_;
+        };
+
+
         //struct BTreePath : public std::vector< std::pair< NodeUid, Pos > >
         //{
         //    BTreePath() { reserve(100); }
@@ -152,6 +233,7 @@ namespace jb
             uint64_t good_before_;
             NodeUid children_;
             PackedValue value_;
+            Key name_;
 
             //
             // provides LESSER relation for b-tree elements
@@ -166,11 +248,20 @@ namespace jb
         //
         // more aliases
         //
-        using ElementCollection = static_vector< Element, BTreeMax  >;
-        using LinkCollection = static_vector< NodeUid, BTreeMax + 1 >;
-
-        //using ElementCollection = std::vector< Element  >;
-        //using LinkCollection = std::vector< NodeUid >;
+        // node arrays are sized to the actual number of elements through size classes of the slab
+        // pool; links and digests are read by optimistic readers without locking, so their outgrown
+        // storage lives as long as the node
+        using ElementCollection = std::vector< Element, details::slab_allocator< Element > >;
+        using LinkCollection = details::slab_array< NodeUid, BTreeCapacity + 1 >;
+        using DigestCollection = details::slab_array< Digest, BTreeCapacity >;
+
+        // digests in Eytzinger order with their positions in the node
+        struct EytzingerIndex
+        {
+            DigestCollection digests_;
+            details::slab_array< uint16_t, BTreeCapacity > ranks_;
+        };
+        static_assert( BTreeCapacity <= std::numeric_limits< uint16_t >::max(), "B-tree power is too big for Eytzinger index" );
 
         //
         // data members
@@ -178,10 +269,107 @@ namespace jb
         NodeUid uid_;
         StorageFile & file_;
         BTreeCache & cache_;
+
+        // the power of the file: minimum number of elements of non-root node and overflow size
+        const size_t btree_min_;
+        const size_t btree_max_;
+
+        // held by key locks over the b-tree rooted at the node
         mutable boost::upgrade_mutex guard_;
+
+        // latch of the node content, see VersionGuard, and the thread holding it exclusively
+        mutable boost::upgrade_mutex latch_;
+        std::atomic< std::thread::id > latch_owner_;
+
         ElementCollection elements_;
         LinkCollection links_;
 
+        // contiguous copy of element digests, lets search go through few cache lines with SIMD
+        // comparisons instead of striding over the whole elements
+        mutable DigestCollection digests_;
+
+        // the same digests in Eytzinger order if BTreeEytzinger policy is set, it is built from the
+        // mirror and never stored
+        mutable std::conditional_t< BTreeEytzinger, EytzingerIndex, std::tuple<> > eytzinger_;
+
+        // modification counter, odd value means the node is being modified right now
+        mutable std::atomic< uint64_t > version_{ 0 };
+
+        // combines concurrent modifications of b-tree rooted at the node, created on first use
+        using ModificationCombiner = details::flat_combiner< Modification, RetCode >;
+        std::once_flag combiner_once_;
+        std::unique_ptr< ModificationCombiner > combiner_;
+
+        // read-only snapshot of upper levels of pinned b-tree rooted at the node, see pin_hot_tier()
+        struct HotTier;
+        class HotTierRefresh;
+        std::atomic< size_t > hot_levels_{ 0 };
+        mutable std::shared_ptr< const HotTier > hot_tier_;
+
+
+        /* Latches b-tree node for modification
+
+        Holds exclusive lock over the node latch and keeps the node version odd, so optimistic
+        readers detect the modification and restart, locking readers take the latch shared. On release
+        rebuilds digest mirror and publishes new even version and returns excessive capacity of the
+        elements. Nested latching of the node by the thread already holding the latch does nothing
+
+        The latch is not the guard held by key locks, so a writer holding the key over a b-tree
+        latches its root as any other node
+
+        All structural changes of a child node (relocation, removal) must be done under latched
+        parent, that lets readers validate the link they came through by the parent version
+        */
+        class VersionGuard
+        {
+            BTree & node_;
+            bool owner_ = false;
+
+        public:
+
+            VersionGuard( const VersionGuard & ) = delete;
+            VersionGuard & operator = ( const VersionGuard & ) = delete;
+
+            explicit VersionGuard( BTree & node ) : node_( node )
+            {
+                using namespace std;
+
+                const auto self = this_thread::get_id();
+                if ( node_.latch_owner_.load( memory_order_relaxed ) == self ) return;
+
+                node_.latch_.lock();
+                node_.latch_owner_.store( self, memory_order_relaxed );
+
+                // write-back dirty node is imaged before a batch modifies it
+                try
+                {
+                    node_.cache_.preserve( node_ );
+                }
+                catch ( ... )
+                {
+                    node_.latch_owner_.store( thread::id{}, memory_order_relaxed );
+                    node_.latch_.unlock();
+                    throw;
+                }
+
+                node_.version_.fetch_add( 1, memory_order_relaxed );
+                atomic_thread_fence( memory_order_release );
+
+                owner_ = true;
+            }
+
+            ~VersionGuard()
+            {
+                if ( !owner_ ) return;
+
+                node_.compact();
+                node_.reindex();
+                node_.version_.fetch_add( 1, std::memory_order_release );
+                node_.latch_owner_.store( std::thread::id{}, std::memory_order_relaxed );
+                node_.latch_.unlock();
+            }
+        };
+
 
         /* Output streaming operator for b-tree node element
 
@@ -250,7 +438,7 @@ namespace jb
         */
         friend std::ostream & operator << ( std::ostream & os, const BTree & node )
         {
-            throw_logic_error( node.elements_.size() < BTreeMax, "Maximum size of b-tree node exceeded" );
+            throw_logic_error( node.elements_.size() < node.btree_max_, "Maximum size of b-tree node exceeded" );
             throw_logic_error( node.elements_.size() + 1 == node.links_.size(), "Broken b-tree node" );
 
             big_uint64_t size = node.elements_.size();
@@ -267,6 +455,19 @@ namespace jb
                 os.write( reinterpret_cast< const char * >( &link ), sizeof( link ) );
             }
 
+            // subkey names go after the links, elements are ordered by digests, so neighbouring names
+            // have nothing in common and are stored as is
+            for ( const auto & e : node.elements_ )
+            {
+                const auto & name = e.name_;
+                throw_btree_error( name.size() <= std::numeric_limits< uint32_t >::max(), RetCode::InvalidKey, "Too long subkey name" );
+
+                big_uint32_t name_size = static_cast< uint32_t >( name.size() );
+                os.write( reinterpret_cast< const char * >( &name_size ), sizeof( name_size ) );
+                os.write( reinterpret_cast< const char * >( name.data() ), static_cast< std::streamsize >( name.size() * sizeof( typename Key::value_type ) ) );
+                throw_btree_error( os.good(), RetCode::UnknownError );
+            }
+
             return os;
         }
 
@@ -284,7 +485,7 @@ namespace jb
             is.read( reinterpret_cast< char* >( &size ), sizeof( size ) );
             size_t sz = static_cast< size_t >( size );
 
-            throw_btree_error( sz < BTreeMax, RetCode::InvalidData, "Maximum size of b-tree node exceeded" );
+            throw_btree_error( sz < node.btree_max_, RetCode::InvalidData, "Maximum size of b-tree node exceeded" );
 
             node.elements_.resize( sz );
             node.links_.resize( sz + 1 );
@@ -301,6 +502,28 @@ namespace jb
                 l = link;
             }
 
+            for ( auto & e : node.elements_ )
+            {
+                big_uint32_t name_size;
+                is.read( reinterpret_cast< char* >( &name_size ), sizeof( name_size ) );
+                throw_btree_error( is.good(), RetCode::InvalidData, "Unable to read subkey name" );
+
+                // the size comes from the file and may be broken, so the name grows as the chain delivers it
+                const size_t size = name_size;
+                e.name_.clear();
+
+                for ( size_t got = 0; got < size; )
+                {
+                    const size_t slice = std::min( size - got, std::max( NameSlice, got ) );
+
+                    e.name_.resize( got + slice );
+                    is.read( reinterpret_cast< char* >( e.name_.data() + got ), static_cast< std::streamsize >( slice * sizeof( typename Key::value_type ) ) );
+                    throw_btree_error( is.good(), RetCode::InvalidData, "Unable to read subkey name" );
+
+                    got += slice;
+                }
+            }
+
             return is;
         }
 
@@ -313,7 +536,10 @@ namespace jb
         */
         void save( Transaction & t ) const
         {
-            auto buffer = t.get_chain_writer< char >();
+            // batch operation writes the node once at the end
+            if ( cache_.defer_batch_write( this ) ) return;
+
+            auto buffer = t.template get_chain_writer< char >();
 
             std::ostream os( &buffer );
             os << *this;
@@ -323,6 +549,8 @@ namespace jb
             std::swap( uid, const_cast< BTree* >( this )->uid_ );
 
             cache_.update_uid( uid, uid_ );
+            cache_.mark_clean( this );
+            cache_.note_batch_write( uid_ );
         }
 
 
@@ -333,11 +561,19 @@ namespace jb
         */
         void overwrite( Transaction & t ) const
         {
-            auto buffer = t.get_chain_overwriter< char >( uid_ );
+            // batch operation writes the node once at the end
+            if ( cache_.defer_batch_write( this ) ) return;
+
+            auto buffer = t.template get_chain_overwriter< char >( uid_ );
             
             std::ostream os( &buffer );
             os << *this;
             os.flush();
+
+            // the file keeps the old content till the commit, readers must not reload the node meanwhile
+            if ( auto node = cache_.find_node( uid_ ); node.get() == this ) t.keep( std::move( node ) );
+
+            cache_.mark_clean( this );
         }
 
 
@@ -355,6 +591,83 @@ namespace jb
             is >> *this;
 
             uid_ = uid;
+            reindex();
+        }
+
+
+        /* Returns excessive capacity of the elements to the slab pool
+
+        The capacity is kept if it's less than twice the size, so a node growing by single elements
+        does not reallocate on each insertion
+
+        @throw nothing
+        */
+        void compact() noexcept
+        {
+            if ( elements_.capacity() <= 2 * elements_.size() ) return;
+
+            try
+            {
+                elements_.shrink_to_fit();
+            }
+            catch ( const std::bad_alloc & )
+            {
+                // the node just keeps the capacity
+            }
+        }
+
+
+        /* Rebuilds digest mirror after modification of the elements
+
+        Every modification of a node is done under VersionGuard that rebuilds the mirror on release,
+        so the mirror stays consistent while the node is available for searching
+
+        @throw nothing
+        @note failure to grow the mirror terminates, the node cannot be published without it
+        */
+        void reindex() const noexcept
+        {
+            using namespace std;
+
+            digests_.resize( elements_.size() );
+            transform( begin( elements_ ), end( elements_ ), begin( digests_ ), [] ( const auto & e ) noexcept {
+                return e.digest_;
+            } );
+
+            if constexpr ( BTreeEytzinger )
+            {
+                eytzinger_.digests_.resize( digests_.size() );
+                eytzinger_.ranks_.resize( digests_.size() );
+                details::eytzinger_layout( digests_.data(), digests_.size(), eytzinger_.digests_.data(), eytzinger_.ranks_.data() );
+            }
+        }
+
+
+        /* Finds position of the first digest not less than given one in the node
+
+        May be called by optimistic readers without locking, so torn reads never go beyond the
+        storage of the node, the result must be validated by the node version
+
+        @param [in] digest - digest to be found
+        @retval Pos - lower bound position
+        @throw nothing
+        */
+        Pos search_digest( Digest digest ) const noexcept
+        {
+            using namespace std;
+
+            const auto[ digests, size ] = digests_.view();
+
+            if constexpr ( BTreeEytzinger )
+            {
+                const auto[ layout, layout_size ] = eytzinger_.digests_.view();
+                const auto[ ranks, ranks_size ] = eytzinger_.ranks_.view();
+                return min< size_t >( details::eytzinger_lower_bound( layout, ranks, min( { layout_size, ranks_size, size } ), digest ), size );
+            }
+            else
+            {
+                return details::digest_lower_bound( digests, size, digest );
+            }
         }
 
 
@@ -362,22 +675,22 @@ namespace jb
 
         @param [in] l - the left part
         @param [in] r - the right part
-        @throw nothing
+        @throw std::bad_alloc
         */
-        auto split_overflown_node( BTree & l, BTree & r ) const noexcept
+        auto split_overflown_node( BTree & l, BTree & r ) const
         {
             using namespace std;
 
-            throw_logic_error( elements_.size() == BTreeMax, "A node is not overflown" );
+            throw_logic_error( elements_.size() == btree_max_, "A node is not overflown" );
 
             l.elements_.clear(); l.links_.clear();
             r.elements_.clear(); r.links_.clear();
 
-            l.elements_.insert( begin( l.elements_ ), begin( elements_ ), begin( elements_ ) + BTreeMin );
-            r.elements_.insert( begin( r.elements_ ), end( elements_ ) - BTreeMin, end( elements_ ) );
+            l.elements_.insert( begin( l.elements_ ), begin( elements_ ), begin( elements_ ) + btree_min_ );
+            r.elements_.insert( begin( r.elements_ ), end( elements_ ) - btree_min_, end( elements_ ) );
 
-            l.links_.insert( begin( l.links_ ), begin( links_ ), begin( links_ ) + BTreeMin + 1 );
-            r.links_.insert( begin( r.links_ ), end( links_ ) - BTreeMin - 1, end( links_ ) );
+            l.links_.insert( begin( l.links_ ), begin( links_ ), begin( links_ ) + btree_min_ + 1 );
+            r.links_.insert( begin( r.links_ ), end( links_ ) - btree_min_ - 1, end( links_ ) );
         }
 
 
@@ -395,22 +708,28 @@ namespace jb
             using namespace std;
 
             throw_logic_error( elements_.size() + 1 == links_.size(), "Broken b-tree node" );
-            throw_logic_error( elements_.size() < BTreeMax, "A node is overflown" );
+            throw_logic_error( elements_.size() < btree_max_, "A node is overflown" );
             throw_logic_error( pos < elements_.size() + 1, "Invalid insert position" );
 
+            VersionGuard latch( *this );
+
             // if the element exists
             if ( pos < elements_.size() && e.digest_ == elements_[ pos ].digest_ )
             {
+                const bool buried = Tombstone == elements_[ pos ].good_before_;
+
                 // if overwriting possible?
-                throw_btree_error( ow, RetCode::AlreadyExists );
+                throw_btree_error( ow || buried, RetCode::AlreadyExists );
 
                 // erase blob for old value
                 elements_[ pos ].value_.erase_blob( t );
 
-                // emplace element at existing position
-                auto old_expiration = elements_[ pos ].good_before_;
+                // emplace element at existing position, children of the key survive its overwriting
+                auto old_expiration = buried ? 0 : elements_[ pos ].good_before_;
+                auto old_children = elements_[ pos ].children_;
                 elements_[ pos ] = e;
                 elements_[ pos ].good_before_ = elements_[ pos ].good_before_ ? elements_[ pos ].good_before_ : old_expiration;
+                elements_[ pos ].children_ = InvalidNodeUid != e.children_ ? e.children_ : old_children;
 
                 // overwrite node
                 return overwrite( t );
@@ -418,13 +737,13 @@ namespace jb
             else
             {
                 // insert element at the pos
-                assert( !pos || elements_[ pos - 1 ] < e && elements_.size() <= pos || e < elements_[ pos ] );
+                assert( ( !pos || elements_[ pos - 1 ] < e ) && ( elements_.size() <= pos || e < elements_[ pos ] ) );
                 elements_.insert( begin( elements_ ) + pos, e );
                 links_.insert( begin( links_ ) + pos, InvalidNodeUid );
             }
 
             // if this node overflow
-            if ( elements_.size() == BTreeMax )
+            if ( elements_.size() == btree_max_ )
             {
                 bpath.empty() ? process_overflown_root( t ) : split_and_araise_median( t, bpath );
             }
@@ -447,7 +766,9 @@ namespace jb
             using namespace std;
 
             throw_logic_error( elements_.size() + 1 == links_.size(), "Broken b-tree node" );
-            throw_logic_error( elements_.size() == BTreeMax, "Root is not overflown" );
+            throw_logic_error( elements_.size() == btree_max_, "Root is not overflown" );
+
+            VersionGuard latch( *this );
 
             // split this item into 2 new and save them
             BTree l( file_, cache_ ); BTree r( file_, cache_ );
@@ -456,7 +777,7 @@ namespace jb
             r.save( t );
 
             // leave only mediane element...
-            elements_[ 0 ] = move( elements_[ BTreeMin ] );
+            elements_[ 0 ] = move( elements_[ btree_min_ ] );
             elements_.resize( 1 );
 
             // with links to new items
@@ -470,7 +791,9 @@ namespace jb
 
         /* Process overflow of non root node
 
-        Splits node into 2 ones and araises median element to the parent node
+        Splits node into 2 ones and araises median element to the parent node. The parent is latched
+        while the node is still latched: writers of a b-tree are serialized by the key lock, so there
+        is no writer to share the node with, and readers see both nodes replaced at once
 
         @param [out] t - transaction
         @param [in] bpath - path in btree
@@ -482,7 +805,7 @@ namespace jb
             using namespace std;
 
             throw_logic_error( elements_.size() + 1 == links_.size(), "Broken b-tree node" );
-            throw_logic_error( elements_.size() == BTreeMax, "Root is not overflown" );
+            throw_logic_error( elements_.size() == btree_max_, "Root is not overflown" );
             throw_logic_error( bpath.size(), "This is root" );
 
             // split node into 2 new and save them
@@ -492,21 +815,23 @@ namespace jb
             r.save( t );
 
             // get parent b-tree path
-            BTreePath::value_type parent_path = move( bpath.back() ); bpath.pop_back();
+            typename BTreePath::value_type parent_path = move( bpath.back() ); bpath.pop_back();
+
+            // latch parent before this node disappears, readers will not come here through stale link
+            auto parent = cache_.get_node( parent_path.first );
+            VersionGuard parent_latch( *parent );
 
             // remove this node from storage and drop it from cache
             t.erase_chain( uid_ );
             cache_.drop( uid_ );
 
             // and insert mediane element to parent
-            auto parent = cache_.get_node( parent_path.first );
-
             parent->insert_araising_element(
                 t,
                 parent_path.second,
                 bpath,
                 l.uid_,
-                move( elements_[ BTreeMin ] ),
+                move( elements_[ btree_min_ ] ),
                 r.uid_
             );
         }
@@ -537,13 +862,15 @@ namespace jb
 
             throw_logic_error( elements_.size() + 1 == links_.size(), "Broken b-tree node" );
 
+            VersionGuard latch( *this );
+
             // insert araising element
             elements_.insert( begin( elements_ ) + pos, e );
             links_.insert( begin( links_ ) + pos, l_link );
             links_[ pos + 1 ] = r_link;
 
             // check node for overflow
-            if ( elements_.size() == BTreeMax )
+            if ( elements_.size() == btree_max_ )
             {
                 // if this is root node of b-tree
                 if ( bpath.empty() )
@@ -578,568 +905,3498 @@ namespace jb
 
         /* Erases an element at given position
 
+        The element is removed from the b-tree structure only, its BLOB and children b-tree must be
+        handled by the caller. An element of internal node is replaced with its predecessor from a
+        leaf, the predecessor is moved, so erasing of the leaf copy does not touch its BLOB either.
+        Underflow is propagated up through the path
+
         @param [in] transaction - active transaction
         @param [in] pos - position of an element to be erased
         @param [in] bpath - b-tree path
-        @param [in] entry_level - level of a node in b-tree
         @throw btree_error, btree_cache_error, storage_file_error
+        @note must run within a batch, see run_batch(), since the nodes are modified in place and
+              relocation of several of them is resolved by writing of the batch
         */
-        void erase_element( Transaction & t, Pos pos, BTreePath bpath, size_t entry_level )
+        void erase_element( Transaction & t, Pos pos, BTreePath bpath )
         {
             using namespace std;
 
             throw_logic_error( pos < elements_.size(), "Invalid position" );
             throw_logic_error( elements_.size() + 1 == links_.size(), "Broken b-tree node" );
 
-            // erase BLOB for the elements
-            elements_[ pos ].value_.erase_blob( t );
+            VersionGuard latch( *this );
 
             if ( !is_leaf() )
             {
                 throw_logic_error( links_[ pos ] != InvalidNodeUid, "Imbalanced tree" );
-                throw_logic_error( links_[ pos + 1 ] != InvalidNodeUid, "Imbalanced tree" );
-
-                // get left child node
-                BTreeP left_child = cache_.get_node( links_[ pos ] );
-
-                // if left child is rich enough
-                if ( left_child->elements_.size() > BTreeMin )
-                {
-                    auto bpath_size = bpath.size();
-
-                    bpath.emplace_back( uid_, pos + 1 );
-                    auto node = left_child;
-
-                    // search for maximum element of the left subtree
-                    while ( InvalidNodeUid != node->links_.back() )
-                    {
-                        bpath.emplace_back( node->uid_, node->elements_.size() );
-                        node = cache_.get_node( node->links_.back() );
-                    }
-
-                    // bring the minimum element of right subtree
-                    elements_[ pos ] = node->elements_.back();
-
-                    // and erase it
-                    node->erase_element( t, node->elements_.size() - 1, bpath, entry_level );
-
-                    // update link to the right child
-                    links_[ pos + 1 ] = left_child->uid_;
-
-                    bpath.resize( bpath_size );
-
-                    // save this one
-                    entry_level == bpath.size() ? overwrite( t ) : save( t );
-
-                    return;
-                }
-
-                // get right child node
-                BTreeP right_child = cache_.get_node( links_[ pos + 1 ] );
-
-                // if right child is rich enough
-                if ( right_child->elements_.size() > BTreeMin )
-                {
-                    auto bpath_size = bpath.size();
-
-                    bpath.emplace_back( uid_, pos + 1 );
-                    auto node = right_child;
-
-                    // search for minimum element of the right subtree
-                    while ( InvalidNodeUid != node->links_[ 0 ] )
-                    {
-                        bpath.emplace_back( node->uid_, 0 );
-                        node = cache_.get_node( node->links_[ 0 ] );
-                    }
-
-                    // bring the minimum element of the right subtree
-                    elements_[ pos ] = node->elements_[ 0 ];
-
-                    // and erase it
-                    node->erase_element( t, 0, bpath, entry_level );
 
-                    // update link to the right child
-                    links_[ pos + 1 ] = right_child->uid_;
+                // search for maximum element of the left subtree
+                bpath.emplace_back( uid_, pos );
+                auto node = cache_.get_node( links_[ pos ] );
 
-                    bpath.resize( bpath_size );
-
-                    // save this one
-                    entry_level == bpath.size() ? overwrite( t ) : save( t );
-
-                    return;
-                }
-
-                // left child absorbs this element and right child
-                left_child->absorb( elements_[ pos ], *right_child );
-                elements_.erase( begin( elements_ ) + pos );
-                links_.erase( begin( links_ ) + pos + 1 );
-
-                if ( elements_.size() )
+                while ( InvalidNodeUid != node->links_.back() )
                 {
-                    bpath.emplace_back( uid_, pos );
-                    left_child->erase_element( t, BTreeMin, bpath, entry_level );
-                    bpath.pop_back();
-
-                    links_[ pos ] = left_child->uid_;
-
-                    t.erase_chain( right_child->uid_ );
-                    cache_.drop( right_child->uid_ );
+                    bpath.emplace_back( node->uid_, node->elements_.size() );
+                    node = cache_.get_node( node->links_.back() );
                 }
-                else
-                {
-                    elements_ = left_child->elements_;
-                    links_ = left_child->links_;
 
-                    erase_element( t, BTreeMin, bpath, entry_level );
-
-                    t.erase_chain( left_child->uid_ );
-                    cache_.drop( left_child->uid_ );
-
-                    t.erase_chain( right_child->uid_ );
-                    cache_.drop( right_child->uid_ );
-                }
+                // bring it here
+                elements_[ pos ] = node->elements_.back();
+                overwrite( t );
 
-                // save this one
-                entry_level == bpath.size() ? overwrite( t ) : save( t );
+                // and erase it from the leaf
+                node->erase_element( t, node->elements_.size() - 1, move( bpath ) );
             }
             else
             {
                 elements_.erase( begin( elements_ ) + pos );
                 links_.erase( begin( links_ ) + pos );
 
-                if ( elements_.size() < BTreeMin && uid_ != RootNodeUid )
+                if ( elements_.size() < btree_min_ && !bpath.empty() )
                 {
-                    return process_leaf_underflow( t, bpath, entry_level );
+                    process_underflow( t, bpath );
                 }
                 else
                 {
-                    // save this one
-                    entry_level < bpath.size() ? save( t ) : overwrite( t );
+                    overwrite( t );
                 }
             }
         }
 
 
-        /* Handles underflown leaf upon erasing operation
+        /* Handles underflown non-root node upon erasing operation
+
+        The node borrows an element from a rich sibling through the parent or is merged with a poor
+        one. Merging takes an element of the parent, so the parent may underflow in turn. The root
+        that loses its last element is replaced with the only child
 
         @param [in] transaction - active transaction
         @param [in] bpath - b-tree path
-        @param [in] entry_level - level of a node containing element to be erased
         @throw btree_error, btree_cache_error, storage_file_error
+        @note must run within a batch, see erase_element()
         */
-        void process_leaf_underflow( Transaction & t, BTreePath & bpath, size_t entry_level )
+        void process_underflow( Transaction & t, BTreePath & bpath )
         {
             using namespace std;
 
             throw_logic_error( elements_.size() + 1 == links_.size(), "Broken b-tree node" );
-            throw_logic_error( elements_.size() < BTreeMin, "The node is not underflown" );
-            throw_logic_error( is_leaf(), "The node is not a leaf" );
+            throw_logic_error( elements_.size() < btree_min_, "The node is not underflown" );
+            throw_logic_error( bpath.size(), "This is root" );
 
-            // if this is the root node
-            if ( bpath.empty() )
-            {
-                overwrite( t );
-                return;
-            }
+            VersionGuard latch( *this );
 
             // exract parent info from the path
-            auto parent_ref = move( bpath.back() );
+            const auto[ parent_uid, link ] = bpath.back();
+            bpath.pop_back();
 
-            // get parent node
-            auto parent = cache_.get_node( parent_ref.first );
+            // get parent node and latch it before touching its children
+            auto parent = cache_.get_node( parent_uid );
+            VersionGuard parent_latch( *parent );
 
-            // get left sibling node
-            BTreeP left_sibling;
+            throw_logic_error( parent->links_[ link ] == uid_, "Broken b-tree path" );
 
-            // if left sibling exists - load it
-            if ( 0 < parent_ref.second && InvalidNodeUid != parent->links_[ parent_ref.second - 1 ] )
-            {
-                left_sibling = cache_.get_node( parent->links_[ parent_ref.second - 1 ] );
-                throw_logic_error( left_sibling->is_leaf(), "Imbalanced tree" );
-            }
+            // get siblings and latch them
+            BTreeP left_sibling = link > 0 ? cache_.get_node( parent->links_[ link - 1 ] ) : nullptr;
+            BTreeP right_sibling = link < parent->elements_.size() ? cache_.get_node( parent->links_[ link + 1 ] ) : nullptr;
 
-            // if left sibling is rich
-            if ( left_sibling && left_sibling->elements_.size() > BTreeMin )
+            std::optional< VersionGuard > left_latch, right_latch;
+            if ( left_sibling ) left_latch.emplace( *left_sibling );
+            if ( right_sibling ) right_latch.emplace( *right_sibling );
+
+            // if left sibling is rich: rotate its last element through the parent
+            if ( left_sibling && left_sibling->elements_.size() > btree_min_ )
             {
-                // prepend parent key to this node
-                elements_.insert( begin( elements_ ), parent->elements_[ parent_ref.second - 1 ] );
-                links_.push_back( InvalidNodeUid );
+                elements_.insert( begin( elements_ ), parent->elements_[ link - 1 ] );
+                links_.insert( begin( links_ ), left_sibling->links_.back() );
 
-                // set parent key to the last of left sibling
-                parent->elements_[ parent_ref.second - 1 ] = left_sibling->elements_.back();
+                parent->elements_[ link - 1 ] = left_sibling->elements_.back();
 
-                // consume the last of left sibling
-                auto e = left_sibling->elements_.back().digest_;
                 left_sibling->elements_.pop_back();
                 left_sibling->links_.pop_back();
 
-                // save this and the sibling
-                save( t );
-                left_sibling->save( t );
-
-                // update parent's links
-                parent->links_[ parent_ref.second ] = uid_;
-                parent->links_[ parent_ref.second - 1 ] = left_sibling->uid_;
-
-                // done: save parent 
-                if ( entry_level == bpath.size() )
-                {
-                    parent->overwrite( t );
-                }
+                overwrite( t );
+                left_sibling->overwrite( t );
+                parent->overwrite( t );
 
                 return;
             }
 
-            // get right sibling node
-            BTreeP right_sibling;
-
-            if ( parent_ref.second + 1 < parent->elements_.size() && InvalidNodeUid != parent->links_[ parent_ref.second + 1 ] )
-            {
-                right_sibling = cache_.get_node( parent->links_[ parent_ref.second + 1 ] );
-                throw_logic_error( right_sibling->is_leaf(), "Imbalanced tree" );
-            }
-
-            // if right sibling is rich
-            if ( right_sibling && right_sibling->elements_.size() > BTreeMin )
+            // if right sibling is rich: rotate its first element through the parent
+            if ( right_sibling && right_sibling->elements_.size() > btree_min_ )
             {
-                // append parent key
-                elements_.push_back( parent->elements_[ parent_ref.second + 1 ] );
-                links_.push_back( InvalidNodeUid );
+                elements_.push_back( parent->elements_[ link ] );
+                links_.push_back( right_sibling->links_.front() );
 
-                // assign parent key with the first of right sibling
-                parent->elements_[ parent_ref.second + 1 ] = right_sibling->elements_.front();
+                parent->elements_[ link ] = right_sibling->elements_.front();
 
-                // consume the first element of right sibling
-                auto e = right_sibling->elements_[ 0 ].digest_;
                 right_sibling->elements_.erase( begin( right_sibling->elements_ ) );
-                right_sibling->links_.pop_back();
-
-                // save this and the sibling
-                save( t );
-                right_sibling->save( t );
-
-                // update parent's links
-                parent->links_[ parent_ref.second ] = uid_;
-                parent->links_[ parent_ref.second + 1 ] = right_sibling->uid_;
+                right_sibling->links_.erase( begin( right_sibling->links_ ) );
 
-                // done: save parent 
-                if ( entry_level == bpath.size() )
-                {
-                    parent->overwrite( t );
-                }
+                overwrite( t );
+                right_sibling->overwrite( t );
+                parent->overwrite( t );
 
                 return;
             }
 
-            // if both sibling are poor and left sibling exists
+            // both siblings are poor: merge with one of them, the left node absorbs the right one
+            BTreeP merged;
+
             if ( left_sibling )
             {
-                // merge this b-tree node with the left sibling
-                left_sibling->absorb( parent->elements_[ parent_ref.second - 1 ], *this );
+                left_sibling->absorb( parent->elements_[ link - 1 ], *this );
 
-                parent->elements_.erase( begin( parent->elements_ ) + parent_ref.second - 1 );
-                parent->links_.erase( begin( parent->links_ ) + parent_ref.second );
+                parent->elements_.erase( begin( parent->elements_ ) + link - 1 );
+                parent->links_.erase( begin( parent->links_ ) + link );
 
                 t.erase_chain( uid_ );
                 cache_.drop( uid_ );
 
-                if ( parent->elements_.size() )
-                {
-                    left_sibling->save( t );
-                    parent->links_[ parent_ref.second - 1 ] = left_sibling->uid_;
-                }
-                else
-                {
-                    parent->elements_ = left_sibling->elements_;
-                    parent->links_ = left_sibling->links_;
-
-                    t.erase_chain( left_sibling->uid_ );
-                    cache_.drop( left_sibling->uid_ );
-                }
-
-                // done: save parent 
-                if ( entry_level == bpath.size() )
-                {
-                    parent->overwrite( t );
-                }
-
-                return;
+                merged = left_sibling;
             }
-
-            // if both siblings are poor and right sibling exists
-            if ( right_sibling )
+            else
             {
-                // merge this b-tree node with the left sibling
-                absorb( parent->elements_[ parent_ref.second ], *right_sibling );
+                throw_logic_error( right_sibling != nullptr, "Imbalanced b-tree" );
+
+                absorb( parent->elements_[ link ], *right_sibling );
 
-                parent->elements_.erase( begin( parent->elements_ ) + parent_ref.second );
-                parent->links_.erase( begin( parent->links_ ) + parent_ref.second + 1 );
+                parent->elements_.erase( begin( parent->elements_ ) + link );
+                parent->links_.erase( begin( parent->links_ ) + link + 1 );
 
                 t.erase_chain( right_sibling->uid_ );
                 cache_.drop( right_sibling->uid_ );
 
-                if ( parent->elements_.size() )
-                {
-                    save( t );
-                    parent->links_[ parent_ref.second ] = uid_;
-                }
-                else
-                {
-                    parent->elements_ = elements_;
-                    parent->links_ = links_;
+                merged = cache_.get_node( uid_ );
+            }
 
-                    t.erase_chain( uid_ );
-                    cache_.drop( uid_ );
-                }
+            // the root has lost its last element: the merged node becomes the root
+            if ( bpath.empty() && parent->elements_.empty() )
+            {
+                VersionGuard merged_latch( *merged );
 
-                // done: save parent 
-                if ( entry_level == bpath.size() )
-                {
-                    parent->overwrite( t );
-                }
+                parent->elements_ = merged->elements_;
+                parent->links_ = merged->links_;
+
+                t.erase_chain( merged->uid_ );
+                cache_.drop( merged->uid_ );
 
+                parent->overwrite( t );
                 return;
             }
 
-            // die
-            throw_logic_error( false, "Imbalanced b-tree" );
+            merged->overwrite( t );
+
+            if ( !bpath.empty() && parent->elements_.size() < btree_min_ )
+            {
+                parent->process_underflow( t, bpath );
+            }
+            else
+            {
+                parent->overwrite( t );
+            }
         }
 
 
-        /* Absorbs element and right sibling node. Given element becomes new mediane
+        /* Provides position of the first element not less than a digest
 
-        @param [in] mediane - element to be used as new mediane
-        @param [in] right_sibling - right sibling node
+        Unlike search through digest mirror works for latched node which mirror may be outdated
+
+        @param [in] digest - digest to be found
+        @retval Pos - position
         @throw nothing
         */
-        void absorb( const Element & mediane, BTree & right_sibling ) noexcept
+        Pos element_lower_bound( Digest digest ) const noexcept
         {
             using namespace std;
 
-            throw_logic_error( elements_.size() + right_sibling.elements_.size() + 1 <= BTreeMax );
-
-            elements_.insert( end( elements_ ), mediane );
-            elements_.insert( end( elements_ ), begin( right_sibling.elements_ ), end( right_sibling.elements_ ) );
-            links_.insert( end( links_ ), begin( right_sibling.links_ ), end( right_sibling.links_ ) );
+            return static_cast< Pos >( lower_bound( begin( elements_ ), end( elements_ ), digest, [] ( const auto & e, auto d ) noexcept {
+                return e.digest_ < d;
+            } ) - begin( elements_ ) );
         }
 
 
-    public:
+        /* Passes the last element of left child through this node to the right child
 
-        /** The class is not default creatible/copyable/movable
+        @param [in] sep - position of the element between the children
+        @param [in] left - left child
+        @param [in] right - right child
+        @throw std::bad_alloc
+        @note the caller must hold VersionGuard over this node and both children
         */
-        BTree() = delete;
-        BTree( BTree&& ) = delete;
-
+        void rotate_right( Pos sep, BTree & left, BTree & right )
+        {
+            using namespace std;
 
-        /* Explicit constructor
+            right.elements_.insert( begin( right.elements_ ), move( elements_[ sep ] ) );
+            right.links_.insert( begin( right.links_ ), left.links_.back() );
 
-        @param [in] file - associated storage file
-        @param [in] cache - associated b-tree node cache
-        @throw nothing
-        */
-        explicit BTree( StorageFile & file, BTreeCache & cache ) noexcept
-            : uid_( InvalidNodeUid )
-            , file_( file )
-            , cache_( cache )
-        {
-            links_.push_back( InvalidNodeUid );
+            elements_[ sep ] = move( left.elements_.back() );
+            left.elements_.pop_back();
+            left.links_.pop_back();
+        }
+
+
+        /* Passes the first element of right child through this node to the left child
+
+        @param [in] sep - position of the element between the children
+        @param [in] left - left child
+        @param [in] right - right child
+        @throw std::bad_alloc
+        @note the caller must hold VersionGuard over this node and both children
+        */
+        void rotate_left( Pos sep, BTree & left, BTree & right )
+        {
+            using namespace std;
+
+            left.elements_.push_back( move( elements_[ sep ] ) );
+            left.links_.push_back( right.links_.front() );
+
+            elements_[ sep ] = move( right.elements_.front() );
+            right.elements_.erase( begin( right.elements_ ) );
+            right.links_.erase( begin( right.links_ ) );
+        }
+
+
+        /* Finds a sibling that can take an element from full child on the way down
+
+        The element is passed on the side away from the digest, so the descent stays in the child
+
+        @param [in] pos - position of the link to the child
+        @param [in] child - full child
+        @param [in] digest - digest the descent goes to
+        @retval BTreeP - sibling having room or nullptr
+        @retval bool - true if the sibling is the right one
+        @throw btree_cache_error, btree_error, storage_file_error
+        */
+        std::tuple< BTreeP, bool > find_room( Pos pos, const BTree & child, Digest digest ) const
+        {
+            if ( pos < elements_.size() && digest < child.elements_.back().digest_ )
+            {
+                auto right = cache_.get_node( links_[ pos + 1 ] );
+                if ( right->elements_.size() + 1 < btree_max_ ) return { right, true };
+            }
+
+            if ( pos > 0 && child.elements_.front().digest_ < digest )
+            {
+                auto left = cache_.get_node( links_[ pos - 1 ] );
+                if ( left->elements_.size() + 1 < btree_max_ ) return { left, false };
+            }
+
+            return { nullptr, false };
+        }
+
+
+        /* Finds a sibling that can give an element to minimal child on the way down
+
+        @param [in] pos - position of the link to the child
+        @retval BTreeP - sibling having more than minimal number of elements or nullptr
+        @retval bool - true if the sibling is the right one
+        @throw btree_cache_error, btree_error, storage_file_error
+        */
+        std::tuple< BTreeP, bool > find_donor( Pos pos ) const
+        {
+            if ( pos > 0 )
+            {
+                auto left = cache_.get_node( links_[ pos - 1 ] );
+                if ( left->elements_.size() > btree_min_ ) return { left, false };
+            }
+
+            if ( pos < elements_.size() )
+            {
+                auto right = cache_.get_node( links_[ pos + 1 ] );
+                if ( right->elements_.size() > btree_min_ ) return { right, true };
+            }
+
+            return { nullptr, false };
+        }
+
+
+        /* Finds a child which can give the closest element to replace erased element of internal node
+
+        @param [in] pos - position of the element
+        @retval BTreeP - child having more than minimal number of elements or nullptr
+        @retval bool - true if the child is the left one, i.e. the predecessor is taken
+        @throw btree_cache_error, btree_error, storage_file_error
+        */
+        std::tuple< BTreeP, bool > find_replacement( Pos pos ) const
+        {
+            auto left = cache_.get_node( links_[ pos ] );
+            if ( left->elements_.size() > btree_min_ ) return { left, true };
+
+            auto right = cache_.get_node( links_[ pos + 1 ] );
+            if ( right->elements_.size() > btree_min_ ) return { right, false };
+
+            return { nullptr, false };
+        }
+
+
+        /* Provides the leaf holding the first or the last element of a subtree
+
+        @param [in] node - root of the subtree
+        @param [in] last - the last element is wanted
+        @retval BTreeP - the leaf
+        @throw btree_cache_error, btree_error, storage_file_error
+        */
+        BTreeP outermost_leaf( BTreeP node, bool last ) const
+        {
+            while ( !node->is_leaf() )
+            {
+                node = cache_.get_node( last ? node->links_.back() : node->links_.front() );
+            }
+
+            return node;
+        }
+
+
+        /* Digests and links of a node as a descent would leave it, lets to check the descent in
+        advance without modifying the nodes
+        */
+        struct Sketch
+        {
+            std::vector< Digest > digests_;
+            std::vector< NodeUid > links_;
+
+            explicit Sketch( const BTree & node ) : links_( node.links_.begin(), node.links_.end() )
+            {
+                digests_.reserve( node.elements_.size() );
+                for ( const auto & e : node.elements_ ) digests_.push_back( e.digest_ );
+            }
+
+            bool is_leaf() const noexcept
+            {
+                return std::all_of( links_.begin(), links_.end(), [] ( auto l ) { return InvalidNodeUid == l; } );
+            }
+
+            Pos lower_bound( Digest digest ) const noexcept
+            {
+                return static_cast< Pos >( std::lower_bound( digests_.begin(), digests_.end(), digest ) - digests_.begin() );
+            }
+        };
+
+
+        /* Checks if new element can go from this root down to a leaf once
+
+        A full node cannot be split on the way down: the maximum number of elements is twice the
+        minimum, so one of the halves would be short. Instead full child passes an element to a
+        sibling having room, and nodes are split bottom-up only. The check follows the descent
+        including the changes it would make to the nodes on the path, so the descent never meets a
+        child it cannot relieve. The number of levels is counted on the way
+
+        @param [in] digest - digest of new element
+        @retval std::optional< size_t > - number of levels below the root, nothing if the insertion must go bottom-up
+        @throw btree_error, btree_cache_error, storage_file_error
+        @note the caller must be the only writer of the b-tree
+        */
+        std::optional< size_t > insert_top_down_levels( Digest digest ) const
+        {
+            using namespace std;
+
+            auto has_room = [this] ( NodeUid uid ) { return cache_.get_node( uid )->elements_.size() + 1 < btree_max_; };
+
+            Sketch node( *this );
+
+            for ( size_t levels = 0; ; ++levels )
+            {
+                // only the root may be full here
+                if ( node.is_leaf() ) return node.digests_.size() + 1 < btree_max_ ? optional< size_t >{ levels } : nullopt;
+
+                const auto pos = node.lower_bound( digest );
+                Sketch child( *cache_.get_node( node.links_[ pos ] ) );
+
+                // the same choice as find_room() does
+                if ( child.digests_.size() + 1 == btree_max_ )
+                {
+                    if ( pos < node.digests_.size() && digest < child.digests_.back() && has_room( node.links_[ pos + 1 ] ) )
+                    {
+                        child.digests_.pop_back();
+                        child.links_.pop_back();
+                    }
+                    else if ( pos > 0 && child.digests_.front() < digest && has_room( node.links_[ pos - 1 ] ) )
+                    {
+                        child.digests_.erase( child.digests_.begin() );
+                        child.links_.erase( child.links_.begin() );
+                    }
+                    else
+                    {
+                        return nullopt;
+                    }
+                }
+
+                node = move( child );
+            }
+        }
+
+
+        /* Checks if an element can be erased going from this root down to a leaf once
+
+        Minimal node cannot be merged with minimal sibling on the way down: together with the
+        separator they would exceed the maximum. Instead minimal child takes an element from a
+        sibling having more, and nodes are merged bottom-up only. The check follows the descent
+        including the changes it would make to the nodes on the path, so the descent never meets a
+        child it cannot top up. The number of levels is counted on the way
+
+        @param [in] digest - digest of the element
+        @retval std::optional< size_t > - number of levels below the root, nothing if the erasing must go bottom-up
+        @throw btree_error, btree_cache_error, storage_file_error
+        @note the caller must be the only writer of the b-tree
+        */
+        std::optional< size_t > erase_top_down_levels( Digest digest ) const
+        {
+            using namespace std;
+
+            auto rich = [this] ( NodeUid uid ) { return cache_.get_node( uid )->elements_.size() > btree_min_; };
+
+            Sketch node( *this );
+
+            for ( size_t levels = 0; ; ++levels )
+            {
+                if ( node.is_leaf() ) return levels;
+
+                const auto pos = node.lower_bound( digest );
+
+                // the same choice as find_replacement() does
+                if ( pos < node.digests_.size() && digest == node.digests_[ pos ] )
+                {
+                    const bool from_left = rich( node.links_[ pos ] );
+                    if ( !from_left && !rich( node.links_[ pos + 1 ] ) ) return nullopt;
+
+                    auto child = cache_.get_node( node.links_[ from_left ? pos : pos + 1 ] );
+                    auto leaf = outermost_leaf( child, from_left );
+                    digest = from_left ? leaf->elements_.back().digest_ : leaf->elements_.front().digest_;
+
+                    node = Sketch( *child );
+                    continue;
+                }
+
+                Sketch child( *cache_.get_node( node.links_[ pos ] ) );
+
+                // the same choice as find_donor() does
+                if ( child.digests_.size() <= btree_min_ )
+                {
+                    if ( pos > 0 && rich( node.links_[ pos - 1 ] ) )
+                    {
+                        child.digests_.insert( child.digests_.begin(), node.digests_[ pos - 1 ] );
+                        child.links_.insert( child.links_.begin(), cache_.get_node( node.links_[ pos - 1 ] )->links_.back() );
+                    }
+                    else if ( pos < node.digests_.size() && rich( node.links_[ pos + 1 ] ) )
+                    {
+                        child.digests_.push_back( node.digests_[ pos ] );
+                        child.links_.push_back( cache_.get_node( node.links_[ pos + 1 ] )->links_.front() );
+                    }
+                    else
+                    {
+                        return nullopt;
+                    }
+                }
+
+                node = move( child );
+            }
+        }
+
+
+        /* Inserts new element going from this root down to a leaf once
+
+        Full child passes an element to a sibling before the descent enters it, so the leaf always
+        has room for the element and no ancestor is revisited. The nodes are latched hand over hand:
+        a child is latched before its parent is released, and each visited node is written once in
+        place when the descent leaves it
+
+        @param [out] t - active transaction
+        @param [in] e - element to be inserted
+        @throw btree_error, btree_cache_error, storage_file_error
+        @note the element must not exist, insert_top_down_levels() must have approved the insertion,
+              the transaction must allow to overwrite 2 nodes per level
+        */
+        void insert_top_down( Transaction & t, const Element & e )
+        {
+            using namespace std;
+
+            optional< VersionGuard > latches[ 2 ];
+            BTreeP holders[ 2 ];
+            size_t current = 0;
+
+            BTree * node = this;
+            latches[ current ].emplace( *node );
+
+            for ( ;; )
+            {
+                const auto pos = node->element_lower_bound( e.digest_ );
+                throw_logic_error( pos == node->elements_.size() || e.digest_ != node->elements_[ pos ].digest_, "The element already exists" );
+
+                if ( node->is_leaf() )
+                {
+                    throw_logic_error( node->elements_.size() + 1 < btree_max_, "A node is full" );
+
+                    node->elements_.insert( begin( node->elements_ ) + pos, e );
+                    node->links_.insert( begin( node->links_ ) + pos, InvalidNodeUid );
+                    node->overwrite( t );
+
+                    return;
+                }
+
+                // latch the child before leaving this node
+                auto child = cache_.get_node( node->links_[ pos ] );
+                latches[ current ^ 1 ].emplace( *child );
+
+                if ( child->elements_.size() + 1 == btree_max_ )
+                {
+                    auto[ sibling, right ] = node->find_room( pos, *child, e.digest_ );
+                    throw_logic_error( static_cast< bool >( sibling ), "A full node cannot be relieved" );
+
+                    VersionGuard sibling_latch( *sibling );
+
+                    if ( right )
+                    {
+                        node->rotate_right( pos, *child, *sibling );
+                    }
+                    else
+                    {
+                        node->rotate_left( pos - 1, *sibling, *child );
+                    }
+
+                    sibling->overwrite( t );
+                }
+
+                // this node is complete
+                node->overwrite( t );
+                latches[ current ].reset();
+
+                current ^= 1;
+                holders[ current ] = move( child );
+                node = holders[ current ].get();
+            }
+        }
+
+
+        /* Erases an element going from this root down to a leaf once
+
+        Minimal child takes an element from a sibling before the descent enters it, so erasing from
+        the leaf never underflows and no ancestor is revisited. An element found in internal node is
+        replaced with its predecessor or successor from a child having more than minimal number of
+        elements, and the descent continues to erase that one from the leaf. The nodes are latched
+        hand over hand and written once
+
+        @param [out] t - active transaction
+        @param [in] digest - digest of the element to be erased
+        @throw btree_error, btree_cache_error, storage_file_error
+        @note the element must exist, its BLOB and children must be released by the caller,
+              erase_top_down_levels() must have approved the erasing, the transaction must allow to
+              overwrite 2 nodes per level
+        */
+        void erase_top_down( Transaction & t, Digest digest )
+        {
+            using namespace std;
+
+            optional< VersionGuard > latches[ 2 ];
+            BTreeP holders[ 2 ];
+            size_t current = 0;
+
+            BTree * node = this;
+            latches[ current ].emplace( *node );
+
+            for ( ;; )
+            {
+                const auto pos = node->element_lower_bound( digest );
+                const bool found = pos < node->elements_.size() && digest == node->elements_[ pos ].digest_;
+
+                if ( node->is_leaf() )
+                {
+                    throw_logic_error( found, "The element does not exist" );
+
+                    node->elements_.erase( begin( node->elements_ ) + pos );
+                    node->links_.erase( begin( node->links_ ) + pos );
+                    node->overwrite( t );
+
+                    return;
+                }
+
+                BTreeP child;
+
+                if ( found )
+                {
+                    // bring the closest element from the rich subtree, then erase it down there
+                    bool from_left;
+                    tie( child, from_left ) = node->find_replacement( pos );
+                    throw_logic_error( static_cast< bool >( child ), "Both children are minimal" );
+
+                    auto leaf = outermost_leaf( child, from_left );
+                    node->elements_[ pos ] = from_left ? leaf->elements_.back() : leaf->elements_.front();
+                    digest = node->elements_[ pos ].digest_;
+
+                    latches[ current ^ 1 ].emplace( *child );
+                }
+                else
+                {
+                    child = cache_.get_node( node->links_[ pos ] );
+                    latches[ current ^ 1 ].emplace( *child );
+
+                    if ( child->elements_.size() <= btree_min_ )
+                    {
+                        auto[ donor, right ] = node->find_donor( pos );
+                        throw_logic_error( static_cast< bool >( donor ), "A minimal node cannot be topped up" );
+
+                        VersionGuard donor_latch( *donor );
+
+                        if ( right )
+                        {
+                            node->rotate_left( pos, *child, *donor );
+                        }
+                        else
+                        {
+                            node->rotate_right( pos - 1, *donor, *child );
+                        }
+
+                        donor->overwrite( t );
+                    }
+                }
+
+                // this node is complete
+                node->overwrite( t );
+                latches[ current ].reset();
+
+                current ^= 1;
+                holders[ current ] = move( child );
+                node = holders[ current ].get();
+            }
+        }
+
+
+        /* Tries to insert an element in memory only leaving the node for write-back
+
+        Possible if the change affects this node only: the value fits in place, the node does not
+        overflow, and replaced value is not a BLOB
+
+        @param [in] pos - insert position
+        @param [in] digest - subkey digest
+        @param [in] name - subkey name
+        @param [in] value - value to be assigned to the subkey
+        @param [in] good_before - expiration mark for the subkey
+        @param [in] ow - if overwritting allowed
+        @retval bool - true if the element is inserted
+        @throw std::bad_alloc
+        */
+        bool insert_deferred( Pos pos, Digest digest, const Key & name, const Value & value, uint64_t good_before, bool ow )
+        {
+            using namespace std;
+
+            // expiration index is modified by transaction only
+            if ( ExpirationIndex && good_before ) return false;
+
+            auto packed = PackedValue::make_inline( value );
+            if ( !packed ) return false;
+
+            const bool exists = pos < elements_.size() && digest == elements_[ pos ].digest_;
+
+            const bool buried = exists && Tombstone == elements_[ pos ].good_before_;
+
+            if ( exists )
+            {
+                // let regular insert report an error or release the BLOB
+                if ( !( ow || buried ) || elements_[ pos ].value_.is_blob() ) return false;
+            }
+            else if ( elements_.size() + 1 >= btree_max_ || !is_leaf() )
+            {
+                return false;
+            }
+
+            if ( !cache_.defer_write( uid_ ) ) return false;
+
+            VersionGuard latch( *this );
+
+            if ( exists )
+            {
+                elements_[ pos ].value_ = *packed;
+                elements_[ pos ].good_before_ = good_before || buried ? good_before : elements_[ pos ].good_before_;
+            }
+            else
+            {
+                elements_.insert( begin( elements_ ) + pos, Element{ digest, good_before, InvalidNodeUid, *packed, name } );
+                links_.insert( begin( links_ ) + pos, InvalidNodeUid );
+            }
+
+            return true;
+        }
+
+
+        /* Tries to erase an element in memory only leaving the node for write-back
+
+        Possible if the change affects this node only: the element is a leaf one without children,
+        BLOB value and expiration index entry, and the node does not underflow
+
+        @param [in] pos - position of element to be removed
+        @param [in] bpath - path from b-tree root
+        @retval bool - true if the element is erased
+        @throw std::bad_alloc
+        */
+        bool erase_deferred( Pos pos, const BTreePath & bpath )
+        {
+            using namespace std;
+
+            const auto & e = elements_[ pos ];
+
+            if ( InvalidNodeUid != e.children_ || e.value_.is_blob() || !is_leaf() ) return false;
+            if ( elements_.size() <= btree_min_ && !bpath.empty() ) return false;
+            if ( ExpirationIndex && indexed( e.good_before_ ) ) return false;
+
+            if ( !cache_.defer_write( uid_ ) ) return false;
+
+            VersionGuard latch( *this );
+
+            elements_.erase( begin( elements_ ) + pos );
+            links_.erase( begin( links_ ) + pos );
+
+            return true;
+        }
+
+
+        /* Checks if b-tree rooted at this node has no live elements
+
+        Lazily erased subkeys stay in inner nodes as tombstones till background collapsing, so the
+        whole b-tree is walked. The walk stops at the first live element
+
+        @retval bool - true if the b-tree contains tombstones only
+        @throw btree_error, btree_cache_error, storage_file_error
+        @note the caller must hold a key lock over the b-tree
+        */
+        bool vacant() const
+        {
+            using namespace std;
+
+            if ( !all_of( begin( elements_ ), end( elements_ ), [] ( const Element & e ) { return Tombstone == e.good_before_; } ) ) return false;
+
+            return all_of( begin( links_ ), end( links_ ), [&] ( NodeUid link ) { return InvalidNodeUid == link || cache_.get_node( link )->vacant(); } );
+        }
+
+
+        /* Releases vacant children b-tree
+
+        A leaf root is erased at once, b-tree keeping tombstones in inner nodes is detached to be
+        reclaimed in background
+
+        @param [out] t - active transaction
+        @param [in] children - root of the b-tree
+        @retval bool - true if the b-tree is detached, reclamation is to be requested after commit
+        @throw btree_error, btree_cache_error, storage_file_error
+        */
+        bool release_vacant( Transaction & t, NodeUid children )
+        {
+            if ( !cache_.get_node( children )->is_leaf() )
+            {
+                t.detach_btree( children );
+                return true;
+            }
+
+            t.erase_chain( children );
+            cache_.drop( children );
+
+            return false;
+        }
+
+
+        /* Provides node of b-tree rooted at this node
+
+        @param [in] uid - node uid
+        @param [out] holder - keeps the node alive if it's not the root
+        @retval BTree & - the node
+        @throw btree_error, btree_cache_error, storage_file_error
+        */
+        BTree & resolve( NodeUid uid, BTreeP & holder )
+        {
+            if ( uid == uid_ ) return *this;
+
+            holder = cache_.get_node( uid );
+            return *holder;
+        }
+
+
+        /* Provides node of b-tree rooted at this node
+
+        @param [in] uid - node uid
+        @param [out] holder - keeps the node alive if it's not the root
+        @retval const BTree & - the node
+        @throw btree_error, btree_cache_error, storage_file_error
+        */
+        const BTree & resolve( NodeUid uid, BTreeP & holder ) const
+        {
+            return const_cast< BTree* >( this )->resolve( uid, holder );
+        }
+
+
+        /* Checks if search path leads to a tombstone
+
+        @param [in] path - path to found element
+        @retval bool - true if the element is erased lazily
+        @throw btree_error, btree_cache_error, storage_file_error
+        @note the node must be the root of b-tree
+        */
+        bool buried( const BTreePath & path ) const
+        {
+            auto[ uid, pos ] = path.back();
+
+            BTreeP node;
+            const BTree & target = resolve( uid, node );
+
+            return Tombstone == target.elements_[ pos ].good_before_;
+        }
+
+
+        /* Checks if search path leads to a tombstone registering the tombstone for collapsing
+
+        Registered tombstones are kept in memory only, so ones left by previous run are collapsed
+        when a writer meets them
+
+        @param [in] path - path to found element
+        @retval bool - true if the element is erased lazily
+        @throw btree_error, btree_cache_error, storage_file_error
+        @note the node must be the root of b-tree
+        */
+        bool met_tombstone( const BTreePath & path ) const
+        {
+            if ( !buried( path ) ) return false;
+
+            auto[ uid, pos ] = path.back();
+
+            BTreeP node;
+            const BTree & target = resolve( uid, node );
+
+            try
+            {
+                cache_.note_tombstone( uid_, target.elements_[ pos ].digest_ );
+            }
+            catch ( ... )
+            {
+                // the tombstone just stays till it's met again
+            }
+
+            return true;
+        }
+
+
+        /* Marks an element as erased leaving it in place till background collapsing
+
+        The element keeps its digest only, BLOB and children b-tree must be released by the caller
+
+        @param [out] t - active transaction
+        @param [in] pos - element position
+        @throw btree_error, btree_cache_error, storage_file_error
+        */
+        void bury( Transaction & t, Pos pos )
+        {
+            VersionGuard latch( *this );
+
+            auto & e = elements_[ pos ];
+            e.good_before_ = Tombstone;
+            e.children_ = InvalidNodeUid;
+            e.value_ = *PackedValue::make_inline( Value{} );
+
+            overwrite( t );
+        }
+
+
+        /* Provides shared structure lock of the cache if lazy erasing or expiration index is on
+
+        @retval boost::shared_lock - the lock, not owning if neither is on
+        @throw boost::lock_error
+        */
+        auto lock_structure() const
+        {
+            return BTreeLazyErase || ExpirationIndex ? cache_.lock_structure() : boost::shared_lock< boost::upgrade_mutex >{};
+        }
+
+
+        /* Removes tombstones from b-tree rooted at this node rebalancing it
+
+        All the tombstones are erased by one batch, so each affected node is written once. Digests
+        overwritten by insertion since they were buried are skipped
+
+        @param [in] digests - digests of tombstones
+        @throw btree_error, btree_cache_error, storage_file_error
+        @note the caller must hold exclusive key lock over the b-tree and exclusive structure lock
+              of the cache
+        */
+        void collapse_tombstones( const std::vector< Digest > & digests )
+        {
+            HotTierRefresh refresh( *this );
+
+            run_batch( [&] ( Transaction & t ) {
+                for ( auto digest : digests )
+                {
+                    relieve_batch( t );
+
+                    BTreePath bpath;
+                    if ( !find_digest( digest, bpath ) || !buried( bpath ) ) continue;
+
+                    auto[ uid, pos ] = bpath.back();
+                    bpath.pop_back();
+
+                    BTreeP node;
+                    BTree & target = resolve( uid, node );
+
+                    target.erase_element( t, pos, bpath );
+                }
+            } );
+        }
+
+
+        /* Provides digest of expiration index entry to start looking for a subkey from
+
+        @param [in] digest - subkey digest
+        @param [in] good_before - subkey expiration mark
+        @retval Digest - the first candidate digest of the entry
+        @throw nothing
+        */
+        static Digest expiration_entry_digest( Digest digest, uint64_t good_before ) noexcept
+        {
+            const uint64_t low_bits = static_cast< uint64_t >( digest ) & ( ( 1ULL << ExpirationShift ) - 1 );
+            return static_cast< Digest >( good_before << ExpirationShift | low_bits );
+        }
+
+
+        /* Makes name of expiration index entry referring to a subkey
+
+        @param [in] root - root of b-tree containing the subkey
+        @param [in] digest - subkey digest
+        @param [in] good_before - subkey expiration mark
+        @retval Key - fixed size hexadecimal representation of the reference
+        @throw std::bad_alloc
+        */
+        static Key expiration_entry_name( NodeUid root, Digest digest, uint64_t good_before )
+        {
+            using CharT = typename Key::value_type;
+
+            Key name;
+            name.reserve( ExpirationNameSize );
+
+            for ( uint64_t field : { static_cast< uint64_t >( root ), static_cast< uint64_t >( digest ), good_before } )
+            {
+                for ( int shift = 60; shift >= 0; shift -= 4 )
+                {
+                    name.push_back( static_cast< CharT >( "0123456789abcdef"[ ( field >> shift ) & 0xf ] ) );
+                }
+            }
+
+            return name;
+        }
+
+
+        /* Parses name of expiration index entry
+
+        @param [in] name - entry name
+        @retval std::optional - b-tree root, subkey digest and expiration mark, nothing if the name is malformed
+        @throw nothing
+        */
+        static auto parse_expiration_entry_name( const Key & name ) noexcept
+        {
+            using namespace std;
+
+            using Reference = tuple< NodeUid, Digest, uint64_t >;
+
+            if ( name.size() != ExpirationNameSize ) return optional< Reference >{};
+
+            uint64_t fields[ 3 ] = {};
+
+            for ( size_t i = 0; i < name.size(); ++i )
+            {
+                const auto c = static_cast< uint64_t >( name[ i ] );
+
+                uint64_t d = 0;
+                if ( '0' <= c && c <= '9' ) d = c - '0';
+                else if ( 'a' <= c && c <= 'f' ) d = c - 'a' + 10;
+                else return optional< Reference >{};
+
+                fields[ i / 16 ] = fields[ i / 16 ] << 4 | d;
+            }
+
+            return optional< Reference >{ Reference{ static_cast< NodeUid >( fields[ 0 ] ), static_cast< Digest >( fields[ 1 ] ), fields[ 2 ] } };
+        }
+
+
+        /* Checks if expiration mark is registered in expiration index
+
+        Too far expiration marks do not fit the index, such subkeys expire lazily only
+
+        @param [in] good_before - expiration mark
+        @retval bool - true if a subkey with the mark has an index entry
+        @throw nothing
+        */
+        static bool indexed( uint64_t good_before ) noexcept
+        {
+            return good_before && Tombstone != good_before && good_before < ExpirationLimit;
+        }
+
+
+        /* Removes expiration index entry of a subkey being erased
+
+        @param [in] t - active transaction
+        @param [in] root - root of b-tree containing the subkey
+        @param [in] e - the subkey
+        @throw btree_error, btree_cache_error, storage_file_error
+        @note must not be called from a batch over another b-tree
+        */
+        void unindex_erased( Transaction & t, NodeUid root, const Element & e )
+        {
+            if ( !ExpirationIndex || !indexed( e.good_before_ ) || InvalidNodeUid == t.expiration_index() ) return;
+
+            cache_.get_node( t.expiration_index() )->unindex_expirations( t, root, { { e.digest_, e.good_before_ } } );
+        }
+
+
+        /* Creates empty expiration index b-tree if the file has none yet
+
+        @throw btree_error, storage_file_error
+        @note the caller must not hold a transaction
+        */
+        void ensure_expiration_index()
+        {
+            if ( InvalidNodeUid != file_.expiration_index() ) return;
+
+            auto t = file_.open_transaction();
+
+            // another writer could create it meanwhile
+            if ( InvalidNodeUid != t.expiration_index() ) return;
+
+            BTree index( file_, cache_ );
+            index.save( t );
+            t.set_expiration_index( index.uid_ );
+
+            t.commit();
+        }
+
+
+        /* Registers subkeys with expiration marks in expiration index
+
+        The index is a b-tree which entries are ordered by expiration mark, each entry refers to a
+        subkey by its name. Digests of entries of the same msec are distinguished by low bits of
+        subkey digests, a collision is resolved by taking the next digest. The index is modified by
+        a batch nested into given transaction
+
+        @param [in] t - active transaction
+        @param [in] root - root of b-tree containing the subkeys
+        @param [in] subkeys - the subkeys, ones without expiration mark are ignored
+        @throw btree_error, btree_cache_error, storage_file_error
+        @note the index must be created by ensure_expiration_index() before the transaction
+        */
+        void index_expirations( Transaction & t, NodeUid root, const ExpiringSubkeys & subkeys )
+        {
+            using namespace std;
+
+            if ( !ExpirationIndex ) return;
+
+            vector< Element > entries;
+
+            for ( auto[ digest, good_before ] : subkeys )
+            {
+                if ( !indexed( good_before ) ) continue;
+
+                const auto blank = PackedValue::make_inline( Value{} );
+                entries.push_back( Element{ expiration_entry_digest( digest, good_before ), 0, InvalidNodeUid, *blank, expiration_entry_name( root, digest, good_before ) } );
+            }
+
+            if ( entries.empty() ) return;
+
+            const auto index_uid = t.expiration_index();
+            throw_logic_error( InvalidNodeUid != index_uid, "Expiration index is not created" );
+
+            auto index = cache_.get_node( index_uid );
+
+            index->run_batch( t, [&] ( Transaction & t ) {
+                for ( auto & e : entries )
+                {
+                    index->relieve_batch( t );
+
+                    for ( ;; )
+                    {
+                        BTreePath bpath;
+                        const bool found = index->find_digest( e.digest_, bpath );
+
+                        auto[ uid, pos ] = bpath.back();
+                        bpath.pop_back();
+
+                        BTreeP node;
+                        BTree & target = index->resolve( uid, node );
+
+                        if ( !found )
+                        {
+                            target.insert_element( t, pos, bpath, e, false );
+                            break;
+                        }
+
+                        // the subkey is registered already
+                        if ( target.elements_[ pos ].name_ == e.name_ ) break;
+
+                        e.digest_ = static_cast< Digest >( static_cast< uint64_t >( e.digest_ ) + 1 );
+                    }
+                }
+            }, [] {} );
+        }
+
+
+        /* Removes entries referring to given subkeys from expiration index
+
+        @param [in] t - active transaction
+        @param [in] root - root of b-tree containing the subkeys
+        @param [in] subkeys - the subkeys
+        @throw btree_error, btree_cache_error, storage_file_error
+        @note the node must be the root of expiration index
+        */
+        void unindex_expirations( Transaction & t, NodeUid root, const ExpiringSubkeys & subkeys )
+        {
+            run_batch( t, [&] ( Transaction & t ) {
+                for ( auto[ digest, good_before ] : subkeys )
+                {
+                    relieve_batch( t );
+
+                    const auto name = expiration_entry_name( root, digest, good_before );
+
+                    for ( auto key = expiration_entry_digest( digest, good_before ); ; key = static_cast< Digest >( static_cast< uint64_t >( key ) + 1 ) )
+                    {
+                        BTreePath bpath;
+                        if ( !find_digest( key, bpath ) ) break;
+
+                        auto[ uid, pos ] = bpath.back();
+                        bpath.pop_back();
+
+                        BTreeP node;
+                        BTree & target = resolve( uid, node );
+
+                        if ( target.elements_[ pos ].name_ == name )
+                        {
+                            target.erase_element( t, pos, bpath );
+                            break;
+                        }
+                    }
+                }
+            }, [] {} );
+        }
+
+
+        /* Replaces expiration index entries of erased subkeys with entries of inserted ones
+
+        Both steps run by one batch over the index, so the root of the index is written once
+
+        @param [in] t - active transaction
+        @param [in] erased_root - root of b-tree the erased subkeys belonged to
+        @param [in] erased - the erased subkeys
+        @param [in] inserted_root - root of b-tree containing the inserted subkeys
+        @param [in] inserted - the inserted subkeys
+        @throw btree_error, btree_cache_error, storage_file_error
+        @note the index must be created by ensure_expiration_index() before the transaction if any
+              inserted subkey has expiration mark
+        */
+        void reindex_expirations( Transaction & t, NodeUid erased_root, const ExpiringSubkeys & erased, NodeUid inserted_root, const ExpiringSubkeys & inserted )
+        {
+            const auto index_uid = t.expiration_index();
+            if ( !ExpirationIndex || InvalidNodeUid == index_uid ) return index_expirations( t, inserted_root, inserted );
+
+            auto index = cache_.get_node( index_uid );
+
+            index->run_batch( t, [&] ( Transaction & t ) {
+                if ( !erased.empty() ) index->unindex_expirations( t, erased_root, erased );
+                index_expirations( t, inserted_root, inserted );
+            }, [] {} );
+        }
+
+
+        /* Applies a batch of combined modifications in one transaction
+
+        The modifications are visited in digest order, so neighbouring ones share the nodes, the
+        modifications of the same digest keep the order of their publication. Each modification
+        gets its own status, only a failure of the whole batch is thrown
+
+        @param [in] ms - modifications to be applied
+        @retval std::vector< RetCode > - statuses in order of the modifications
+        @throw btree_error, btree_cache_error, storage_file_error
+        @note the node must be the root of b-tree
+        */
+        std::vector< RetCode > apply_modifications( std::vector< Modification > & ms )
+        {
+            using namespace std;
+
+            auto structure = lock_structure();
+            HotTierRefresh refresh( *this );
+
+            vector< size_t > order( ms.size() );
+            for ( size_t i = 0; i < order.size(); ++i ) order[ i ] = i;
+
+            stable_sort( begin( order ), end( order ), [&] ( auto l, auto r ) { return ms[ l ].digest_ < ms[ r ].digest_; } );
+
+            const bool expiring_inserts = ExpirationIndex && any_of( begin( ms ), end( ms ), [] ( const auto & m ) {
+                return Modification::Kind::Insert == m.kind_ && indexed( m.good_before_ );
+            } );
+
+            if ( expiring_inserts ) ensure_expiration_index();
+
+            // only applied modifications affect the index
+            ExpiringSubkeys expiring, erased;
+
+            vector< RetCode > rcs( ms.size(), RetCode::Ok );
+            vector< Digest > buried_digests;
+            bool detached = false;
+
+            auto t = file_.open_transaction();
+
+            run_batch( t, [&] ( Transaction & t ) {
+                for ( auto ndx : order )
+                {
+                    relieve_batch( t );
+
+                    auto & m = ms[ ndx ];
+
+                    BTreePath bpath;
+                    const bool exists = find_digest( m.digest_, bpath ) && !buried( bpath );
+
+                    auto[ uid, pos ] = bpath.back();
+                    bpath.pop_back();
+
+                    BTreeP node;
+                    BTree & target = resolve( uid, node );
+
+                    if ( Modification::Kind::Insert == m.kind_ )
+                    {
+                        if ( exists && !m.overwrite_ )
+                        {
+                            rcs[ ndx ] = RetCode::AlreadyExists;
+                            continue;
+                        }
+
+                        Element e{ m.digest_, m.good_before_, InvalidNodeUid, PackedValue::make_packed( t, m.value_ ), move( m.name_ ) };
+                        target.insert_element( t, pos, bpath, e, true );
+
+                        if ( ExpirationIndex && indexed( m.good_before_ ) ) expiring.emplace_back( m.digest_, m.good_before_ );
+                    }
+                    else
+                    {
+                        if ( !exists )
+                        {
+                            rcs[ ndx ] = RetCode::NotFound;
+                            continue;
+                        }
+
+                        // erase empty children b-tree
+                        if ( auto children = target.elements_[ pos ].children_; InvalidNodeUid != children )
+                        {
+                            if ( !cache_.get_node( children )->vacant() )
+                            {
+                                rcs[ ndx ] = RetCode::NotLeaf;
+                                continue;
+                            }
+
+                            detached = release_vacant( t, children ) || detached;
+                        }
+
+                        if ( const auto & e = target.elements_[ pos ]; ExpirationIndex && indexed( e.good_before_ ) )
+                        {
+                            erased.emplace_back( e.digest_, e.good_before_ );
+                        }
+
+                        target.elements_[ pos ].value_.erase_blob( t );
+
+                        if ( BTreeLazyErase && !( target.is_leaf() && ( bpath.empty() || target.elements_.size() > btree_min_ ) ) )
+                        {
+                            buried_digests.push_back( m.digest_ );
+                            target.bury( t, pos );
+                        }
+                        else
+                        {
+                            target.erase_element( t, pos, bpath );
+                        }
+                    }
+                }
+            }, [&] {
+                // the index is modified by the next batch of the same transaction
+                reindex_expirations( t, uid_, erased, uid_, expiring );
+                t.commit();
+            } );
+
+            if ( detached ) cache_.request_reclaim();
+
+            for ( auto digest : buried_digests )
+            {
+                try
+                {
+                    cache_.note_tombstone( uid_, digest );
+                }
+                catch ( ... )
+                {
+                    // the subkey is erased anyway, the tombstone just stays till overwritten
+                }
+            }
+
+            return rcs;
+        }
+
+
+        /* Applies a batch of combined modifications under exclusive key lock over the b-tree
+
+        Readers and other writers of the volume take the same lock navigating to the b-tree, so the
+        batch does not interleave with them
+
+        @param [in] ms - modifications to be applied
+        @retval std::vector< RetCode > - statuses in order of the modifications
+        @throw btree_error, btree_cache_error, storage_file_error
+        @note the calling combiner must not hold the lock over the b-tree
+        */
+        std::vector< RetCode > apply_combined( std::vector< Modification > & ms )
+        {
+            boost::unique_lock< boost::upgrade_mutex > key{ guard_ };
+            return apply_modifications( ms );
+        }
+
+
+        /* Provides combiner of concurrent modifications
+
+        @retval ModificationCombiner - the combiner
+        @throw std::bad_alloc
+        */
+        ModificationCombiner & combiner()
+        {
+            std::call_once( combiner_once_, [&] { combiner_ = std::make_unique< ModificationCombiner >( BTreeCombineBatch ); } );
+            return *combiner_;
+        }
+
+
+        /* Sorts bulk items by digest and removes repeated digests keeping the last item
+
+        @param [in/out] items - items to be sorted
+        @retval iterator - the first of unique items, the items before it are to be ignored
+        @throw nothing
+        */
+        static auto sort_bulk_items( std::vector< BulkItem > & items ) noexcept
+        {
+            using namespace std;
+
+            auto digest_less = [] ( const BulkItem & l, const BulkItem & r ) { return get< 0 >( l ) < get< 0 >( r ); };
+            auto digest_equal = [] ( const BulkItem & l, const BulkItem & r ) { return get< 0 >( l ) == get< 0 >( r ); };
+
+            stable_sort( begin( items ), end( items ), digest_less );
+            return unique( rbegin( items ), rend( items ), digest_equal ).base();
+        }
+
+
+        /* Runs batch operation over the b-tree in one transaction
+
+        Nodes modified by the operation are collected by the cache instead of being written immediately
+        and are written once at the end. If the operation fails modified nodes are dropped from the
+        cache and the root is reloaded, so memory state matches the file again
+
+        @tparam F - operation type, callable as f( Transaction & )
+        @param [in] f - operation
+        @throw btree_error, btree_cache_error, storage_file_error
+        */
+        template < typename F >
+        void run_batch( F && f )
+        {
+            auto t = file_.open_transaction();
+            run_batch( t, std::forward< F >( f ), [&] { t.commit(); } );
+        }
+
+
+        /* Runs batch operation over the b-tree within given transaction
+
+        Lets a transaction modify several b-trees by consequent batches, the finishing step of a batch
+        may run the next one. The nodes are written before the finishing step. Memory state of the
+        batch is restored when the transaction is rolled back, so the nodes reloaded from the file
+        match it whatever step fails. A batch nested into running batch over the same b-tree joins
+        it, the nodes are written by the end of the running batch then, since the root may be
+        overwritten once per transaction
+
+        @tparam F - operation type, callable as f( Transaction & )
+        @tparam G - finishing step type, callable as g()
+        @param [in] t - active transaction
+        @param [in] f - operation
+        @param [in] finish - called when the nodes are written
+        @throw btree_error, btree_cache_error, storage_file_error
+        */
+        template < typename F, typename G >
+        void run_batch( Transaction & t, F && f, G && finish )
+        {
+            using namespace std;
+
+            if ( cache_.batch_running( this ) )
+            {
+                f( t );
+                finish();
+                return;
+            }
+
+            auto batch = make_shared< typename BTreeCache::Batch >();
+            batch->root_ = this;
+
+            // the root must outlive the transaction
+            BTreeP root = cache_.find_node( uid_ );
+            if ( root.get() != this ) root.reset();
+
+            t.on_rollback( [this, root, batch] { discard_batch( *batch ); } );
+
+            cache_.begin_batch( *batch );
+
+            try
+            {
+                f( t );
+                flush_batch( t, *batch, true );
+            }
+            catch ( ... )
+            {
+                cache_.end_batch( *batch );
+                throw;
+            }
+
+            cache_.end_batch( *batch );
+
+            finish();
+        }
+
+
+        /* Writes nodes collected by running batch if they pin too many nodes of the cache
+
+        Must be called between modifications of the batch operation, the root keeps updated links
+        till the end of the batch
+
+        @param [in] t - active transaction
+        @throw btree_error, btree_cache_error, storage_file_error
+        @note the node must be the root of the batch
+        */
+        void relieve_batch( Transaction & t )
+        {
+            if ( auto batch = cache_.overflown_batch() ) flush_batch( t, *batch, false );
+        }
+
+
+        /* Writes nodes modified by batch operation
+
+        Modified nodes except the root are relocated bottom-up, so each parent receives new links
+        before it's written itself. Ancestors of modified nodes are rewritten as well. The root is
+        overwritten in place at the end of the batch only, since a chain is overwritten once per
+        transaction. Nodes written by partial writing are not pinned by the batch anymore
+
+        @param [in] t - active transaction
+        @param [in/out] batch - running batch
+        @param [in] final - the end of the batch
+        @throw btree_error, btree_cache_error, storage_file_error
+        */
+        void flush_batch( Transaction & t, typename BTreeCache::Batch & batch, bool final )
+        {
+            using namespace std;
+
+            if ( batch.dirty_.empty() && !( final && batch.relinked_ ) ) return;
+
+            struct Relocation
+            {
+                BTreeP node_;
+                BTree * parent_;
+                Pos link_;
+                size_t depth_;
+            };
+
+            unordered_map< const BTree*, Relocation > relocations;
+
+            for ( const auto & item : batch.dirty_ )
+            {
+                if ( item.first == this ) continue;
+
+                const BTreeP & node = item.second;
+                throw_logic_error( node->elements_.size(), "Empty non-root node" );
+
+                // find path from the root to the node
+                BTreePath path;
+                auto found = find_digest( node->elements_.front().digest_, path );
+                throw_logic_error( found && path.front().first == uid_ && path.back().first == node->uid_, "Broken b-tree" );
+
+                // register the node and its ancestors up to already registered one
+                BTreeP child = node;
+                for ( auto depth = path.size() - 1; depth > 0 && !relocations.count( child.get() ); --depth )
+                {
+                    BTreeP parent = depth > 1 ? cache_.get_node( path[ depth - 1 ].first ) : nullptr;
+                    relocations.emplace( child.get(), Relocation{ child, parent ? parent.get() : this, path[ depth - 1 ].second, depth } );
+                    child = move( parent );
+                }
+            }
+
+            // write the nodes from the bottom
+            vector< Relocation * > order;
+            order.reserve( relocations.size() );
+            for ( auto & item : relocations ) order.push_back( &item.second );
+
+            sort( begin( order ), end( order ), [] ( const Relocation * l, const Relocation * r ) { return l->depth_ > r->depth_; } );
+
+            // written nodes are noted by the batch
+            batch.flushing_ = true;
+
+            try
+            {
+                for ( auto r : order )
+                {
+                    VersionGuard parent_latch( *r->parent_ );
+
+                    auto old_uid = r->node_->uid_;
+
+                    r->node_->save( t );
+                    r->parent_->links_[ r->link_ ] = r->node_->uid_;
+
+                    t.erase_chain( old_uid );
+                }
+
+                if ( final )
+                {
+                    // and finally the root
+                    VersionGuard latch( *this );
+                    overwrite( t );
+                }
+            }
+            catch ( ... )
+            {
+                batch.flushing_ = false;
+                throw;
+            }
+
+            batch.flushing_ = false;
+
+            if ( final ) return;
+
+            // release written nodes, the root waits for the end of the batch
+            batch.relinked_ = batch.relinked_ || !order.empty();
+
+            for ( auto item = begin( batch.dirty_ ); item != end( batch.dirty_ ); )
+            {
+                item = item->first == this ? next( item ) : batch.dirty_.erase( item );
+            }
+        }
+
+
+        /* Restores consistency between memory and file after failed batch
+
+        Called when the transaction is rolled back. Write-back dirty nodes get back their images taken
+        before the batch and stay dirty, their deferred modifications are acknowledged. Other nodes
+        touched by the batch are evicted and reloaded on demand, the root is reloaded at once
+
+        @param [in] batch - nodes modified/written by the batch
+        @throw nothing
+        @note failure to restore write-back dirty node terminates, the modification must not be lost silently
+        */
+        void discard_batch( typename BTreeCache::Batch & batch ) noexcept
+        {
+            for ( auto & item : batch.images_ )
+            {
+                auto & image = item.second;
+                auto & node = *image.node_;
+
+                VersionGuard latch( node );
+
+                std::istringstream is( image.data_ );
+                is >> node;
+
+                if ( node.uid_ != image.uid_ )
+                {
+                    cache_.update_uid( node.uid_, image.uid_ );
+                    node.uid_ = image.uid_;
+                }
+
+                cache_.mark_dirty( image.node_ );
+            }
+
+            for ( const auto & item : batch.dirty_ )
+            {
+                if ( item.first != this && !batch.images_.count( item.first ) ) cache_.evict( item.second->uid_ );
+            }
+
+            for ( auto uid : batch.written_ )
+            {
+                cache_.evict( uid );
+            }
+
+            if ( batch.images_.count( this ) ) return;
+
+            try
+            {
+                VersionGuard latch( *this );
+                load( uid_ );
+            }
+            catch ( ... )
+            {
+            }
+        }
+
+
+        /* Absorbs element and right sibling node. Given element becomes new mediane
+
+        @param [in] mediane - element to be used as new mediane
+        @param [in] right_sibling - right sibling node
+        @throw std::bad_alloc
+        */
+        void absorb( const Element & mediane, BTree & right_sibling )
+        {
+            using namespace std;
+
+            throw_logic_error( elements_.size() + right_sibling.elements_.size() + 1 <= btree_max_ );
+
+            elements_.insert( end( elements_ ), mediane );
+            elements_.insert( end( elements_ ), begin( right_sibling.elements_ ), end( right_sibling.elements_ ) );
+            links_.insert( end( links_ ), begin( right_sibling.links_ ), end( right_sibling.links_ ) );
+        }
+
+
+        /* Makes one attempt to find a digest from this node down to a leaf
+
+        Each node is read between two loads of its version, and the reading is valid only if the
+        version is even and has not changed. A node reached through a link is valid only if its
+        parent has not changed since the link was read. Cached children are taken without locking,
+        loading of a child is done under shared lock over the parent, so the link cannot become stale
+        while the child is being loaded
+
+        @param [in] digest - key to be found
+        @param [in/out] path - search path
+        @param [in] optimistic - if true the nodes are read without locking
+        @retval std::optional< bool > - if digest found, nothing on conflict with a writer
+        @throw btree_error, btree_cache_error, storage_file_error
+        */
+        std::optional< bool > try_find_digest( Digest digest, BTreePath & path, bool optimistic ) const
+        {
+            using namespace std;
+
+            using shared_lock = boost::shared_lock< boost::upgrade_mutex >;
+
+            const BTree * parent = nullptr;
+            uint64_t parent_version = 0;
+
+            const BTree * node = this;
+            BTreeP holder, parent_holder;
+
+            for ( ;; )
+            {
+                shared_lock lock{ node->latch_, boost::defer_lock };
+                if ( !optimistic ) lock.lock();
+
+                const auto version = node->version_.load( memory_order_acquire );
+                if ( version & 1 ) return nullopt;
+
+                // the node must be still referenced by the parent
+                if ( parent && parent->version_.load( memory_order_acquire ) != parent_version ) return nullopt;
+
+                // read the node, the data may be inconsistent till validation
+                const auto uid = node->uid_;
+                const auto[ digests, size ] = node->digests_.view();
+                const auto[ links, links_size ] = node->links_.view();
+                const auto d = node->search_digest( digest );
+                const bool found = d < size && digests[ d ] == digest;
+                const auto link = found || d >= links_size ? InvalidNodeUid : links[ d ];
+
+                atomic_thread_fence( memory_order_acquire );
+                if ( node->version_.load( memory_order_relaxed ) != version ) return nullopt;
+
+                path.emplace_back( uid, d );
+
+                if ( found ) return true;
+                if ( InvalidNodeUid == link ) return false;
+
+                throw_btree_error( path.size() < path.capacity(), RetCode::SubkeyLimitReached );
+
+                auto child = optimistic ? cache_.find_node( link ) : nullptr;
+
+                if ( !child )
+                {
+                    if ( !lock.owns_lock() ) lock.lock();
+                    if ( node->version_.load( memory_order_acquire ) != version ) return nullopt;
+
+                    child = cache_.get_node( link );
+                }
+
+                parent = node;
+                parent_version = version;
+                parent_holder = move( holder );
+
+                holder = move( child );
+                node = holder.get();
+            }
+        }
+
+
+        /* Searches a range of sorted digests from this node down by single merge pass per node
+
+        The node is read under shared lock, its position moves forward only, so each digest costs a
+        search through the rest of the node instead of whole descent. Digests falling into the same
+        child go down together. A digest reached through a parent that has changed since is searched
+        again alone from the root
+
+        @param [in] root - b-tree root
+        @param [in] digests - sorted digests of the whole batch
+        @param [in] first - the first digest of the range
+        @param [in] last - the digest after the range
+        @param [in/out] paths - search paths
+        @param [out] found - if the digests found
+        @param [in] parent - the node the search came from, nullptr for the root
+        @param [in] parent_version - version of the parent when the link was read
+        @throw btree_error, btree_cache_error, storage_file_error
+        */
+        void find_digest_range( const BTree & root, const Digest * digests, size_t first, size_t last, std::vector< BTreePath > & paths,
+            std::vector< bool > & found, const BTree * parent, uint64_t parent_version ) const
+        {
+            using namespace std;
+
+            struct Descent
+            {
+                BTreeP child_;
+                size_t first_, last_;
+            };
+
+            vector< Descent > descents;
+            size_t retry = last;
+            uint64_t version = 0;
+
+            {
+                boost::shared_lock< boost::upgrade_mutex > lock{ latch_ };
+
+                version = version_.load( memory_order_acquire );
+
+                // the node must be still referenced by the parent
+                if ( parent && parent->version_.load( memory_order_acquire ) != parent_version ) retry = first;
+
+                const auto size = digests_.size();
+
+                for ( size_t i = first, d = 0; i < retry; )
+                {
+                    d += details::digest_lower_bound( digests_.data() + d, size - d, digests[ i ] );
+
+                    paths[ i ].emplace_back( uid_, d );
+
+                    if ( d < size && digests_[ d ] == digests[ i ] )
+                    {
+                        found[ i++ ] = true;
+                        continue;
+                    }
+
+                    // the following digests going to the same child
+                    auto j = i + 1;
+                    for ( ; j < last && ( d == size || digests[ j ] < digests_[ d ] ); ++j )
+                    {
+                        paths[ j ].emplace_back( uid_, d );
+                    }
+
+                    if ( const auto link = links_[ d ]; InvalidNodeUid != link )
+                    {
+                        throw_btree_error( paths[ i ].size() < paths[ i ].capacity(), RetCode::SubkeyLimitReached );
+                        descents.push_back( Descent{ cache_.get_node( link ), i, j } );
+                    }
+
+                    i = j;
+                }
+            }
+
+            for ( const auto & descent : descents )
+            {
+                descent.child_->find_digest_range( root, digests, descent.first_, descent.last_, paths, found, this, version );
+            }
+
+            for ( auto i = retry; i < last; ++i )
+            {
+                paths[ i ].clear();
+                found[ i ] = root.find_digest( digests[ i ], paths[ i ] );
+            }
+        }
+
+
+        /* State of a lookup interleaved with other ones, see find_scattered_digests()
+        */
+        struct Lookup
+        {
+            const BTree * node_;                // node to be visited next, nullptr while being loaded
+            BTreeP holder_;                     // keeps the node alive
+            const BTree * parent_ = nullptr;    // node the lookup came from
+            BTreeP parent_holder_;
+            uint64_t parent_version_ = 0;       // version of the parent when the link was read
+            NodeUid pending_ = InvalidNodeUid;  // the node being read ahead by the cache
+            size_t restarts_ = 0;
+        };
+
+
+        /* Loads a child node if its parent has not changed since the link was read
+
+        @param [in] parent - parent node
+        @param [in] version - version of the parent when the link was read
+        @param [in] link - child uid
+        @retval BTreeP - the child, nullptr if the parent has changed
+        @throw btree_error, btree_cache_error, storage_file_error
+        */
+        static BTreeP load_child( const BTree * parent, uint64_t version, NodeUid link )
+        {
+            boost::shared_lock< boost::upgrade_mutex > lock{ parent->latch_ };
+
+            if ( parent->version_.load( std::memory_order_acquire ) != version ) return nullptr;
+
+            return parent->cache_.get_node( link );
+        }
+
+
+        /* Resumes a lookup waiting for a node, loads the node in place if it's not read ahead yet
+
+        @param [in/out] l - lookup state
+        @param [in/out] path - search path of the lookup
+        @throw btree_error, btree_cache_error, storage_file_error
+        */
+        void resume( Lookup & l, BTreePath & path ) const
+        {
+            const auto uid = l.pending_;
+            l.pending_ = InvalidNodeUid;
+
+            if ( auto child = load_child( l.parent_, l.parent_version_, uid ) )
+            {
+                l.holder_ = std::move( child );
+                l.node_ = l.holder_.get();
+            }
+            else
+            {
+                restart( l, path );
+            }
+        }
+
+
+        /* Moves a lookup back to the root
+
+        @param [in/out] l - lookup state
+        @param [in/out] path - search path of the lookup
+        @throw nothing
+        */
+        void restart( Lookup & l, BTreePath & path ) const noexcept
+        {
+            path.clear();
+            l.node_ = this;
+            l.holder_.reset();
+            l.parent_ = nullptr;
+            l.parent_holder_.reset();
+            l.parent_version_ = 0;
+            ++l.restarts_;
+        }
+
+
+        /* Advances a lookup till it completes or meets a node missing in the cache
+
+        Cached nodes are visited one by one under shared lock. A missing node is queued for reading
+        ahead by the cache maintenance, and the lookup yields till the node appears in the cache; if
+        the limit of queued loads is reached, the node is loaded in place
+
+        @param [in] digest - key to be found
+        @param [in/out] path - search path
+        @param [in/out] l - lookup state
+        @param [in/out] loads - number of queued loads
+        @retval std::optional< bool > - if digest found, nothing if the lookup yields
+        @throw btree_error, btree_cache_error, storage_file_error
+        */
+        std::optional< bool > advance( Digest digest, BTreePath & path, Lookup & l, size_t & loads ) const
+        {
+            using namespace std;
+
+            for ( ;; )
+            {
+                const BTree & node = *l.node_;
+
+                uint64_t version;
+                NodeUid next;
+
+                {
+                    boost::shared_lock< boost::upgrade_mutex > lock{ node.latch_ };
+
+                    version = node.version_.load( memory_order_acquire );
+
+                    // the node must be still referenced by the parent
+                    if ( l.parent_ && l.parent_->version_.load( memory_order_acquire ) != l.parent_version_ )
+                    {
+                        restart( l, path );
+                        return nullopt;
+                    }
+
+                    const auto size = node.digests_.size();
+                    const auto d = node.search_digest( digest );
+
+                    path.emplace_back( node.uid_, d );
+
+                    if ( d < size && node.digests_[ d ] == digest ) return true;
+
+                    next = node.links_[ d ];
+                    if ( InvalidNodeUid == next ) return false;
+
+                    throw_btree_error( path.size() < path.capacity(), RetCode::SubkeyLimitReached );
+                }
+
+                l.parent_ = l.node_;
+                l.parent_holder_ = move( l.holder_ );
+                l.parent_version_ = version;
+
+                auto child = cache_.find_node( next );
+
+                if ( !child && loads < InterleavedLoads )
+                {
+                    // the parent may be evicted and reused before the request is served
+                    cache_.request_prefetch( [ cache = &cache_, parent = l.parent_->uid_, version, next ] {
+                        if ( auto p = cache->find_node( parent ) ) load_child( p.get(), version, next );
+                    } );
+
+                    l.node_ = nullptr;
+                    l.pending_ = next;
+                    ++loads;
+                    return nullopt;
+                }
+
+                if ( !child && !( child = load_child( l.parent_, version, next ) ) )
+                {
+                    restart( l, path );
+                    return nullopt;
+                }
+
+                l.holder_ = move( child );
+                l.node_ = l.holder_.get();
+            }
+        }
+
+
+        /* Copy of upper levels of b-tree
+
+        Each node of the tier is copied under shared lock together with its version. The copies do
+        not hold the nodes, so the tier neither pins the cache nor delays reclamation, a node is
+        referred weakly to check its version. The copy is valid as long as the versions of the nodes
+        have not changed; a lookup reads the copies only and checks the versions of visited nodes,
+        so it neither locks anything nor touches MRU order of the cache
+        */
+        struct HotTier
+        {
+            static constexpr uint32_t Beyond = std::numeric_limits< uint32_t >::max();
+
+            struct Node
+            {
+                std::weak_ptr< const BTree > node_;                 // expired for the root
+                uint64_t version_;
+                NodeUid uid_;
+                DigestCollection digests_;
+                LinkCollection links_;
+                static_vector< uint32_t, BTreeCapacity + 1 > children_;    // tier nodes by links, Beyond for lower levels
+            };
+
+            std::vector< Node > nodes_;
+        };
+
+
+        /* Refreshes pinned upper levels of b-tree when a writer leaves, see pin_hot_tier()
+
+        Readers never rebuild the snapshot, so each writer of the b-tree refreshes it once its
+        modifications are committed or rolled back. A writer of a node other than the root finds the
+        root by the search path
+        */
+        class HotTierRefresh
+        {
+            const BTree & node_;
+            NodeUid root_;
+
+        public:
+
+            HotTierRefresh( const HotTierRefresh & ) = delete;
+            HotTierRefresh & operator = ( const HotTierRefresh & ) = delete;
+
+            explicit HotTierRefresh( const BTree & root ) noexcept : node_( root ), root_( root.uid_ ) {}
+
+            HotTierRefresh( const BTree & node, const BTreePath & bpath ) noexcept
+                : node_( node )
+                , root_( bpath.empty() ? node.uid_ : bpath.front().first )
+            {
+            }
+
+            ~HotTierRefresh()
+            {
+                if ( root_ == node_.uid_ )
+                {
+                    node_.refresh_hot_tier();
+                }
+                else if ( auto root = node_.cache_.find_node( root_ ) )
+                {
+                    root->refresh_hot_tier();
+                }
+            }
+        };
+
+
+        /* Builds snapshot of upper levels of b-tree rooted at the node
+
+        @param [in] levels - number of levels to be copied
+        @retval std::shared_ptr< const HotTier > - the snapshot
+        @throw std::bad_alloc, btree_error, btree_cache_error, storage_file_error
+        @note called by writers only, must not be called under VersionGuard over a node of the b-tree
+        */
+        std::shared_ptr< const HotTier > build_hot_tier( size_t levels ) const
+        {
+            using namespace std;
+
+            auto tier = make_shared< HotTier >();
+            vector< size_t > depths;
+
+            // the nodes are held while the tier is being built only
+            vector< BTreeP > held;
+
+            tier->nodes_.push_back( typename HotTier::Node{} );
+            depths.push_back( 0 );
+
+            for ( size_t i = 0; i < tier->nodes_.size(); ++i )
+            {
+                const BTree & node = i ? *held[ i - 1 ] : *this;
+
+                boost::shared_lock< boost::upgrade_mutex > lock{ node.latch_ };
+
+                // the vector may be reallocated by children below
+                {
+                    auto & copy = tier->nodes_[ i ];
+                    copy.version_ = node.version_.load( memory_order_acquire );
+                    copy.uid_ = node.uid_;
+                    copy.digests_ = node.digests_;
+                    copy.links_ = node.links_;
+                    copy.children_.assign( node.links_.size(), HotTier::Beyond );
+                }
+
+                if ( depths[ i ] + 1 >= levels ) continue;
+
+                for ( size_t l = 0; l < node.links_.size(); ++l )
+                {
+                    if ( const auto link = node.links_[ l ]; InvalidNodeUid != link )
+                    {
+                        auto child = cache_.get_node( link );
+
+                        tier->nodes_[ i ].children_[ l ] = static_cast< uint32_t >( tier->nodes_.size() );
+                        tier->nodes_.push_back( typename HotTier::Node{ child } );
+                        held.push_back( move( child ) );
+                        depths.push_back( depths[ i ] + 1 );
+                    }
+                }
+            }
+
+            return tier;
+        }
+
+
+        /* Replaces snapshot of upper levels with fresh one if the b-tree is pinned
+
+        A snapshot that cannot be built is dropped, readers go on with regular search till the next
+        writer refreshes it
+
+        @throw nothing
+        @note the node must be the root of b-tree
+        */
+        void refresh_hot_tier() const noexcept
+        {
+            using namespace std;
+
+            const auto levels = hot_levels_.load( memory_order_relaxed );
+            if ( !levels ) return;
+
+            try
+            {
+                atomic_store( &hot_tier_, build_hot_tier( levels ) );
+            }
+            catch ( ... )
+            {
+                atomic_store( &hot_tier_, shared_ptr< const HotTier >{} );
+            }
+        }
+
+
+        /* Makes one attempt to find a digest through snapshot of upper levels
+
+        The snapshot is read as is, then the versions of visited nodes are checked: if none of them
+        has changed, the copies were actual at that moment. Below the snapshot the search goes on
+        by find_digest() from the first node out of the tier if it's cached, and the versions are
+        checked once again, so the node was still linked while being searched
+
+        @param [in] tier - snapshot
+        @param [in] digest - key to be found
+        @param [in/out] path - search path
+        @retval std::optional< bool > - if digest found, nothing if the snapshot is stale
+        @throw btree_error, btree_cache_error, storage_file_error
+        */
+        std::optional< bool > try_find_hot( const HotTier & tier, Digest digest, BTreePath & path ) const
+        {
+            using namespace std;
+
+            static_vector< const typename HotTier::Node*, BTreeMaxDepth > visited;
+
+            auto actual = [&] () noexcept {
+                return all_of( begin( visited ), end( visited ), [&] ( auto n ) noexcept {
+                    if ( n == &tier.nodes_.front() ) return version_.load( memory_order_acquire ) == n->version_;
+
+                    auto node = n->node_.lock();
+                    return node && node->version_.load( memory_order_acquire ) == n->version_;
+                } );
+            };
+
+            for ( const auto * n = &tier.nodes_.front(); ; )
+            {
+                throw_btree_error( path.size() < path.capacity(), RetCode::SubkeyLimitReached );
+
+                visited.push_back( n );
+
+                const auto size = n->digests_.size();
+                const auto d = details::digest_lower_bound( n->digests_.data(), size, digest );
+
+                path.emplace_back( n->uid_, d );
+
+                if ( d < size && n->digests_[ d ] == digest ) return actual() ? optional< bool >{ true } : nullopt;
+
+                const auto link = n->links_[ d ];
+                if ( InvalidNodeUid == link ) return actual() ? optional< bool >{ false } : nullopt;
+
+                if ( HotTier::Beyond != n->children_[ d ] )
+                {
+                    n = &tier.nodes_[ n->children_[ d ] ];
+                    continue;
+                }
+
+                if ( !actual() ) return nullopt;
+
+                // a node missing in the cache is left for regular search
+                auto child = cache_.find_node( link );
+                if ( !child ) return nullopt;
+
+                throw_btree_error( path.size() < path.capacity(), RetCode::SubkeyLimitReached );
+
+                const bool found = child->find_digest( digest, path );
+                return actual() ? optional< bool >{ found } : nullopt;
+            }
+        }
+
+
+    public:
+
+        /** The class is not default creatible/copyable/movable
+        */
+        BTree() = delete;
+        BTree( BTree&& ) = delete;
+
+
+        /* Explicit constructor
+
+        @param [in] file - associated storage file
+        @param [in] cache - associated b-tree node cache
+        @throw nothing
+        */
+        explicit BTree( StorageFile & file, BTreeCache & cache ) noexcept
+            : uid_( InvalidNodeUid )
+            , file_( file )
+            , cache_( cache )
+            , btree_min_( file.btree_power() - 1 )
+            , btree_max_( 2 * file.btree_power() - 1 )
+        {
+            links_.push_back( InvalidNodeUid );
         }
 
 
         /** Provides b-tree node uid
 
-        @retval NodeUid - uid
-        @throw nothing
-        */
-        auto uid() const noexcept { return uid_; }
+        @retval NodeUid - uid
+        @throw nothing
+        */
+        auto uid() const noexcept { return uid_; }
+
+
+        /** Provides access to b-tree node guard
+
+        @retval boost::upgrade_mutex - guard
+        @throw nothing
+        */
+        auto & guard() const noexcept { return guard_; }
+
+
+        /** Provides value of an element at given position
+
+        @param [in] ndx - position
+        @retval Value - the element's value
+        @throw btree_error, storage_file_error
+        */
+        const auto value( size_t ndx )
+        {
+            throw_logic_error( ndx < elements_.size(), "Invalid position" );
+            return elements_[ ndx ].value_.unpack( file_ );
+        }
+
+
+        /** Provides streaming reader over BLOB value of an element at given position
+
+        Unlike value() the function does not materialize the value, the data may be read in pieces
+        or by ranges
+
+        @param [in] ndx - position
+        @retval BlobReader - reader object
+        @throw btree_error, storage_file_error
+        */
+        auto value_reader( size_t ndx ) const
+        {
+            throw_logic_error( ndx < elements_.size(), "Invalid position" );
+            return elements_[ ndx ].value_.make_reader( file_ );
+        }
+
+
+        /** Provides expiration timemark for an element at given position
+
+        @param [in] ndx - element position
+        @retval uint64_t - expiration time in msecs from epoch
+        */
+        const auto & good_before( size_t ndx ) const noexcept
+        {
+            throw_logic_error( ndx < elements_.size(), "Invalid position" );
+            return elements_[ ndx ].good_before_;
+        }
+
+
+        /** Provides name of subkey represented by an element at given position
+
+        @param [in] ndx - element position
+        @retval Key - subkey name
+        @throw nothing
+        */
+        const auto & name( size_t ndx ) const noexcept
+        {
+            throw_logic_error( ndx < elements_.size(), "Invalid position" );
+            return elements_[ ndx ].name_;
+        }
+
+
+        /** Provides UID of b-tree containing element's children
+
+        @param [in] ndx - element position
+        @retval NodeUid - uid of children b-tree
+        @throw nothing
+        */
+        const auto & children( size_t ndx ) const noexcept
+        {
+            throw_logic_error( ndx < elements_.size(), "Invalid position" );
+            return elements_[ ndx ].children_;
+        }
+
+
+        /** Pins upper levels of b-tree rooted at the node
+
+        The levels are kept as read-only snapshot, see HotTier, so searches go through them without
+        the cache. Writers of the b-tree rebuild the snapshot after commit, see HotTierRefresh, a
+        search meeting a stale snapshot goes on with regular search
+
+        @param [in] levels - number of levels to be pinned
+        @throw std::bad_alloc, btree_error, btree_cache_error, storage_file_error
+        @note the node must be the root of b-tree, the pinning lasts while the node is held
+        */
+        void pin_hot_tier( size_t levels = BTreeHotLevels )
+        {
+            throw_logic_error( levels > 0, "Invalid number of levels" );
+
+            hot_levels_.store( levels, std::memory_order_relaxed );
+            std::atomic_store( &hot_tier_, build_hot_tier( levels ) );
+        }
+
+
+        /** Releases pinned upper levels of b-tree rooted at the node
+
+        @throw nothing
+        */
+        void unpin_hot_tier() noexcept
+        {
+            hot_levels_.store( 0, std::memory_order_relaxed );
+            std::atomic_store( &hot_tier_, std::shared_ptr< const HotTier >{} );
+        }
+
+
+        /** Searches through b-tree for given key digest...
+
+        accumulates search path that can be later used as a hint for upcoming operation. The search
+        descends without locking the nodes and validates node versions instead, on conflict with a
+        writer it restarts from the root. After several conflicts the search waits on node latches
+
+        If upper levels of the b-tree are pinned, the search starts through them, see pin_hot_tier()
+
+        @param [in] digest - key to be found
+        @param [out] path - search path
+        @retval bool - if digest found
+        @throw btree_error, btree_cache_error, storage_file_error
+        @note must not be called by a writer holding VersionGuard over a node of the b-tree
+        */
+        bool find_digest( Digest digest, BTreePath & path ) const
+        {
+            using namespace std;
+
+            const auto path_size = path.size();
+
+            // pinned upper levels, rebuilt by writers
+            if ( hot_levels_.load( memory_order_relaxed ) )
+            {
+                if ( auto tier = atomic_load( &hot_tier_ ) )
+                {
+                    if ( auto found = try_find_hot( *tier, digest, path ) ) return *found;
+                    path.resize( path_size );
+                }
+            }
+
+            for ( size_t attempt = 0; ; ++attempt )
+            {
+                path.resize( path_size );
+
+                const bool optimistic = attempt < OptimisticAttempts;
+
+                if ( auto found = try_find_digest( digest, path, optimistic ) )
+                {
+                    return *found;
+                }
+
+                // locking attempt waits for the writer, no need to yield
+                if ( optimistic ) this_thread::yield();
+            }
+        }
+
+
+        /** Searches through b-tree for a batch of digests at once
+
+        Sibling subkeys are usually read together and share the most of their search paths. The
+        digests are searched by merge descent, so each node on the way is visited once for the
+        whole batch, see find_digest_range()
+
+        @param [in] digests - keys to be found, sorted ascending
+        @param [out] paths - search paths, one per digest
+        @retval std::vector< bool > - if the digests found
+        @throw btree_error, btree_cache_error, storage_file_error
+        @note must not be called by a writer holding VersionGuard over a node of the b-tree
+        */
+        std::vector< bool > find_digests( const std::vector< Digest > & digests, std::vector< BTreePath > & paths ) const
+        {
+            using namespace std;
+
+            throw_logic_error( is_sorted( begin( digests ), end( digests ) ), "Digests must be sorted" );
+
+            paths.assign( digests.size(), BTreePath{} );
+            vector< bool > found( digests.size(), false );
+
+            if ( !digests.empty() ) find_digest_range( *this, digests.data(), 0, digests.size(), paths, found, nullptr, 0 );
+
+            return found;
+        }
+
+
+        /** Searches through b-tree for a batch of unrelated digests
+
+        Each lookup is a chain of dependent node reads, and a node missing in the cache stalls
+        the chain till the node is loaded. The lookups of the batch are interleaved instead: a
+        lookup meeting a missing node queues it for reading ahead by the cache maintenance thread
+        and yields, the others go on meanwhile. When every lookup waits, one missing node is loaded
+        in place, so the batch never waits for the maintenance only. So the misses of the batch
+        overlap instead of being paid one by one. A lookup conflicting with writers too many times
+        is completed by find_digest()
+
+        @param [in] digests - keys to be found in any order
+        @param [out] paths - search paths, one per digest
+        @retval std::vector< bool > - if the digests found
+        @throw btree_error, btree_cache_error, storage_file_error
+        @note must not be called by a writer holding VersionGuard over a node of the b-tree
+        */
+        std::vector< bool > find_scattered_digests( const std::vector< Digest > & digests, std::vector< BTreePath > & paths ) const
+        {
+            using namespace std;
+
+            paths.assign( digests.size(), BTreePath{} );
+            vector< bool > found( digests.size(), false );
+
+            vector< Lookup > lookups( digests.size() );
+            for ( auto & l : lookups ) l.node_ = this;
+
+            vector< size_t > active( digests.size() );
+            for ( size_t i = 0; i < active.size(); ++i ) active[ i ] = i;
+
+            size_t loads = 0;
+
+            while ( !active.empty() )
+            {
+                bool progressed = false;
+
+                for ( size_t a = 0; a < active.size(); )
+                {
+                    const auto i = active[ a ];
+                    auto & l = lookups[ i ];
+
+                    if ( InvalidNodeUid != l.pending_ )
+                    {
+                        if ( !cache_.find_node( l.pending_ ) )
+                        {
+                            ++a;
+                            continue;
+                        }
+
+                        --loads;
+                        resume( l, paths[ i ] );
+                    }
+
+                    progressed = true;
+
+                    optional< bool > result;
+
+                    if ( l.restarts_ >= OptimisticAttempts )
+                    {
+                        paths[ i ].clear();
+                        result = find_digest( digests[ i ], paths[ i ] );
+                    }
+                    else
+                    {
+                        result = advance( digests[ i ], paths[ i ], l, loads );
+                    }
+
+                    if ( result )
+                    {
+                        found[ i ] = *result;
+                        lookups[ i ] = Lookup{};
+                        active[ a ] = active.back();
+                        active.pop_back();
+                    }
+                    else
+                    {
+                        ++a;
+                    }
+                }
+
+                // all the lookups are waiting for loads, the request may be dropped or queued behind others
+                if ( !progressed )
+                {
+                    auto & l = lookups[ active.front() ];
+
+                    --loads;
+                    resume( l, paths[ active.front() ] );
+                }
+            }
+
+            return found;
+        }
+
+
+        /** Inserts new subkey with given parameters to the key at specified position
+
+        @param [in] pos - insert position
+        @param [in] bpath - path from b-tree root
+        @param [in] digest - subkey digest
+        @param [in] name - subkey name
+        @param [in] value - value to be assigned to new subkey
+        @param [in] good_before - expiration mark for the subkey
+        @param [in] overwrite - overwrite existing subkey
+        @throw btree_error, btree_cache_error, storage_file_error
+        @note in write-back mode simple changes stay in memory till the cache flushes the node
+        @note in lazy erasing mode the caller must hold structure lock of the cache since the search
+        */
+        auto insert( Pos pos, BTreePath & bpath, Digest digest, const Key & name, const Value & value, uint64_t good_before, bool overwrite )
+        {
+            throw_logic_error( pos <= elements_.size(), "Invalid position" );
+
+            HotTierRefresh refresh( *this, bpath );
+
+            // try to avoid immediate writing
+            if ( insert_deferred( pos, digest, name, value, good_before, overwrite ) ) return;
+
+            if ( ExpirationIndex && good_before ) ensure_expiration_index();
+
+            const auto root = bpath.empty() ? uid_ : bpath.front().first;
+
+            // open transaction
+            auto t = file_.open_transaction();
+
+            // pack value
+            PackedValue p = PackedValue::make_packed( t, value );
+
+            // insert element
+            Element e{ digest, good_before, InvalidNodeUid, p, name };
+            insert_element( t, pos, bpath, e, overwrite );
+
+            // register expiring subkey
+            index_expirations( t, root, { { digest, good_before } } );
+
+            // finalize transaction
+            t.commit();
+        }
+
+
+        /** Inserts new subkey into b-tree rooted at this node
+
+        Finds the position itself. If BTreeTopDown policy is set, new subkey goes from the root down
+        to a leaf once relieving full nodes on the way, otherwise it's inserted to the leaf and
+        overflow is propagated up through the path. Top-down insertion requires 2 preserved chunks
+        per level, so too high b-tree, or one which full nodes cannot be relieved, falls back to
+        bottom-up one
+
+        @param [in] digest - subkey digest
+        @param [in] name - subkey name
+        @param [in] value - value to be assigned to new subkey
+        @param [in] good_before - expiration mark for the subkey
+        @param [in] overwrite - overwrite existing subkey
+        @throw btree_error, btree_cache_error, storage_file_error
+        @note the node must be the root of b-tree
+        */
+        void insert_subkey( Digest digest, const Key & name, const Value & value, uint64_t good_before, bool overwrite )
+        {
+            auto structure = lock_structure();
+            HotTierRefresh refresh( *this );
+
+            BTreePath bpath;
+            const bool exists = find_digest( digest, bpath );
+
+            auto[ uid, pos ] = bpath.back();
+            bpath.pop_back();
+
+            BTreeP node;
+            BTree & target = resolve( uid, node );
+
+            // overwriting of existing subkey makes no structural changes, regular insertion does it
+            const auto levels = BTreeTopDown && !exists ? insert_top_down_levels( digest ) : std::nullopt;
+
+            if ( levels && 2 * ( *levels + 1 ) < PreservedChunkNumber )
+            {
+                if ( target.insert_deferred( pos, digest, name, value, good_before, overwrite ) ) return;
+
+                if ( ExpirationIndex && good_before ) ensure_expiration_index();
+
+                auto t = file_.open_transaction();
+
+                Element e{ digest, good_before, InvalidNodeUid, PackedValue::make_packed( t, value ), name };
+                insert_top_down( t, e );
+
+                index_expirations( t, uid_, { { digest, good_before } } );
+
+                t.commit();
+            }
+            else
+            {
+                target.insert( pos, bpath, digest, name, value, good_before, overwrite );
+            }
+        }
+
+
+        /** Erases specified b-tree node element
+
+        If BTreeLazyErase policy is set and the erasing would affect other nodes, the element is
+        marked as a tombstone in place, so the erasing takes single node write. The tombstone looks
+        expired to readers and is removed with rebalancing by background maintenance of the cache
+
+        @param [in] pos - position of element to be removed
+        @param [in] bpath - path from b-tree root
+        @throw btree_error, btree_cache_error, storage_file_error
+        @note in write-back mode simple changes stay in memory till the cache flushes the node
+        @note in lazy erasing mode the caller must hold structure lock of the cache since the search
+        */
+        auto erase( Pos pos, BTreePath & bpath )
+        {
+            throw_logic_error( pos < elements_.size(), "Invalid position" );
+
+            HotTierRefresh refresh( *this, bpath );
+
+            // try to avoid immediate writing
+            if ( erase_deferred( pos, bpath ) ) return;
+
+            // open transaction
+            auto t = file_.open_transaction();
+            bool detached = false;
+
+            // erase children b-tree if empty
+            if ( auto children = elements_[ pos ].children_; InvalidNodeUid != children )
+            {
+                throw_btree_error( cache_.get_node( children )->vacant(), RetCode::NotLeaf );
+
+                detached = release_vacant( t, children );
+            }
+
+            unindex_erased( t, bpath.empty() ? uid_ : bpath.front().first, elements_[ pos ] );
+
+            // erase the element
+            elements_[ pos ].value_.erase_blob( t );
+
+            if ( BTreeLazyErase && !( is_leaf() && ( bpath.empty() || elements_.size() > btree_min_ ) ) )
+            {
+                const auto digest = elements_[ pos ].digest_;
+
+                bury( t, pos );
+                t.commit();
+
+                if ( detached ) cache_.request_reclaim();
+
+                try
+                {
+                    cache_.note_tombstone( bpath.empty() ? uid_ : bpath.front().first, digest );
+                }
+                catch ( ... )
+                {
+                    // the subkey is erased anyway, the tombstone just stays till overwritten
+                }
+
+                return;
+            }
+
+            // the erasing may restructure the b-tree, so the nodes are written by a batch over the root
+            BTreeP root;
+            resolve( bpath.empty() ? uid_ : bpath.front().first, root ).run_batch( t, [&] ( Transaction & t ) {
+                erase_element( t, pos, bpath );
+            }, [&] {
+                t.commit();
+            } );
+
+            if ( detached ) cache_.request_reclaim();
+        }
+
+
+        /** Erases a subkey from b-tree rooted at this node
+
+        Finds the subkey itself. If BTreeTopDown policy is set, the erasing goes from the root down
+        to a leaf once topping up minimal nodes on the way, otherwise underflow is propagated up
+        through the path. Top-down erasing requires 2 preserved chunks per level, so too high b-tree,
+        or one which minimal nodes cannot be topped up, falls back to bottom-up one
+
+        @param [in] digest - subkey digest
+        @retval bool - false if the subkey does not exist
+        @throw btree_error, btree_cache_error, storage_file_error
+        @note the node must be the root of b-tree
+        */
+        bool erase_subkey( Digest digest )
+        {
+            auto structure = lock_structure();
+            HotTierRefresh refresh( *this );
+
+            BTreePath bpath;
+            if ( !find_digest( digest, bpath ) || met_tombstone( bpath ) ) return false;
+
+            auto[ uid, pos ] = bpath.back();
+            bpath.pop_back();
+
+            BTreeP node;
+            BTree & target = resolve( uid, node );
+
+            const auto levels = BTreeTopDown && !BTreeLazyErase ? erase_top_down_levels( digest ) : std::nullopt;
+
+            if ( !levels || 2 * ( *levels + 1 ) >= PreservedChunkNumber )
+            {
+                target.erase( pos, bpath );
+                return true;
+            }
+
+            // try to avoid immediate writing
+            if ( target.erase_deferred( pos, bpath ) ) return true;
+
+            auto t = file_.open_transaction();
+            bool detached = false;
+
+            // erase children b-tree if empty
+            if ( auto children = target.elements_[ pos ].children_; InvalidNodeUid != children )
+            {
+                throw_btree_error( cache_.get_node( children )->vacant(), RetCode::NotLeaf );
+
+                detached = release_vacant( t, children );
+            }
+
+            unindex_erased( t, uid_, target.elements_[ pos ] );
+
+            target.elements_[ pos ].value_.erase_blob( t );
+            erase_top_down( t, digest );
+
+            t.commit();
+
+            if ( detached ) cache_.request_reclaim();
+
+            return true;
+        }
+
+
+        /** Erases specified b-tree node element together with whole subtree of its children
+
+        Unlike erase() the element may have children. The children b-tree is unlinked and registered
+        as detached by a single transaction, so the erasing takes the same time regardless of the
+        subtree size. Nodes and BLOBs of the detached b-tree are released later by background
+        reclamation of the cache, see reclaim_detached()
+
+        @param [in] pos - position of element to be removed
+        @param [in] bpath - path from b-tree root
+        @throw btree_error, btree_cache_error, storage_file_error
+        */
+        void erase_subtree( Pos pos, BTreePath & bpath )
+        {
+            throw_logic_error( pos < elements_.size(), "Invalid position" );
+
+            const auto children = elements_[ pos ].children_;
+
+            if ( InvalidNodeUid == children ) return erase( pos, bpath );
+
+            HotTierRefresh refresh( *this, bpath );
+
+            // open transaction
+            auto t = file_.open_transaction();
+
+            // unlink children b-tree and erase the element
+            t.detach_btree( children );
+            unindex_erased( t, bpath.empty() ? uid_ : bpath.front().first, elements_[ pos ] );
+            elements_[ pos ].value_.erase_blob( t );
+
+            BTreeP root;
+            resolve( bpath.empty() ? uid_ : bpath.front().first, root ).run_batch( t, [&] ( Transaction & t ) {
+                erase_element( t, pos, bpath );
+            }, [&] {
+                t.commit();
+            } );
+
+            cache_.request_reclaim();
+        }
+
+
+        /** Moves a subkey with whole subtree of its children to another key or under another name
+
+        The children b-tree is not copied: new element under the target takes the same children
+        b-tree and the same value, then the source element is removed, both in one transaction. So
+        the operation takes a few node writes regardless of the subtree size. Existing target subkey
+        is replaced if allowed, its children b-tree is detached and reclaimed in background
+
+        @param [in] digest - digest of the subkey to be moved
+        @param [in] target - root of b-tree of the target key, may be this b-tree for renaming
+        @param [in] target_digest - digest of the subkey under the target
+        @param [in] target_name - name of the subkey under the target
+        @param [in] overwrite - replace existing target subkey
+        @param [in] target_lineage - roots of b-trees on the way from the volume root to the target
+        b-tree inclusive, the move is rejected if the subtree being moved is one of them
+        @throw btree_error, btree_cache_error, storage_file_error
+        @note both nodes must be roots of their b-trees
+        */
+        void move_subkey( Digest digest, BTree & target, Digest target_digest, const Key & target_name, bool overwrite, const std::vector< NodeUid > & target_lineage )
+        {
+            using namespace std;
+
+            if ( &target == this && digest == target_digest ) return;
+
+            auto structure = lock_structure();
+            HotTierRefresh refresh( *this ), target_refresh( target );
+
+            if ( ExpirationIndex ) ensure_expiration_index();
+
+            // check both ends before any modification
+            BTreePath bpath;
+            throw_btree_error( find_digest( digest, bpath ) && !met_tombstone( bpath ), RetCode::NotFound );
+
+            // a key cannot be moved under itself or under its own descendant
+            {
+                auto[ uid, pos ] = bpath.back();
+
+                BTreeP node;
+                const auto children = resolve( uid, node ).elements_[ pos ].children_;
+
+                const bool cycle = InvalidNodeUid != children && find( begin( target_lineage ), end( target_lineage ), children ) != end( target_lineage );
+                throw_btree_error( !cycle, RetCode::InvalidKey );
+            }
+
+            BTreePath tpath;
+            const bool exists = target.find_digest( target_digest, tpath ) && !target.buried( tpath );
+            throw_btree_error( !exists || overwrite, RetCode::AlreadyExists );
+
+            // open transaction
+            auto t = file_.open_transaction();
+
+            bool detached = false;
+            Element e;
+
+            // each node is modified in place and written once by the end of the batch, the source
+            // and the target may share nodes
+            const auto place = [&] ( Transaction & t ) {
+                // the erasing could restructure the target b-tree, look for the position again
+                BTreePath tpath;
+                target.find_digest( target_digest, tpath );
+
+                auto[ tuid, tpos ] = tpath.back();
+                tpath.pop_back();
+
+                BTreeP tnode;
+                BTree & destination = target.resolve( tuid, tnode );
+
+                // replaced subkey gives its children b-tree away
+                detached = exists && InvalidNodeUid != destination.elements_[ tpos ].children_;
+                if ( detached ) t.detach_btree( destination.elements_[ tpos ].children_ );
+
+                e.digest_ = target_digest;
+                e.name_ = target_name;
+                destination.insert_element( t, tpos, tpath, e, exists );
+            };
+
+            // the entry of the source subkey is moved to the target one
+            const auto finish = [&] {
+                const ExpiringSubkeys erased = ExpirationIndex && e.good_before_ ? ExpiringSubkeys{ { digest, e.good_before_ } } : ExpiringSubkeys{};
+                reindex_expirations( t, uid_, erased, target.uid_, { { target_digest, e.good_before_ } } );
+
+                t.commit();
+            };
+
+            run_batch( t, [&] ( Transaction & t ) {
+                // unlink the element from the source without releasing its BLOB and children
+                auto[ uid, pos ] = bpath.back();
+                bpath.pop_back();
+
+                BTreeP node;
+                BTree & source = resolve( uid, node );
+
+                e = source.elements_[ pos ];
+                source.erase_element( t, pos, bpath );
+
+                if ( &target == this ) place( t );
+            }, [&] {
+                if ( &target == this ) return finish();
+
+                target.run_batch( t, place, finish );
+            } );
+
+            if ( detached ) cache_.request_reclaim();
+        }
+
+
+        /** Releases a portion of detached b-trees
+
+        Takes up to limit detached nodes, releases their chains and BLOBs and detaches their children
+        within one transaction, so the reclamation may be interrupted at any moment and resumed on the
+        next run. Cached copy of a node is preferred to the stored one, it may keep not flushed
+        modifications
+
+        A node still held by a reader, a cursor or a pending read-ahead is not released, it's returned
+        to the list and retried later. Its children stay reachable till the node is released, so
+        they are not freed under the holder either
+
+        Each node is listed with the root of its b-tree, so expiration index entries of released
+        subkeys are removed within the same transaction and never refer to a reused root
+
+        @param [in] file - storage file
+        @param [in] cache - b-tree node cache
+        @param [in] limit - maximum number of nodes to be released
+        @retval bool - true if there are detached nodes remaining
+        @retval bool - true if some nodes have been deferred since they are in use
+        @throw btree_error, btree_cache_error, storage_file_error
+        */
+        static std::tuple< bool, bool > reclaim_detached( StorageFile & file, BTreeCache & cache, size_t limit )
+        {
+            auto t = file.open_transaction();
+
+            using namespace std;
+
+            auto nodes = t.take_detached_btrees( limit );
+            if ( nodes.empty() ) return { false, false };
+
+            bool deferred = false;
+            size_t released = 0;
+            unordered_map< NodeUid, ExpiringSubkeys > expiring;
+
+            for ( const auto & detached : nodes )
+            {
+                const auto[ uid, root ] = detached;
+
+                if ( cache.in_use( uid ) )
+                {
+                    t.defer_detached_btree( detached );
+                    deferred = true;
+                    continue;
+                }
+
+                BTreeP cached = cache.find_node( uid );
+                BTree loaded( file, cache );
+                if ( !cached ) loaded.load( uid );
+
+                const BTree & node = cached ? *cached : loaded;
+
+                for ( const auto & e : node.elements_ )
+                {
+                    e.value_.erase_blob( t );
+                    if ( InvalidNodeUid != e.children_ ) t.detach_btree( e.children_ );
+                    if ( ExpirationIndex && indexed( e.good_before_ ) ) expiring[ root ].emplace_back( e.digest_, e.good_before_ );
+                }
+
+                for ( auto link : node.links_ )
+                {
+                    if ( InvalidNodeUid != link ) t.detach_node( link, root );
+                }
+
+                t.erase_chain( uid );
+                cache.drop( uid );
+                ++released;
+            }
 
+            // nothing to persist, let the transaction roll back
+            if ( !released ) return { true, true };
 
-        /** Provides access to b-tree node guard
+            if ( const auto index_uid = t.expiration_index(); !expiring.empty() && InvalidNodeUid != index_uid )
+            {
+                auto index = cache.get_node( index_uid );
+                for ( const auto & item : expiring ) index->unindex_expirations( t, item.first, item.second );
+            }
 
-        @retval boost::upgrade_mutex - guard
-        @throw nothing
-        */
-        auto & guard() const noexcept { return guard_; }
+            const bool more = t.detached_btrees() > 0;
 
+            t.commit();
 
-        /** Provides value of an element at given position
+            return { more, deferred };
+        }
 
-        @param [in] ndx - position
-        @retval Value - the element's value
-        @throw btree_error, storage_file_error
+
+        /** Erases a portion of expired subkeys registered in expiration index
+
+        Takes up to limit index entries with the earliest expiration marks. Subkeys of one b-tree are
+        erased under locks provided by the caller, the same locks a volume writer takes over the
+        b-tree, so a b-tree being read, written or locked by a mount is skipped. A subkey which still
+        has the registered expiration mark is erased with its BLOB, its children b-tree is detached
+        and reclaimed in background. Subkeys of one b-tree are erased by one batch and their entries
+        are removed from the index within the same transaction. Entries of rewritten subkeys are just
+        removed. Skipped b-trees and ones that cannot be read keep their entries till the next run
+
+        @tparam L - locker type, callable as lock( const BTreeP & root ), returns pair of key lock
+                    and structure lock, not owning key lock tells the b-tree may not be modified now
+        @param [in] file - storage file
+        @param [in] cache - b-tree node cache
+        @param [in] now - current time in msecs from epoch
+        @param [in] limit - maximum number of entries to be processed
+        @param [in] lock - locker
+        @retval bool - true if there may be more expired subkeys
+        @retval bool - true if some b-trees have been skipped
+        @throw btree_error, btree_cache_error, storage_file_error
         */
-        const auto value( size_t ndx )
+        template < typename L >
+        static std::tuple< bool, bool > reap_expired( StorageFile & file, BTreeCache & cache, uint64_t now, size_t limit, const L & lock )
         {
-            throw_logic_error( ndx < elements_.size(), "Invalid position" );
-            return elements_[ ndx ].value_.unpack( file_ );
+            using namespace std;
+
+            const auto index_uid = file.expiration_index();
+            if ( InvalidNodeUid == index_uid ) return { false, false };
+
+            auto index = cache.get_node( index_uid );
+
+            // the entries go in digest order that is expiration order
+            unordered_map< NodeUid, ExpiringSubkeys > expired;
+            size_t count = 0;
+
+            for ( const auto & name : Cursor( index, limit ).next_page() )
+            {
+                auto reference = parse_expiration_entry_name( name );
+                if ( !reference ) continue;
+
+                auto[ root, digest, good_before ] = *reference;
+                if ( good_before >= now ) break;
+
+                expired[ root ].emplace_back( digest, good_before );
+                ++count;
+            }
+
+            bool reclaim = false;
+            bool deferred = false;
+
+            for ( const auto & item : expired )
+            {
+                const auto root_uid = item.first;
+                const auto & subkeys = item.second;
+
+                try
+                {
+                    auto root = cache.get_node( root_uid );
+
+                    auto locks = lock( root );
+                    if ( !locks.first )
+                    {
+                        deferred = true;
+                        continue;
+                    }
+
+                    HotTierRefresh refresh( *root );
+
+                    auto t = file.open_transaction();
+
+                    root->run_batch( t, [&] ( Transaction & t ) {
+                        for ( auto[ digest, good_before ] : subkeys )
+                        {
+                            root->relieve_batch( t );
+
+                            BTreePath bpath;
+                            if ( !root->find_digest( digest, bpath ) ) continue;
+
+                            auto[ uid, pos ] = bpath.back();
+                            bpath.pop_back();
+
+                            BTreeP node;
+                            BTree & target = root->resolve( uid, node );
+
+                            // the subkey has been rewritten since registration
+                            auto & e = target.elements_[ pos ];
+                            if ( good_before != e.good_before_ ) continue;
+
+                            if ( InvalidNodeUid != e.children_ )
+                            {
+                                t.detach_btree( e.children_ );
+                                reclaim = true;
+                            }
+
+                            e.value_.erase_blob( t );
+                            target.erase_element( t, pos, bpath );
+                        }
+                    }, [&] {
+                        index->unindex_expirations( t, root_uid, subkeys );
+                        t.commit();
+                    } );
+                }
+                catch ( ... )
+                {
+                    // the entries stay in the index, try next run
+                    deferred = true;
+                }
+            }
+
+            if ( reclaim ) cache.request_reclaim();
+
+            return { count == limit, deferred };
         }
 
 
-        /** Provides expiration timemark for an element at given position
+        /** Builds b-tree from a batch of subkeys at once
 
-        @param [in] ndx - element position
-        @retval uint64_t - expiration time in msecs from epoch
+        The items are sorted by digest and packed into full nodes level by level from the leaves up
+        to the root, so each node is written once and the whole operation takes one transaction. Nodes
+        are filled by BTreeBulkLoadFill percents, leaving room for subsequent insertions. If a digest
+        repeats the last item wins
+
+        @param [in] items - subkeys to be loaded
+        @throw btree_error, btree_cache_error, storage_file_error
+        @note the node must be the root of an empty b-tree
         */
-        const auto & good_before( size_t ndx ) const noexcept
+        void bulk_load( std::vector< BulkItem > items )
         {
-            throw_logic_error( ndx < elements_.size(), "Invalid position" );
-            return elements_[ ndx ].good_before_;
+            using namespace std;
+
+            throw_logic_error( elements_.empty() && links_.size() == 1 && InvalidNodeUid == links_[ 0 ], "Bulk load requires empty b-tree" );
+
+            if ( items.empty() ) return;
+
+            HotTierRefresh refresh( *this );
+
+            // sort the items keeping the last one of equal digests
+            auto first = sort_bulk_items( items );
+
+            ExpiringSubkeys expiring;
+            for ( auto it = first; it != end( items ); ++it )
+            {
+                if ( ExpirationIndex && get< 2 >( *it ) ) expiring.emplace_back( get< 0 >( *it ), get< 2 >( *it ) );
+            }
+
+            if ( !expiring.empty() ) ensure_expiration_index();
+
+            // open transaction
+            auto t = file_.open_transaction();
+
+            // make leaf level
+            vector< Element > elements;
+            elements.reserve( static_cast< size_t >( distance( first, end( items ) ) ) );
+
+            for ( auto it = first; it != end( items ); ++it )
+            {
+                elements.push_back( Element{ get< 0 >( *it ), get< 2 >( *it ), InvalidNodeUid, PackedValue::make_packed( t, get< 1 >( *it ) ), move( get< 3 >( *it ) ) } );
+            }
+
+            vector< NodeUid > links( elements.size() + 1, InvalidNodeUid );
+
+            // desired number of elements per node
+            const size_t fill = clamp< size_t >( ( btree_max_ - 1 ) * BTreeBulkLoadFill / 100, btree_min_, btree_max_ - 1 );
+
+            // while the level does not fit the root
+            while ( elements.size() > btree_max_ - 1 )
+            {
+                const auto n = elements.size();
+
+                // number of nodes on the level: enough to keep fill factor but not too many to underflow
+                const size_t node_count = min( ( n + 1 + fill ) / ( fill + 1 ), ( n + 1 ) / ( btree_min_ + 1 ) );
+
+                // the nodes are separated by elements going to upper level
+                const size_t per_node = ( n + 1 - node_count ) / node_count;
+                const size_t remainder = ( n + 1 - node_count ) % node_count;
+
+                vector< Element > upper_elements;
+                upper_elements.reserve( node_count - 1 );
+
+                vector< NodeUid > upper_links;
+                upper_links.reserve( node_count );
+
+                for ( size_t i = 0, e = 0; i < node_count; ++i )
+                {
+                    const size_t size = per_node + ( i < remainder ? 1 : 0 );
+                    throw_logic_error( btree_min_ <= size && size < btree_max_, "Invalid size of b-tree node" );
+
+                    BTree node( file_, cache_ );
+                    node.elements_.assign( begin( elements ) + e, begin( elements ) + e + size );
+                    node.links_.assign( begin( links ) + e, begin( links ) + e + size + 1 );
+                    node.save( t );
+
+                    upper_links.push_back( node.uid_ );
+                    e += size;
+
+                    if ( i + 1 < node_count )
+                    {
+                        upper_elements.push_back( move( elements[ e++ ] ) );
+                    }
+                }
+
+                elements = move( upper_elements );
+                links = move( upper_links );
+            }
+
+            // the rest goes to the root
+            {
+                VersionGuard latch( *this );
+                elements_.assign( begin( elements ), end( elements ) );
+                links_.assign( begin( links ), end( links ) );
+                overwrite( t );
+            }
+
+            // register expiring subkeys
+            index_expirations( t, uid_, expiring );
+
+            // finalize transaction
+            t.commit();
         }
 
 
-        /** Provides UID of b-tree containing element's children
+        /** Inserts a batch of subkeys in one transaction
 
-        @param [in] ndx - element position
-        @retval NodeUid - uid of children b-tree
-        @throw nothing
+        The subkeys are sorted by digest, so neighbouring insertions share the nodes. Each modified
+        node is written once per batch regardless of number of insertions into it. If a digest
+        repeats the last item wins
+
+        @param [in] items - subkeys to be inserted
+        @param [in] overwrite - overwrite existing subkeys
+        @throw btree_error, btree_cache_error, storage_file_error
+        @note the node must be the root of b-tree and the caller must hold exclusive lock over the key
         */
-        const auto & children( size_t ndx ) const noexcept
+        void insert_batch( std::vector< BulkItem > items, bool overwrite )
         {
-            throw_logic_error( ndx < elements_.size(), "Invalid position" );
-            return elements_[ ndx ].children_;
+            using namespace std;
+
+            auto structure = lock_structure();
+            HotTierRefresh refresh( *this );
+
+            auto first = sort_bulk_items( items );
+
+            // check for existing subkeys before any modification
+            if ( !overwrite )
+            {
+                for ( auto it = first; it != end( items ); ++it )
+                {
+                    BTreePath path;
+                    throw_btree_error( !find_digest( get< 0 >( *it ), path ) || buried( path ), RetCode::AlreadyExists );
+                }
+            }
+
+            ExpiringSubkeys expiring;
+            for ( auto it = first; it != end( items ); ++it )
+            {
+                if ( ExpirationIndex && get< 2 >( *it ) ) expiring.emplace_back( get< 0 >( *it ), get< 2 >( *it ) );
+            }
+
+            if ( !expiring.empty() ) ensure_expiration_index();
+
+            auto t = file_.open_transaction();
+
+            run_batch( t, [&] ( Transaction & t ) {
+                for ( auto it = first; it != end( items ); ++it )
+                {
+                    relieve_batch( t );
+
+                    BTreePath bpath;
+                    find_digest( get< 0 >( *it ), bpath );
+
+                    auto[ uid, pos ] = bpath.back();
+                    bpath.pop_back();
+
+                    BTreeP node;
+                    BTree & target = resolve( uid, node );
+
+                    Element e{ get< 0 >( *it ), get< 2 >( *it ), InvalidNodeUid, PackedValue::make_packed( t, get< 1 >( *it ) ), move( get< 3 >( *it ) ) };
+                    target.insert_element( t, pos, bpath, e, overwrite );
+                }
+            }, [&] {
+                // the index is modified by the next batch of the same transaction
+                index_expirations( t, uid_, expiring );
+                t.commit();
+            } );
         }
 
 
-        /** Searches through b-tree for given key digest...
+        /** Erases a batch of subkeys in one transaction
 
-        accumulates search path that can be later used as a hint for upcoming operation
+        The digests are sorted, so neighbouring erasures share the nodes. Each modified node is
+        written once per batch. Missing subkeys are ignored
 
-        @param [in] digest - key to be found
-        @param [out] path - search path
-        @retval bool - if digest found
+        @param [in] digests - digests of subkeys to be erased
         @throw btree_error, btree_cache_error, storage_file_error
+        @note the node must be the root of b-tree and the caller must hold exclusive lock over the key
         */
-        bool find_digest( Digest digest, BTreePath & path ) const
+        void erase_batch( std::vector< Digest > digests )
         {
             using namespace std;
 
-            throw_logic_error( elements_.size() + 1 == links_.size(), "Broken b-tree node" );
+            auto structure = lock_structure();
+            HotTierRefresh refresh( *this );
 
-            Element e{ digest };
-            auto lower = lower_bound( begin( elements_ ), end( elements_ ), e );
+            sort( begin( digests ), end( digests ) );
+            digests.erase( unique( begin( digests ), end( digests ) ), end( digests ) );
 
-            size_t d = static_cast< size_t >( std::distance( begin( elements_ ), lower ) );
-            path.emplace_back( uid_, d );
+            // check that the subkeys have no children before any modification
+            for ( auto digest : digests )
+            {
+                BTreePath path;
+                if ( !find_digest( digest, path ) ) continue;
 
-            auto link = InvalidNodeUid;
+                auto[ uid, pos ] = path.back();
+                BTreeP node;
+                const BTree & target = resolve( uid, node );
 
-            if ( lower != end( elements_ ) )
-            {
-                if ( lower->digest_ == e.digest_ )
+                if ( auto children = target.elements_[ pos ].children_; InvalidNodeUid != children )
                 {
-                    return true;
+                    throw_btree_error( cache_.get_node( children )->vacant(), RetCode::NotLeaf );
                 }
-                else
+            }
+
+            ExpiringSubkeys erased;
+            bool detached = false;
+
+            auto t = file_.open_transaction();
+
+            run_batch( t, [&] ( Transaction & t ) {
+                for ( auto digest : digests )
+                {
+                    relieve_batch( t );
+
+                    BTreePath bpath;
+                    if ( !find_digest( digest, bpath ) ) continue;
+
+                    auto[ uid, pos ] = bpath.back();
+                    bpath.pop_back();
+
+                    BTreeP node;
+                    BTree & target = resolve( uid, node );
+
+                    // erase empty children b-tree
+                    if ( auto children = target.elements_[ pos ].children_; InvalidNodeUid != children )
+                    {
+                        detached = release_vacant( t, children ) || detached;
+                    }
+
+                    if ( const auto & e = target.elements_[ pos ]; ExpirationIndex && indexed( e.good_before_ ) )
+                    {
+                        erased.emplace_back( e.digest_, e.good_before_ );
+                    }
+
+                    target.elements_[ pos ].value_.erase_blob( t );
+                    target.erase_element( t, pos, bpath );
+                }
+            }, [&] {
+                // the index is modified by the next batch of the same transaction
+                if ( !erased.empty() && InvalidNodeUid != t.expiration_index() )
                 {
-                    link = links_[ d ];
+                    cache_.get_node( t.expiration_index() )->unindex_expirations( t, uid_, erased );
                 }
-            }
-            else
-            {
-                link = links_.back();
-            }
 
-            if ( link == InvalidNodeUid )
+                t.commit();
+            } );
+
+            if ( detached ) cache_.request_reclaim();
+        }
+
+
+        /** Applies numeric operation to the value of an element at given position
+
+        The writers of a b-tree are serialized by the lock over the key, so the value cannot change
+        between reading and writing. The node is overwritten in place by single transaction or, in
+        write-back mode, left for the flusher
+
+        @param [in] pos - element position
+        @param [in] op - operation
+        @param [in] operand - operand of the same type as the value
+        @param [in] expected - value expected by NumericOp::CompareExchange, ignored by others
+        @retval bool - false if NumericOp::CompareExchange found unexpected value
+        @retval Value - the value before the operation
+        @throw btree_error, btree_cache_error, storage_file_error
+        */
+        std::tuple< bool, Value > update( Pos pos, NumericOp op, const Value & operand, const Value & expected )
+        {
+            using namespace std;
+
+            throw_logic_error( pos < elements_.size(), "Invalid position" );
+
+            auto[ applied, previous, updated ] = elements_[ pos ].value_.apply( op, operand, expected );
+
+            // nothing changed
+            if ( updated.value_ == elements_[ pos ].value_.value_ ) return { applied, move( previous ) };
+
+            // try to avoid immediate writing
+            if ( cache_.defer_write( uid_ ) )
             {
-                return false;
+                VersionGuard latch( *this );
+                elements_[ pos ].value_ = updated;
             }
             else
             {
-                throw_btree_error( path.size() < path.capacity(), RetCode::SubkeyLimitReached );
+                auto t = file_.open_transaction();
+
+                {
+                    VersionGuard latch( *this );
+                    elements_[ pos ].value_ = updated;
+                    overwrite( t );
+                }
 
-                auto child = cache_.get_node( link );
-                return child->find_digest( digest, path );
+                t.commit();
             }
+
+            return { applied, move( previous ) };
         }
 
 
-        /** Inserts new subkey with given parameters to the key at specified position
+        /** Applies numeric operation to the value of a subkey in b-tree rooted at this node
+
+        Replaces reading the value and inserting new one: the search is done once, and the element
+        is overwritten without restructuring. Integer and floating point values are supported,
+        BLOB ones are not
 
-        @param [in] pos - insert position
-        @param [in] bpath - path from b-tree root
         @param [in] digest - subkey digest
-        @param [in] value - value to be assigned to new subkey
+        @param [in] op - operation
+        @param [in] operand - operand of the same type as the value
+        @param [in] expected - value expected by NumericOp::CompareExchange, ignored by others
+        @retval bool - false if NumericOp::CompareExchange found unexpected value
+        @retval Value - the value before the operation
+        @throw btree_error, btree_cache_error, storage_file_error
+        @note the node must be the root of b-tree and the caller must hold exclusive lock over the key
+        */
+        std::tuple< bool, Value > update_value( Digest digest, NumericOp op, const Value & operand, const Value & expected = Value{} )
+        {
+            auto structure = lock_structure();
+            HotTierRefresh refresh( *this );
+
+            BTreePath bpath;
+            throw_btree_error( find_digest( digest, bpath ) && !met_tombstone( bpath ), RetCode::NotFound );
+
+            const auto[ uid, pos ] = bpath.back();
+
+            BTreeP node;
+            BTree & target = resolve( uid, node );
+
+            // expired subkey stays till reaping, but it does not exist for readers already
+            const auto good_before = target.good_before( pos );
+            const uint64_t now = std::chrono::system_clock::now().time_since_epoch() / std::chrono::milliseconds( 1 );
+            throw_btree_error( !good_before || good_before >= now, RetCode::NotFound );
+
+            return target.update( pos, op, operand, expected );
+        }
+
+
+        /** Inserts a subkey combining the insertion with concurrent modifications of the b-tree
+
+        Concurrent writers queue their modifications and one of them applies all the queued ones by
+        single transaction under exclusive key lock over the b-tree, see apply_modifications(). So
+        many writers into the same key share node writes and the transaction instead of waiting for
+        each other
+
+        @param [in] digest - subkey digest
+        @param [in] name - subkey name
+        @param [in] value - value to be assigned to the subkey
         @param [in] good_before - expiration mark for the subkey
         @param [in] overwrite - overwrite existing subkey
+        @retval RetCode - Ok, AlreadyExists
         @throw btree_error, btree_cache_error, storage_file_error
+        @note the node must be the root of b-tree, the caller may hold locks over the keys above and
+              must not hold the lock over this b-tree, the combiner takes it exclusively
         */
-        auto insert( Pos pos, BTreePath & bpath, Digest digest, const Value & value, uint64_t good_before, bool overwrite )
+        RetCode combined_insert( Digest digest, const Key & name, const Value & value, uint64_t good_before, bool overwrite )
         {
-            throw_logic_error( pos <= elements_.size(), "Invalid position" );
-
-            // open transaction
-            auto t = file_.open_transaction();
+            Modification m{ Modification::Kind::Insert, digest, name, value, good_before, overwrite };
+            return combiner().execute( std::move( m ), [this] ( std::vector< Modification > & ms ) { return apply_combined( ms ); } );
+        }
 
-            // pack value
-            PackedValue p = PackedValue::make_packed( t, value );
 
-            // insert element
-            Element e{ digest, good_before, InvalidNodeUid, p };
-            insert_element( t, pos, bpath, e, overwrite );
+        /** Erases a subkey combining the erasing with concurrent modifications of the b-tree
 
-            // finalize transaction
-            t.commit();
+        @param [in] digest - subkey digest
+        @retval RetCode - Ok, NotFound, NotLeaf
+        @throw btree_error, btree_cache_error, storage_file_error
+        @note the node must be the root of b-tree, the caller must not hold the lock over this
+              b-tree, see combined_insert()
+        */
+        RetCode combined_erase( Digest digest )
+        {
+            Modification m{ Modification::Kind::Erase, digest, Key{}, Value{}, 0, false };
+            return combiner().execute( std::move( m ), [this] ( std::vector< Modification > & ms ) { return apply_combined( ms ); } );
         }
 
 
-        /** Erases specified b-tree node element
+        /** Inserts the first child of specified element
 
-        @param [in] pos - position of element to be removed
-        @param [in] bpath - path from b-tree root
+        An element without children keeps InvalidNodeUid instead of children b-tree, so leaf keys
+        take no chunks. The children b-tree is created right with the first child in its root, the
+        root is written once together with the link from the element
+
+        @param [in] pos - element position
+        @param [in] digest - child digest
+        @param [in] name - child name
+        @param [in] value - child value
+        @param [in] good_before - child expiration mark
         @throw btree_error, btree_cache_error, storage_file_error
+        @note the element must have no children b-tree, otherwise insert into existing one
         */
-        auto erase( Pos pos, BTreePath & bpath )
+        void insert_first_child( Pos pos, Digest digest, const Key & name, const Value & value, uint64_t good_before )
         {
             throw_logic_error( pos < elements_.size(), "Invalid position" );
+            throw_logic_error( InvalidNodeUid == elements_[ pos ].children_, "Children b-tree already exists" );
+
+            if ( ExpirationIndex && good_before ) ensure_expiration_index();
 
-            // open transaction
             auto t = file_.open_transaction();
 
-            // erase children b-tree if empty
-            if ( InvalidNodeUid != elements_[ pos ].children_ )
-            {
-                auto children = cache_.get_node( elements_[ pos ].children_ );
-                throw_btree_error( !children->elements_.size(), RetCode::NotLeaf );
+            BTree children( file_, cache_ );
+            children.elements_.push_back( Element{ digest, good_before, InvalidNodeUid, PackedValue::make_packed( t, value ), name } );
+            children.links_.push_back( InvalidNodeUid );
+            children.save( t );
 
-                t.erase_chain( elements_[ pos ].children_ );
+            {
+                VersionGuard latch( *this );
+                elements_[ pos ].children_ = children.uid_;
+                overwrite( t );
             }
 
-            // erase the element
-            erase_element( t, pos, bpath, bpath.size() );
+            index_expirations( t, children.uid_, { { digest, good_before } } );
 
-            // finalize transaction
             t.commit();
         }
 
 
-        /** Deploy children b-tree for specified element
+        /** Releases empty children b-tree of specified element
+
+        Returns the element to inline "no children" state, so a key which children have been erased
+        does not keep an empty chunk. The root is kept while anybody else holds it: a navigator may
+        wait for the key lock on its guard, the root is collapsed by the next erase then
 
         @param [in] pos - element position
+        @retval bool - true if the children b-tree has been released
         @throw btree_error, btree_cache_error, storage_file_error
+        @note the caller must hold exclusive lock over b-tree of the element and must not hold the
+              children root
         */
-        auto deploy_children_btree( Pos pos )
+        bool collapse_children( Pos pos )
         {
             throw_logic_error( pos < elements_.size(), "Invalid position" );
 
-            if ( InvalidNodeUid == elements_[ pos ].children_ )
-            {
-                auto t = file_.open_transaction();
+            const auto children = elements_[ pos ].children_;
+            if ( InvalidNodeUid == children || cache_.in_use( children ) || !cache_.get_node( children )->vacant() ) return false;
 
-                BTree children( file_, cache_ );
-                children.save( t );
+            auto t = file_.open_transaction();
 
-                elements_[ pos ].children_ = children.uid_;
-                overwrite( t );
+            const bool detached = release_vacant( t, children );
 
-                t.commit();
+            {
+                VersionGuard latch( *this );
+                elements_[ pos ].children_ = InvalidNodeUid;
+                overwrite( t );
             }
+
+            t.commit();
+
+            if ( detached ) cache_.request_reclaim();
+
+            return true;
         }
     };
 }
 
 
 #include "packed_value.h"
+#include "blob_reader.h"
+#include "b_tree_cursor.h"
 
 
 #endif
\ No newline at end of file
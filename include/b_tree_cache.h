@@ -4,7 +4,16 @@
 
 #include <unordered_map>
 #include <list>
+#include <vector>
 #include <exception>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <string>
+#include <sstream>
+#include <functional>
+#include <algorithm>
 #include <boost/thread/shared_mutex.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/lock_types.hpp>
@@ -19,6 +28,29 @@ namespace jb
     how the data represented on physical level). The class guaranties that each B tree node from
     a physical file has the only reflection on logical level.
 
+    In write-back mode (BTreeDirtyLimit > 0) the cache also keeps nodes modified in memory only. Such
+    nodes are pinned in the cache and periodically written to the file in place by background flusher,
+    several nodes per transaction. Each deferred modification affects a single node only, so any
+    subset of dirty nodes represents consistent b-tree on the disk. A deferred modification is already
+    acknowledged to the caller, so a dirty node is never evicted: a batch that fails after touching it
+    restores the node from the image taken before the batch, and the node stays dirty
+
+    The same background thread reclaims b-trees detached by subtree erasing: nodes and BLOBs of such
+    b-trees are released by small transactions, so the erasing itself takes a single short commit
+
+    In lazy erasing mode (BTreeLazyErase) the thread also collapses tombstones left by erasing: the
+    regular erasing with rebalancing is applied to them batch by batch. While a batch is being
+    collapsed, b-tree writers wait on the structure lock, readers are not affected
+
+    If ExpirationIndex policy is set, the thread also reaps expired subkeys registered in expiration
+    index every period, batch by batch under the same structure lock
+
+    Cursors ask the same thread to read ahead nodes they are about to visit, so enumeration does
+    not wait for the file on each page
+
+    The thread is started with the cache if a policy needs it periodically, otherwise on the first
+    request for reclamation or read-ahead
+
     @tparam Policies - global setting
     @tparam Pad - test pad
     */
@@ -26,10 +58,11 @@ namespace jb
     class Storage< Policies >::PhysicalVolumeImpl::BTreeCache
     {
         using BTree = typename PhysicalVolumeImpl::BTree;
-        using btree_error = typename BTree::btree_error;
-        using BTreeP = typename BTree::BTreeP;
-        using NodeUid = typename BTree::NodeUid;
+        using BTreeP = std::shared_ptr< BTree >;
         using StorageFile = typename PhysicalVolumeImpl::StorageFile;
+        using NodeUid = typename StorageFile::ChunkUid;
+        static constexpr auto InvalidNodeUid = StorageFile::InvalidChunkUid;
+        using Digest = typename Bloom::Digest;
         using storage_file_error = typename StorageFile::storage_file_error;
         using shared_lock = boost::upgrade_lock< boost::upgrade_mutex >;
         using exclusive_lock = boost::upgrade_to_unique_lock< boost::upgrade_mutex >;
@@ -46,6 +79,351 @@ namespace jb
         MruItems mru_items_;
         static constexpr auto CacheSize = Policies::PhysicalVolumePolicy::BTreeCacheSize;
 
+        static constexpr auto DirtyLimit = Policies::PhysicalVolumePolicy::BTreeDirtyLimit;
+        static constexpr auto FlushPeriod = std::chrono::milliseconds( Policies::PhysicalVolumePolicy::BTreeFlushPeriod );
+        static constexpr auto PreservedChunkNumber = Policies::PhysicalVolumePolicy::PreservedChunkNumber;
+        static constexpr auto ReclaimBatch = Policies::PhysicalVolumePolicy::BTreeReclaimBatch;
+        static_assert( ReclaimBatch > 0, "Reclaim batch must not be empty" );
+        static constexpr auto CollapseBatch = Policies::PhysicalVolumePolicy::BTreeCollapseBatch;
+        static_assert( CollapseBatch > 0, "Collapse batch must not be empty" );
+        static constexpr auto ReapBatch = Policies::PhysicalVolumePolicy::ExpirationReapBatch;
+        static_assert( ReapBatch > 0, "Reap batch must not be empty" );
+
+        // maximum number of pending read-ahead requests, the excessive ones are dropped
+        static constexpr size_t PrefetchLimit = 64;
+
+        // nodes a batch may pin before it's written partially, the rest of the cache serves other threads
+        static constexpr size_t BatchPinLimit = CacheSize / 4 > 0 ? CacheSize / 4 : 1;
+
+        std::mutex dirty_mutex_;
+        std::unordered_map< const BTree*, BTreeP > dirty_;
+
+
+
+    public:
+
+        /** Nodes modified by batch operation, nodes written during the batch, and images of write-back
+        dirty nodes taken before the batch modified them
+
+        A batch belongs to the thread running it, so concurrent batches over different b-trees do
+        not interfere
+        */
+        struct Batch
+        {
+            struct Image
+            {
+                BTreeP node_;
+                NodeUid uid_;
+                std::string data_;
+            };
+
+            std::unordered_map< const BTree*, BTreeP > dirty_;
+            std::vector< NodeUid > written_;
+            std::unordered_map< const BTree*, Image > images_;
+
+            bool flushing_ = false;     // the nodes are being written, save() writes through
+            bool relinked_ = false;     // partial writing has updated links of the root
+
+            const BTreeCache * cache_ = nullptr;
+            const BTree * root_ = nullptr;
+            Batch * outer_ = nullptr;
+        };
+
+
+    private:
+
+        std::mutex maintenance_mutex_;
+        std::condition_variable maintenance_cv_;
+        bool flush_requested_ = false;
+        bool reclaim_requested_ = true;     // the file may keep detached b-trees since previous run
+        bool reap_requested_ = false;
+        bool stop_maintenance_ = false;
+        std::once_flag maintenance_once_;
+        std::thread maintenance_;
+
+        // read-ahead requests, guarded by maintenance mutex
+        std::vector< std::function< void() > > prefetches_;
+
+        // digests of tombstones to be collapsed by b-tree roots, guarded by maintenance mutex
+        std::unordered_map< NodeUid, std::vector< Digest > > tombstones_;
+
+        // b-tree writers hold it shared from search to modification, collapsing holds it exclusively
+        boost::upgrade_mutex structure_mutex_;
+
+        // takes key lock over b-tree for reaping on behalf of the volume, guarded by maintenance mutex
+        std::function< boost::unique_lock< boost::upgrade_mutex >( const BTreeP & ) > reap_lock_;
+
+
+        /* Throws std::logic_error if a condition failed and immediately dies on noexcept guard
+
+        @param [in] condition - condition to be checked
+        @param [in] what - text message to be assigned to an error
+        @throw nothing
+        */
+        static auto throw_logic_error( bool condition, const char * what = "" ) noexcept
+        {
+            if ( !condition ) throw std::logic_error( what );
+        }
+
+
+        /* Wakes up background flusher
+
+        @throw nothing
+        */
+        void request_flush() noexcept
+        {
+            {
+                std::lock_guard< std::mutex > lock( maintenance_mutex_ );
+                flush_requested_ = true;
+            }
+            maintenance_cv_.notify_one();
+        }
+
+
+        /* Starts background maintenance thread if it's not started yet
+
+        @throw std::system_error
+        */
+        void start_maintenance()
+        {
+            std::call_once( maintenance_once_, [this] { maintenance_ = std::thread( [this] { maintenance(); } ); } );
+        }
+
+
+        /* Provides the innermost batch of calling thread
+
+        @retval Batch *& - the batch or nullptr
+        @throw nothing
+        */
+        static Batch *& thread_batch() noexcept
+        {
+            static thread_local Batch * batch = nullptr;
+            return batch;
+        }
+
+
+        /* Provides the batch of calling thread running over this cache
+
+        @retval Batch* - the batch or nullptr
+        @throw nothing
+        */
+        Batch * own_batch() const noexcept
+        {
+            auto batch = thread_batch();
+            return batch && batch->cache_ == this ? batch : nullptr;
+        }
+
+
+        /* Collapses a portion of tombstones of one b-tree
+
+        Elements are moved under exclusive key lock over the b-tree, the same lock volume readers and
+        writers take navigating to the b-tree, so nobody keeps a position in it. The lock is only
+        tried: the maintenance thread must not wait for a thread which may wait for it
+
+        @retval bool - false if the b-tree is busy and the tombstones are to be retried next period
+        @throw btree_error, btree_cache_error, storage_file_error
+        */
+        bool collapse_tombstones()
+        {
+            using namespace std;
+
+            NodeUid root = InvalidNodeUid;
+            vector< Digest > digests;
+
+            {
+                lock_guard< mutex > lock( maintenance_mutex_ );
+
+                if ( tombstones_.empty() ) return true;
+
+                auto root_it = begin( tombstones_ );
+                auto & pending = root_it->second;
+                root = root_it->first;
+
+                const auto first = pending.size() > CollapseBatch ? end( pending ) - CollapseBatch : begin( pending );
+                digests.assign( first, end( pending ) );
+                pending.erase( first, end( pending ) );
+
+                if ( pending.empty() ) tombstones_.erase( root_it );
+            }
+
+            auto restore = [&] {
+                lock_guard< mutex > lock( maintenance_mutex_ );
+
+                auto & pending = tombstones_[ root ];
+                pending.insert( end( pending ), begin( digests ), end( digests ) );
+            };
+
+            try
+            {
+                auto node = get_node( root );
+
+                // key lock first, then structure lock, as writers take them
+                boost::unique_lock< boost::upgrade_mutex > key{ node->guard(), boost::try_to_lock };
+                if ( !key )
+                {
+                    restore();
+                    return false;
+                }
+
+                boost::unique_lock< boost::upgrade_mutex > structure{ structure_mutex_ };
+
+                node->collapse_tombstones( digests );
+            }
+            catch ( ... )
+            {
+                restore();
+                throw;
+            }
+
+            return true;
+        }
+
+
+        /* Erases a portion of expired subkeys
+
+        Subkeys are erased under the key lock provided by the volume, reaping is off till the volume
+        provides it
+
+        @retval bool - true if there may be more expired subkeys
+        @retval bool - true if some b-trees are busy and have been skipped
+        @throw btree_error, btree_cache_error, storage_file_error
+        */
+        std::tuple< bool, bool > reap_expired()
+        {
+            using namespace std;
+            using namespace std::chrono;
+
+            function< boost::unique_lock< boost::upgrade_mutex >( const BTreeP & ) > reap_lock;
+            {
+                lock_guard< mutex > lock( maintenance_mutex_ );
+                reap_lock = reap_lock_;
+            }
+
+            if ( !reap_lock ) return { false, false };
+
+            const uint64_t now = system_clock::now().time_since_epoch() / milliseconds( 1 );
+
+            return BTree::reap_expired( file_, *this, now, ReapBatch, [&] ( const BTreeP & root ) {
+                auto key = reap_lock( root );
+
+                // key lock first, then structure lock, as writers take them
+                boost::unique_lock< boost::upgrade_mutex > structure;
+                if ( key ) structure = boost::unique_lock< boost::upgrade_mutex >{ structure_mutex_ };
+
+                return make_pair( std::move( key ), std::move( structure ) );
+            } );
+        }
+
+
+        /* Background maintenance routine
+
+        Reads ahead requested nodes, flushes dirty nodes periodically or on request, reclaims detached
+        b-trees, collapses tombstones batch by batch till nothing left, till the cache stops. Expired
+        subkeys are reaped on each period or on request only, so read-ahead wakes do not scan the
+        expiration index
+
+        @throw nothing
+        */
+        void maintenance() noexcept
+        {
+            std::unique_lock< std::mutex > lock( maintenance_mutex_ );
+
+            bool reclaim_failed = false;
+            bool collapse_failed = false;
+
+            while ( !stop_maintenance_ )
+            {
+                const bool woken = maintenance_cv_.wait_for( lock, FlushPeriod, [&] { return stop_maintenance_ || flush_requested_ || reclaim_requested_ || reap_requested_ || !prefetches_.empty() || ( !collapse_failed && !tombstones_.empty() ); } );
+
+                const bool reap = reap_requested_ || !woken;
+                flush_requested_ = reap_requested_ = false;
+
+                auto prefetches = std::move( prefetches_ );
+                prefetches_.clear();
+
+                // failed reclamation is repeated on the next period
+                const bool reclaim = reclaim_requested_ || reclaim_failed;
+                reclaim_requested_ = reclaim_failed = collapse_failed = false;
+
+                lock.unlock();
+
+                for ( auto & read : prefetches )
+                {
+                    try
+                    {
+                        read();
+                    }
+                    catch ( ... )
+                    {
+                        // read-ahead is an optimization only
+                    }
+                }
+
+                prefetches.clear();
+
+                try
+                {
+                    if ( DirtyLimit ) flush();
+                }
+                catch ( ... )
+                {
+                    // the nodes stay dirty, try next time
+                }
+
+                bool reclaim_more = false;
+
+                try
+                {
+                    if ( reclaim )
+                    {
+                        auto[ more, deferred ] = BTree::reclaim_detached( file_, *this, ReclaimBatch );
+
+                        // nodes still in use are retried on the next period instead of spinning
+                        reclaim_more = more && !deferred;
+                        reclaim_failed = deferred;
+                    }
+                }
+                catch ( ... )
+                {
+                    // the b-trees stay detached, try next time
+                    reclaim_failed = true;
+                }
+
+                try
+                {
+                    collapse_failed = !collapse_tombstones();
+                }
+                catch ( ... )
+                {
+                    // the tombstones stay in place, try next period
+                    collapse_failed = true;
+                }
+
+                bool reap_more = false;
+
+                try
+                {
+                    if ( BTree::ExpirationIndex && reap )
+                    {
+                        auto[ more, deferred ] = reap_expired();
+
+                        // busy b-trees are retried on the next period instead of spinning
+                        reap_more = more && !deferred;
+                    }
+                }
+                catch ( ... )
+                {
+                    // the entries stay in the index, try next period
+                }
+
+                lock.lock();
+
+                // continue at once, other writers get the file between the batches
+                reclaim_requested_ = reclaim_requested_ || reclaim_more;
+                reap_requested_ = reap_requested_ || reap_more;
+            }
+        }
+
 
     public:
 
@@ -80,6 +458,11 @@ namespace jb
             , mru_order_( CacheSize, InvalidNodeUid )
             , mru_items_( CacheSize )
         {
+            // the file may keep detached b-trees since previous run
+            if ( DirtyLimit || BTree::BTreeLazyErase || BTree::ExpirationIndex || file_.detached_btrees() )
+            {
+                start_maintenance();
+            }
         }
         catch ( const std::bad_alloc & )
         {
@@ -91,6 +474,35 @@ namespace jb
         }
 
 
+        /** Destructor
+
+        Stops background maintenance and writes remaining dirty nodes, detached b-trees are left
+        for the next run
+
+        @throw nothing
+        */
+        ~BTreeCache()
+        {
+            if ( maintenance_.joinable() )
+            {
+                {
+                    std::lock_guard< std::mutex > lock( maintenance_mutex_ );
+                    stop_maintenance_ = true;
+                }
+                maintenance_cv_.notify_one();
+                maintenance_.join();
+
+                try
+                {
+                    if ( DirtyLimit ) flush();
+                }
+                catch ( ... )
+                {
+                }
+            }
+        }
+
+
         /** Provides object status
 
         @retval RetCode - creation status
@@ -157,6 +569,9 @@ namespace jb
                             // get exclusive lock over the cache
                             exclusive_lock e{ s };
 
+                            // a reader could take the item by find_node() till the lock is exclusive
+                            if ( item_it->second.first.use_count() != 1 ) continue;
+
                             // drop useless item from cache
                             mru_items_.erase( item_it );
 
@@ -169,6 +584,9 @@ namespace jb
                         }
                     }
 
+                    // dirty nodes are pinned, writing them back releases the cache
+                    if ( DirtyLimit ) request_flush();
+
                     // if cache is full - get timeout: lose time slice and make scheduler to move the thread to the end of queue
                     if ( mru_cv_.timed_wait( s, boost::posix_time::microseconds( 1 ) ) )
                     {
@@ -180,6 +598,14 @@ namespace jb
                         // if timeout
                         try_count++;
                     }
+
+                    // the lock has been released while waiting, so the node could be cached by another thread
+                    if ( auto item_it = mru_items_.find( uid ); item_it != end( mru_items_ ) )
+                    {
+                        exclusive_lock e{ s };
+                        mru_order_.splice( end( mru_order_ ), mru_order_, item_it->second.second );
+                        return item_it->second.first;
+                    }
                 }
 
                 // notify originating thread that cache overloaded
@@ -188,6 +614,151 @@ namespace jb
         }
 
 
+        /** Provides B-tree node if it's already cached
+
+        Unlike get_node() never loads the node and does not touch MRU order, so concurrent readers
+        share the cache lock only
+
+        @param [in] uid - node UID
+        @retval BTreeP - cached node or nullptr
+        @throw nothing
+        */
+        BTreeP find_node( NodeUid uid ) noexcept
+        {
+            boost::shared_lock< boost::upgrade_mutex > s{ mru_mutex_ };
+
+            if ( auto item_it = mru_items_.find( uid ); item_it != mru_items_.end() )
+            {
+                return item_it->second.first;
+            }
+
+            return nullptr;
+        }
+
+
+        /** Let's know if cached node is held by someone besides the cache
+
+        Reference of write-back dirty node kept by the cache is not counted
+
+        @param [in] uid - node UID
+        @retval bool - true if the node is in use
+        @throw nothing
+        */
+        bool in_use( NodeUid uid ) noexcept
+        {
+            boost::shared_lock< boost::upgrade_mutex > s{ mru_mutex_ };
+
+            auto item_it = mru_items_.find( uid );
+            if ( item_it == mru_items_.end() ) return false;
+
+            const auto & node = item_it->second.first;
+            return node.use_count() > ( is_dirty( node.get() ) ? 2 : 1 );
+        }
+
+
+        /** Wakes up background reclamation of detached b-trees
+
+        @throw nothing
+        */
+        void request_reclaim() noexcept
+        {
+            try
+            {
+                start_maintenance();
+            }
+            catch ( ... )
+            {
+                // the b-trees stay detached till the next run
+                return;
+            }
+
+            {
+                std::lock_guard< std::mutex > lock( maintenance_mutex_ );
+                reclaim_requested_ = true;
+            }
+            maintenance_cv_.notify_one();
+        }
+
+
+        /** Enables background reaping of expired subkeys
+
+        The volume provides the way to lock a b-tree, so expired subkeys are erased under the same key
+        lock and mount checks as explicit erasing does
+
+        @param [in] lock - callable as lock( const BTreeP & root ), returns exclusive key lock over
+                           the b-tree or not owning lock if the b-tree may not be modified now
+        @throw std::bad_alloc
+        */
+        void set_reap_lock( std::function< boost::unique_lock< boost::upgrade_mutex >( const BTreeP & ) > lock )
+        {
+            std::lock_guard< std::mutex > guard( maintenance_mutex_ );
+            reap_lock_ = std::move( lock );
+        }
+
+
+        /** Queues reading ahead of a node by background maintenance
+
+        Requests over the limit are dropped, read-ahead is an optimization only
+
+        @param [in] read - reads the node into the cache, checks itself if the node is still needed
+        @throw nothing
+        */
+        void request_prefetch( std::function< void() > && read ) noexcept
+        {
+            try
+            {
+                start_maintenance();
+
+                std::lock_guard< std::mutex > lock( maintenance_mutex_ );
+
+                if ( prefetches_.size() >= PrefetchLimit ) return;
+                prefetches_.push_back( std::move( read ) );
+            }
+            catch ( ... )
+            {
+                return;
+            }
+
+            maintenance_cv_.notify_one();
+        }
+
+
+        /** Registers tombstone to be collapsed by background maintenance
+
+        A tombstone already waiting for collapsing is not registered twice
+
+        @param [in] root - uid of root node of b-tree containing the tombstone
+        @param [in] digest - digest of the tombstone
+        @throw std::bad_alloc
+        */
+        void note_tombstone( NodeUid root, Digest digest )
+        {
+            {
+                std::lock_guard< std::mutex > lock( maintenance_mutex_ );
+
+                auto & pending = tombstones_[ root ];
+                if ( std::find( pending.begin(), pending.end(), digest ) != pending.end() ) return;
+
+                pending.push_back( digest );
+            }
+            maintenance_cv_.notify_one();
+        }
+
+
+        /** Provides structure lock for b-tree writer
+
+        In lazy erasing mode or with expiration index background maintenance moves elements between
+        nodes, so a writer must hold the lock from search to modification to keep found position valid
+
+        @retval boost::shared_lock - the lock
+        @throw boost::lock_error
+        */
+        auto lock_structure()
+        {
+            return boost::shared_lock< boost::upgrade_mutex >{ structure_mutex_ };
+        }
+
+
         /** Update item uid and mark the item as MRU
 
         @param [in] old_uid - obsolete uid
@@ -216,15 +787,34 @@ namespace jb
         }
 
 
+        /** Drops released node from the cache
+
+        The node chain is released by the running transaction and the node content is moved to the
+        nodes written by the same transaction, so its deferred modification is not needed anymore
+
+        @param [in] uid - uid of released node
+        @throw nothing
+        */
         auto drop( NodeUid uid ) noexcept
         {
             using namespace std;
 
+            // released b-tree root takes its tombstones away
+            if ( BTree::BTreeLazyErase )
+            {
+                lock_guard< mutex > lock( maintenance_mutex_ );
+                tombstones_.erase( uid );
+            }
+
             shared_lock s{ mru_mutex_ };
 
             if ( auto item_it = mru_items_.find( uid ); item_it != end( mru_items_ ) )
             {
-                exclusive_lock{ s };
+                exclusive_lock e{ s };
+
+                // the node is not stored anymore, so forget its modification
+                mark_clean( item_it->second.first.get() );
+                if ( auto batch = own_batch() ) batch->dirty_.erase( item_it->second.first.get() );
 
                 // remove item from cache and free order slot
                 auto order_it = item_it->second.second;
@@ -236,6 +826,312 @@ namespace jb
                 mru_cv_.notify_one();
             }
         }
+
+
+        /** Evicts node which cached state may differ from the file
+
+        Unlike drop() the node is still stored, so write-back dirty node is kept: its deferred
+        modification is acknowledged and must reach the file
+
+        @param [in] uid - node uid
+        @retval bool - false if the node is write-back dirty and has not been evicted
+        @throw nothing
+        */
+        bool evict( NodeUid uid ) noexcept
+        {
+            using namespace std;
+
+            shared_lock s{ mru_mutex_ };
+
+            if ( auto item_it = mru_items_.find( uid ); item_it != end( mru_items_ ) )
+            {
+                if ( is_dirty( item_it->second.first.get() ) ) return false;
+
+                exclusive_lock e{ s };
+
+                auto order_it = item_it->second.second;
+                mru_items_.erase( item_it );
+                *order_it = InvalidNodeUid;
+                mru_order_.splice( begin( mru_order_ ), mru_order_, order_it );
+
+                mru_cv_.notify_one();
+            }
+
+            return true;
+        }
+
+
+        /** Starts batch operation of calling thread
+
+        Since that moment cached nodes modified by the thread are not written by save()/overwrite()
+        but collected, so each node is written once at the end of the batch
+
+        @param [in/out] batch - batch to collect the nodes, must outlive the batch operation
+        @throw nothing
+        @note the caller must hold a transaction
+        */
+        void begin_batch( Batch & batch ) noexcept
+        {
+            batch.cache_ = this;
+            batch.outer_ = thread_batch();
+            thread_batch() = &batch;
+        }
+
+
+        /** Finishes batch operation of calling thread
+
+        @param [in] batch - batch started by begin_batch()
+        @throw nothing
+        */
+        void end_batch( Batch & batch ) noexcept
+        {
+            throw_logic_error( thread_batch() == &batch, "Batch is not started" );
+
+            thread_batch() = batch.outer_;
+            batch.outer_ = nullptr;
+        }
+
+
+        /** Let's know if calling thread runs a batch over given b-tree
+
+        @param [in] root - root of the b-tree
+        @retval bool - true if the innermost batch of the thread is over the b-tree
+        @throw nothing
+        */
+        bool batch_running( const BTree * root ) const noexcept
+        {
+            auto batch = own_batch();
+            return batch && batch->root_ == root;
+        }
+
+
+        /** Provides batch of calling thread if it pins too many nodes
+
+        @retval Batch* - the batch to be written partially or nullptr
+        @throw nothing
+        */
+        Batch * overflown_batch() const noexcept
+        {
+            auto batch = own_batch();
+            return batch && batch->dirty_.size() >= BatchPinLimit ? batch : nullptr;
+        }
+
+
+        /** Postpones writing of a node till the end of current batch
+
+        @param [in] node - node to be written
+        @retval bool - true if the writing is postponed, false if there is no batch, the batch is being
+                       written or the node is not cached
+        @throw std::bad_alloc
+        */
+        bool defer_batch_write( const BTree * node )
+        {
+            using namespace std;
+
+            auto batch = own_batch();
+            if ( !batch || batch->flushing_ ) return false;
+
+            shared_lock s{ mru_mutex_ };
+
+            auto item_it = mru_items_.find( node->uid_ );
+            if ( item_it == end( mru_items_ ) || item_it->second.first.get() != node ) return false;
+
+            batch->dirty_.emplace( node, item_it->second.first );
+
+            return true;
+        }
+
+
+        /** Remembers node written during current batch
+
+        Let us forget the nodes if the batch fails
+
+        @param [in] uid - uid of written node
+        @throw std::bad_alloc
+        */
+        void note_batch_write( NodeUid uid )
+        {
+            if ( auto batch = own_batch() ) batch->written_.push_back( uid );
+        }
+
+
+        /** Takes image of write-back dirty node before current batch modifies it
+
+        Let us restore the node with its deferred modification if the batch fails
+
+        @param [in] node - node to be modified, the caller holds exclusive latch over it
+        @throw std::bad_alloc, btree_error
+        */
+        void preserve( const BTree & node )
+        {
+            using namespace std;
+
+            if ( !DirtyLimit ) return;
+
+            auto batch = own_batch();
+            if ( !batch || batch->images_.count( &node ) || !is_dirty( &node ) ) return;
+
+            // dirty node is pinned in the cache
+            BTreeP p;
+            {
+                shared_lock s{ mru_mutex_ };
+
+                auto item_it = mru_items_.find( node.uid_ );
+                throw_logic_error( item_it != end( mru_items_ ) && item_it->second.first.get() == &node, "Dirty node is not cached" );
+
+                p = item_it->second.first;
+            }
+
+            ostringstream os;
+            os << node;
+
+            batch->images_.emplace( &node, typename Batch::Image{ move( p ), node.uid_, os.str() } );
+        }
+
+
+        /** Registers in-memory modification of cached node to be written later
+
+        The caller must hold exclusive latch over the node while modifying the node
+
+        @param [in] uid - node uid
+        @retval bool - false if the modification cannot be deferred and must be written through:
+                       write-back is disabled, the node is not cached or dirty limit is reached
+        @throw std::bad_alloc
+        */
+        bool defer_write( NodeUid uid )
+        {
+            using namespace std;
+
+            if ( !DirtyLimit ) return false;
+
+            shared_lock s{ mru_mutex_ };
+
+            auto item_it = mru_items_.find( uid );
+            if ( item_it == end( mru_items_ ) ) return false;
+
+            const auto & node = item_it->second.first;
+
+            lock_guard< mutex > lock( dirty_mutex_ );
+
+            if ( dirty_.count( node.get() ) ) return true;
+
+            if ( dirty_.size() >= DirtyLimit )
+            {
+                request_flush();
+                return false;
+            }
+
+            dirty_.emplace( node.get(), node );
+            return true;
+        }
+
+
+        /** Let's know if a node keeps deferred modification
+
+        @param [in] node - node
+        @retval bool - true if the node is write-back dirty
+        @throw nothing
+        */
+        bool is_dirty( const BTree * node ) noexcept
+        {
+            if ( !DirtyLimit ) return false;
+
+            std::lock_guard< std::mutex > lock( dirty_mutex_ );
+            return dirty_.count( node ) > 0;
+        }
+
+
+        /** Marks node as keeping deferred modification again, used to restore the node after failed batch
+
+        @param [in] node - node
+        @throw std::bad_alloc
+        */
+        void mark_dirty( const BTreeP & node )
+        {
+            if ( !DirtyLimit ) return;
+
+            std::lock_guard< std::mutex > lock( dirty_mutex_ );
+            dirty_.emplace( node.get(), node );
+        }
+
+
+        /** Forgets in-memory modification of a node, called when the node is written to the file
+
+        @param [in] node - node
+        @throw nothing
+        */
+        void mark_clean( const BTree * node ) noexcept
+        {
+            if ( !DirtyLimit ) return;
+
+            std::lock_guard< std::mutex > lock( dirty_mutex_ );
+            dirty_.erase( node );
+        }
+
+
+        /** Writes dirty nodes to the file
+
+        The nodes are overwritten in place, as many nodes per transaction as the file allows. A node
+        that is being modified right now is skipped and stays dirty
+
+        @throw storage_file_error, btree_error
+        */
+        void flush()
+        {
+            using namespace std;
+
+            // nodes dirty at the moment, later modifications go to the next flush
+            vector< BTreeP > dirty;
+            {
+                lock_guard< mutex > lock( dirty_mutex_ );
+
+                dirty.reserve( dirty_.size() );
+                for ( const auto & item : dirty_ ) dirty.push_back( item.second );
+            }
+
+            for ( auto batch_begin = begin( dirty ); batch_begin != end( dirty ); )
+            {
+                auto batch_end = batch_begin + min< ptrdiff_t >( PreservedChunkNumber, distance( batch_begin, end( dirty ) ) );
+
+                vector< BTreeP > written;
+                written.reserve( PreservedChunkNumber );
+
+                try
+                {
+                    auto t = file_.open_transaction();
+
+                    for ( auto it = batch_begin; it != batch_end; ++it )
+                    {
+                        const BTreeP & node = *it;
+
+                        // do not wait for busy node, otherwise deadlock with a writer holding the node and waiting for the file
+                        boost::shared_lock< boost::upgrade_mutex > node_lock( node->latch_, boost::try_to_lock );
+                        if ( !node_lock.owns_lock() ) continue;
+
+                        // the node could be written by regular operation since we took the snapshot
+                        {
+                            lock_guard< mutex > lock( dirty_mutex_ );
+                            if ( !dirty_.count( node.get() ) ) continue;
+                        }
+
+                        node->overwrite( t );
+                        written.push_back( node );
+                    }
+
+                    if ( written.size() ) t.commit();
+                }
+                catch ( ... )
+                {
+                    // restore dirty state of unsaved nodes
+                    lock_guard< mutex > lock( dirty_mutex_ );
+                    for ( auto & node : written ) dirty_.emplace( node.get(), node );
+
+                    throw;
+                }
+
+                batch_begin = batch_end;
+            }
+        }
     };
 }
 
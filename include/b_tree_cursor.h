@@ -0,0 +1,296 @@
+#ifndef __JB__B_TREE_CURSOR__H__
+#define __JB__B_TREE_CURSOR__H__
+
+
+#include <vector>
+#include <optional>
+#include <thread>
+#include <algorithm>
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/thread/locks.hpp>
+
+
+namespace jb
+{
+    /** Enumerates subkeys of a b-tree page by page
+
+    The subkeys are provided in digest order. Between pages the cursor remembers the last provided
+    digest only, it holds neither locks nor nodes, so concurrent modifications are not blocked. Each
+    page is started by new descent to the first digest after the remembered one. While a page is
+    being read the cursor holds shared lock over single node at a time; if a visited node changes,
+    the cursor descends again from the last provided digest. Subkeys inserted or erased during the
+    enumeration may be either provided or not, the rest are provided exactly once
+
+    After a page is completed, the next leaf is read ahead by background maintenance of the cache,
+    so the following page finds it in the cache
+
+    @tparam Policies - global settings
+    */
+    template < typename Policies >
+    class Storage< Policies >::PhysicalVolumeImpl::BTree::Cursor
+    {
+        using shared_lock = boost::shared_lock< boost::upgrade_mutex >;
+
+        //
+        // visited node: subtree at links_[ pos_ ] is being visited, then elements_[ pos_ ] goes
+        //
+        struct Frame
+        {
+            BTreeP node_;
+            uint64_t version_;
+            Pos pos_;
+        };
+
+        //
+        // data members
+        //
+        BTreeP root_;
+        size_t page_size_;
+        std::optional< Digest > last_;
+        bool done_ = false;
+        std::vector< Frame > stack_;
+
+
+        /* Checks if a node has changed since it was visited
+
+        @param [in] frame - visiting record
+        @retval bool - true if the node must be visited again
+        @throw nothing
+        */
+        static bool changed( const Frame & frame ) noexcept
+        {
+            const auto & node = *frame.node_;
+            return node.version_.load( std::memory_order_acquire ) != frame.version_;
+        }
+
+
+        /* Descends from a node to the leftmost leaf of its subtree
+
+        @param [in] node - subtree root
+        @retval bool - false if a visited node has changed
+        @throw btree_error, btree_cache_error, storage_file_error
+        */
+        bool descend( BTreeP node )
+        {
+            for ( ;; )
+            {
+                shared_lock lock{ node->latch_ };
+
+                Frame frame{ node, node->version_.load( std::memory_order_acquire ), 0 };
+                if ( changed( frame ) ) return false;
+
+                stack_.push_back( frame );
+
+                const auto link = node->links_[ 0 ];
+                if ( InvalidNodeUid == link ) return true;
+
+                auto child = node->cache_.get_node( link );
+
+                lock.unlock();
+                node = std::move( child );
+            }
+        }
+
+
+        /* Descends from the root to the first digest after the last provided one
+
+        @retval bool - false if a visited node has changed
+        @throw btree_error, btree_cache_error, storage_file_error
+        */
+        bool seek()
+        {
+            using namespace std;
+
+            stack_.clear();
+
+            BTreeP node = root_;
+
+            for ( ;; )
+            {
+                shared_lock lock{ node->latch_ };
+
+                const auto & digests = node->digests_;
+                const Pos pos = last_ ? static_cast< Pos >( upper_bound( begin( digests ), end( digests ), *last_ ) - begin( digests ) ) : 0;
+
+                Frame frame{ node, node->version_.load( memory_order_acquire ), pos };
+                if ( changed( frame ) ) return false;
+
+                stack_.push_back( frame );
+
+                const auto link = node->links_[ pos ];
+                if ( InvalidNodeUid == link ) return true;
+
+                auto child = node->cache_.get_node( link );
+
+                lock.unlock();
+                node = move( child );
+            }
+        }
+
+
+        /* Provides next subkey or moves up to the parent
+
+        @param [in/out] page - page to be filled
+        @retval bool - false if visited node has changed
+        @throw std::bad_alloc, btree_error, btree_cache_error, storage_file_error
+        */
+        bool step( std::vector< Key > & page )
+        {
+            auto & frame = stack_.back();
+            const auto & node = *frame.node_;
+
+            BTreeP child;
+
+            {
+                shared_lock lock{ node.latch_ };
+
+                if ( changed( frame ) ) return false;
+
+                // the node is completed
+                if ( frame.pos_ >= node.elements_.size() )
+                {
+                    stack_.pop_back();
+                    return true;
+                }
+
+                const auto & e = node.elements_[ frame.pos_++ ];
+
+                if ( !last_ || *last_ < e.digest_ )
+                {
+                    // erased subkey awaiting for collapsing
+                    if ( BTree::Tombstone != e.good_before_ ) page.push_back( e.name_ );
+                    last_ = e.digest_;
+                }
+
+                const auto link = node.links_[ frame.pos_ ];
+                if ( InvalidNodeUid == link ) return true;
+
+                child = node.cache_.get_node( link );
+            }
+
+            return descend( std::move( child ) );
+        }
+
+
+        /* Requests background reading of the leaf following the current one
+
+        The link is read by the maintenance thread under shared latch over the parent, so a link
+        changed meanwhile is not followed. Queued request holds parent's uid only: pending requests
+        must not pin cache slots, the parent evicted meanwhile is not read again
+
+        @throw nothing
+        */
+        void start_readahead() noexcept
+        {
+            if ( done_ || stack_.size() < 2 ) return;
+
+            const auto & parent = stack_[ stack_.size() - 2 ];
+
+            try
+            {
+                auto & cache = root_->cache_;
+
+                cache.request_prefetch( [ &cache, uid = parent.node_->uid_, version = parent.version_, pos = parent.pos_ ] {
+                    const auto node = cache.find_node( uid );
+                    if ( !node ) return;
+
+                    shared_lock lock{ node->latch_ };
+
+                    if ( node->version_.load( std::memory_order_acquire ) != version || pos + 1 >= node->links_.size() ) return;
+
+                    if ( const auto link = node->links_[ pos + 1 ]; InvalidNodeUid != link )
+                    {
+                        node->cache_.get_node( link );
+                    }
+                } );
+            }
+            catch ( ... )
+            {
+                // readahead is an optimization only
+            }
+        }
+
+
+    public:
+
+        /** The class is not default creatable/copyable...
+        */
+        Cursor() = delete;
+        Cursor( const Cursor & ) = delete;
+        Cursor & operator = ( const Cursor & ) = delete;
+
+
+        /** ...but movable
+        */
+        Cursor( Cursor && ) = default;
+
+
+        /** Explicit constructor
+
+        @param [in] root - root node of b-tree to be enumerated
+        @param [in] page_size - maximum number of subkeys per page
+        @throw nothing
+        */
+        explicit Cursor( BTreeP root, size_t page_size ) noexcept
+            : root_( std::move( root ) )
+            , page_size_( page_size )
+        {
+            throw_logic_error( root_ && page_size_, "Invalid cursor parameters" );
+        }
+
+
+        /** Let's know if all the subkeys have been provided
+
+        @retval bool - true if the enumeration is completed
+        @throw nothing
+        */
+        auto done() const noexcept { return done_; }
+
+
+        /** Provides next page of subkey names
+
+        @retval std::vector< Key > - names of subkeys, empty page means the end of enumeration
+        @throw std::bad_alloc, btree_error, btree_cache_error, storage_file_error
+        */
+        std::vector< Key > next_page()
+        {
+            using namespace std;
+
+            vector< Key > page;
+            if ( done_ ) return page;
+
+            page.reserve( page_size_ );
+
+            bool positioned = false;
+
+            while ( page.size() < page_size_ )
+            {
+                if ( !positioned && !( positioned = seek() ) )
+                {
+                    this_thread::yield();
+                    continue;
+                }
+
+                if ( stack_.empty() )
+                {
+                    done_ = true;
+                    break;
+                }
+
+                if ( !step( page ) )
+                {
+                    positioned = false;
+                    this_thread::yield();
+                }
+            }
+
+            // nothing is held between pages
+            start_readahead();
+            stack_.clear();
+
+            return page;
+        }
+    };
+}
+
+#endif
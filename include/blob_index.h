@@ -0,0 +1,452 @@
+#ifndef __JB__BLOB_INDEX__H__
+#define __JB__BLOB_INDEX__H__
+
+
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <tuple>
+
+#ifndef BOOST_ENDIAN_DEPRECATED_NAMES
+#define BOOST_ENDIAN_DEPRECATED_NAMES
+#include <boost/endian/endian.hpp>
+#undef BOOST_ENDIAN_DEPRECATED_NAMES
+#else
+#include <boost/endian/endian.hpp>
+#endif
+
+
+namespace jb
+{
+    /** Index of deduplicated BLOB chains
+
+    Maps content digests of stored BLOBs to chains and counts references to each chain, so equal
+    values share the same chain. A chain that is not registered in the index is owned by a single
+    value. The index is small enough to be kept in memory entirely, it's loaded once on opening of
+    the file
+
+    A transaction modifies the index in place and remembers its modifications, so the index can be
+    rolled back if the transaction fails. On commit only the modifications are persisted as another
+    journal chain referring to the previous one. When the journal outgrows the index, the index is
+    saved as a snapshot and the journal is released, thus each modification costs amortized O(1)
+    of i/o regardless of the index size
+
+    @tparam Policies - global settings
+    @note the index is modified under write lock of the file only
+    */
+    template < typename Policies >
+    class Storage< Policies >::PhysicalVolumeImpl::StorageFile::BlobIndex
+    {
+        using big_uint64_t = boost::endian::big_uint64_at;
+
+        //
+        // kinds of stored chains
+        //
+        static constexpr uint64_t SnapshotKind = 0;
+        static constexpr uint64_t JournalKind = 1;
+
+        //
+        // minimal number of journal records that causes saving of snapshot
+        //
+        static constexpr size_t CompactionThreshold = 1024;
+
+        enum class Op : uint64_t { Insert = 1, Acquire, Release };
+
+        struct entry_t
+        {
+            uint64_t digest_;
+            uint64_t refs_;
+        };
+
+        struct record_t
+        {
+            Op op_;
+            uint64_t digest_;
+            ChunkUid chain_;
+        };
+
+        std::unordered_map< ChunkUid, entry_t > chains_;
+        std::unordered_multimap< uint64_t, ChunkUid > digests_;
+        std::vector< record_t > pending_;
+        std::vector< ChunkUid > stored_;
+        size_t journaled_ = 0;
+
+
+        /* Removes chain from digest map
+
+        @param [in] digest - content digest
+        @param [in] chain - uid of the chain
+        @throw nothing
+        */
+        void erase_digest( uint64_t digest, ChunkUid chain ) noexcept
+        {
+            auto[ begin, end ] = digests_.equal_range( digest );
+
+            for ( auto d = begin; d != end; ++d )
+            {
+                if ( d->second == chain )
+                {
+                    digests_.erase( d );
+                    break;
+                }
+            }
+        }
+
+
+        /* Applies stored record while loading
+
+        Unreferenced entries are removed immediately since there is nothing to roll back
+
+        @param [in] record - record to be applied
+        @retval bool - false if the record does not match the index
+        @throw std::bad_alloc
+        */
+        bool replay( const record_t & record )
+        {
+            auto it = chains_.find( record.chain_ );
+
+            switch ( record.op_ )
+            {
+            case Op::Insert:
+                if ( it != chains_.end() ) return false;
+                chains_.emplace( record.chain_, entry_t{ record.digest_, 1 } );
+                digests_.emplace( record.digest_, record.chain_ );
+                return true;
+
+            case Op::Acquire:
+                if ( it == chains_.end() ) return false;
+                ++it->second.refs_;
+                return true;
+
+            case Op::Release:
+                if ( it == chains_.end() ) return false;
+                if ( --it->second.refs_ ) return true;
+                erase_digest( it->second.digest_, it->first );
+                chains_.erase( it );
+                return true;
+
+            default:
+                return false;
+            }
+        }
+
+
+        /* Writes header of stored chain
+
+        @param [in/out] os - output stream
+        @param [in] previous - previous chain of the journal
+        @param [in] kind - kind of the chain
+        @param [in] count - number of records
+        @throw may throw what underlaying stream buffer does
+        */
+        static void save_header( std::ostream & os, ChunkUid previous, uint64_t kind, size_t count )
+        {
+            big_uint64_t header[] = { previous, kind, count };
+            os.write( reinterpret_cast< const char* >( header ), sizeof( header ) );
+        }
+
+
+    public:
+
+        /** Let's know if given chain is registered in the index
+
+        @param [in] chain - uid of the chain
+        @retval bool - true if the chain is shared through the index
+        @throw nothing
+        */
+        auto contains( ChunkUid chain ) const noexcept
+        {
+            auto it = chains_.find( chain );
+            return it != chains_.end() && it->second.refs_;
+        }
+
+
+        /** Looks for a chain with given digest and equal content
+
+        @tparam F - predicate type, callable as bool f( ChunkUid )
+        @param [in] digest - content digest
+        @param [in] equal - checks content of candidate chain, protects from digest collisions
+        @retval ChunkUid - uid of found chain or InvalidChunkUid
+        @throw may throw what the predicate does
+        */
+        template < typename F >
+        ChunkUid find( uint64_t digest, F && equal ) const
+        {
+            auto[ begin, end ] = digests_.equal_range( digest );
+
+            for ( auto it = begin; it != end; ++it )
+            {
+                if ( contains( it->second ) && equal( it->second ) ) return it->second;
+            }
+
+            return InvalidChunkUid;
+        }
+
+
+        /** Registers new chain with single reference
+
+        @param [in] digest - content digest
+        @param [in] chain - uid of the chain
+        @throw std::bad_alloc
+        */
+        void insert( uint64_t digest, ChunkUid chain )
+        {
+            throw_logic_error( chains_.find( chain ) == chains_.end(), "Chain is already registered" );
+
+            pending_.push_back( record_t{ Op::Insert, digest, chain } );
+
+            try
+            {
+                chains_.emplace( chain, entry_t{ digest, 1 } );
+                digests_.emplace( digest, chain );
+            }
+            catch ( ... )
+            {
+                chains_.erase( chain );
+                pending_.pop_back();
+                throw;
+            }
+        }
+
+
+        /** Adds a reference to registered chain
+
+        @param [in] chain - uid of the chain
+        @throw std::bad_alloc
+        */
+        void acquire( ChunkUid chain )
+        {
+            auto it = chains_.find( chain );
+            throw_logic_error( it != chains_.end() && it->second.refs_, "Chain is not registered" );
+
+            pending_.push_back( record_t{ Op::Acquire, it->second.digest_, chain } );
+            ++it->second.refs_;
+        }
+
+
+        /** Drops a reference to registered chain
+
+        Unreferenced entry stays in memory till commit, so the rollback does not allocate
+
+        @param [in] chain - uid of the chain
+        @retval bool - true if the chain is not referenced anymore
+        @throw std::bad_alloc
+        */
+        bool release( ChunkUid chain )
+        {
+            auto it = chains_.find( chain );
+            throw_logic_error( it != chains_.end() && it->second.refs_, "Chain is not registered" );
+
+            pending_.push_back( record_t{ Op::Release, it->second.digest_, chain } );
+
+            return !--it->second.refs_;
+        }
+
+
+        /** Let's know if running transaction has modified the index
+
+        @retval bool - true if there are modifications to be persisted
+        @throw nothing
+        */
+        auto modified() const noexcept { return !pending_.empty(); }
+
+
+        /** Let's know if the index is to be saved as a snapshot instead of appending the journal
+
+        @retval bool - true if the journal outgrows the index
+        @throw nothing
+        */
+        auto compaction_due() const noexcept
+        {
+            return journaled_ + pending_.size() >= std::max( CompactionThreshold, chains_.size() );
+        }
+
+
+        /** Provides stored chains of the index, the last one is the newest
+
+        @retval const std::vector< ChunkUid > & - chains
+        @throw nothing
+        */
+        const auto & stored() const noexcept { return stored_; }
+
+
+        /** Writes whole index as a snapshot
+
+        @param [in/out] os - output stream
+        @retval bool - false if the index is empty and nothing has been written
+        @throw may throw what underlaying stream buffer does
+        */
+        bool save_snapshot( std::ostream & os ) const
+        {
+            const auto live = std::count_if( chains_.begin(), chains_.end(), [] ( const auto & c ) { return c.second.refs_ > 0; } );
+            if ( !live ) return false;
+
+            save_header( os, InvalidChunkUid, SnapshotKind, static_cast< size_t >( live ) );
+
+            for ( const auto &[ chain, entry ] : chains_ )
+            {
+                if ( !entry.refs_ ) continue;
+
+                big_uint64_t record[] = { entry.digest_, chain, entry.refs_ };
+                os.write( reinterpret_cast< const char* >( record ), sizeof( record ) );
+            }
+
+            return true;
+        }
+
+
+        /** Writes modifications of running transaction as a journal chain
+
+        @param [in/out] os - output stream
+        @throw may throw what underlaying stream buffer does
+        */
+        void save_journal( std::ostream & os ) const
+        {
+            save_header( os, stored_.empty() ? InvalidChunkUid : stored_.back(), JournalKind, pending_.size() );
+
+            for ( const auto & r : pending_ )
+            {
+                big_uint64_t record[] = { static_cast< uint64_t >( r.op_ ), r.digest_, r.chain_ };
+                os.write( reinterpret_cast< const char* >( record ), sizeof( record ) );
+            }
+        }
+
+
+        /** Reserves memory for commit(), so the commit cannot fail
+
+        @throw std::bad_alloc
+        */
+        void prepare_commit()
+        {
+            stored_.reserve( stored_.size() + 1 );
+        }
+
+
+        /** Accepts modifications of committed transaction
+
+        @param [in] chain - just written chain or InvalidChunkUid if the index is empty
+        @param [in] snapshot - the chain is a snapshot, previous chains have been released
+        @throw nothing
+        */
+        void commit( ChunkUid chain, bool snapshot ) noexcept
+        {
+            for ( const auto & r : pending_ )
+            {
+                if ( Op::Release != r.op_ ) continue;
+
+                if ( auto it = chains_.find( r.chain_ ); it != chains_.end() && !it->second.refs_ )
+                {
+                    erase_digest( it->second.digest_, it->first );
+                    chains_.erase( it );
+                }
+            }
+
+            if ( snapshot )
+            {
+                stored_.clear();
+                journaled_ = 0;
+            }
+            else
+            {
+                journaled_ += pending_.size();
+            }
+
+            if ( InvalidChunkUid != chain ) stored_.push_back( chain );
+
+            pending_.clear();
+        }
+
+
+        /** Reverts modifications of failed transaction
+
+        @throw nothing
+        */
+        void rollback() noexcept
+        {
+            for ( auto r = pending_.rbegin(); r != pending_.rend(); ++r )
+            {
+                auto it = chains_.find( r->chain_ );
+                throw_logic_error( it != chains_.end(), "Broken BLOB index journal" );
+
+                switch ( r->op_ )
+                {
+                case Op::Insert:
+                    erase_digest( it->second.digest_, it->first );
+                    chains_.erase( it );
+                    break;
+
+                case Op::Acquire:
+                    --it->second.refs_;
+                    break;
+
+                case Op::Release:
+                    ++it->second.refs_;
+                    break;
+                }
+            }
+
+            pending_.clear();
+        }
+
+
+        /** Reads header of stored chain
+
+        @param [in/out] is - input stream
+        @retval bool - if the operation succeeded
+        @retval ChunkUid - previous chain of the journal
+        @retval bool - true if the chain is a snapshot
+        @throw nothing
+        */
+        static std::tuple< bool, ChunkUid, bool > load_header( std::istream & is )
+        {
+            big_uint64_t header[ 3 ];
+            if ( !is.read( reinterpret_cast< char* >( header ), sizeof( header ) ) ) return { false, InvalidChunkUid, false };
+
+            return { true, header[ 0 ], SnapshotKind == header[ 1 ] };
+        }
+
+
+        /** Loads another stored chain, chains must be loaded from the oldest one
+
+        @param [in/out] is - input stream
+        @param [in] chain - uid of the chain
+        @retval bool - if the operation succeeded
+        @throw std::bad_alloc
+        */
+        bool load( std::istream & is, ChunkUid chain )
+        {
+            big_uint64_t header[ 3 ];
+            if ( !is.read( reinterpret_cast< char* >( header ), sizeof( header ) ) ) return false;
+
+            const bool snapshot = SnapshotKind == header[ 1 ];
+            const uint64_t count = header[ 2 ];
+
+            // snapshot may be the oldest chain only
+            if ( snapshot && !stored_.empty() ) return false;
+
+            for ( uint64_t i = 0; i < count; ++i )
+            {
+                big_uint64_t record[ 3 ];
+                if ( !is.read( reinterpret_cast< char* >( record ), sizeof( record ) ) ) return false;
+
+                if ( snapshot )
+                {
+                    if ( !record[ 2 ] || !chains_.emplace( record[ 1 ], entry_t{ record[ 0 ], record[ 2 ] } ).second ) return false;
+                    digests_.emplace( record[ 0 ], record[ 1 ] );
+                }
+                else if ( !replay( record_t{ static_cast< Op >( static_cast< uint64_t >( record[ 0 ] ) ), record[ 1 ], record[ 2 ] } ) )
+                {
+                    return false;
+                }
+            }
+
+            if ( !snapshot ) journaled_ += static_cast< size_t >( count );
+            stored_.push_back( chain );
+
+            return true;
+        }
+    };
+}
+
+#endif
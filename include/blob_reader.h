@@ -0,0 +1,209 @@
+#ifndef __JB__BLOB_READER__H__
+#define __JB__BLOB_READER__H__
+
+
+#include <memory>
+#include <tuple>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <limits>
+
+
+namespace jb
+{
+    /** Streaming reader over stored BLOB value
+
+    Let us process multi-megabyte values piece by piece without materializing the whole value in
+    memory. The data is provided as raw bytes of stored representation (i.e. characters of string or
+    little-endian elements of numeric array) either by copying to a buffer or as a sequence of spans
+    pointing directly into i/o buffer of the chain reader. Reading at arbitrary offset skips chunks
+    preceding the position by their headers without transferring their data
+
+    @tparam Policies - global settings
+    @note the reader holds one of reading handles of the storage file till destruction
+    @note the caller is responsible to hold a lock over the key while the reader is in use, otherwise
+          the chain may be released by concurrent modification
+    */
+    template < typename Policies >
+    class Storage< Policies >::PhysicalVolumeImpl::BTree::BlobReader
+    {
+        //
+        // needs access to private constructor
+        //
+        friend struct PackedValue;
+
+        using istreambuf = typename StorageFile::template istreambuf< char >;
+        using prefix = blob_size_prefix< char >;
+
+        //
+        // data members
+        //
+        StorageFile & file_;
+        BlobUid chain_;
+        size_t element_size_;
+        uint64_t size_ = 0;
+        uint64_t position_ = 0;
+        std::unique_ptr< istreambuf > buffer_;
+
+
+        /* Explicit constructor
+
+        @param [in] file - storage file
+        @param [in] chain - uid of the BLOB chain
+        @param [in] element_size - size of value element in bytes
+        @throw btree_error, storage_file_error
+        */
+        explicit BlobReader( StorageFile & file, BlobUid chain, size_t element_size )
+            : file_( file )
+            , chain_( chain )
+            , element_size_( element_size )
+        {
+            open();
+
+            std::istream is( buffer_.get() );
+            auto[ ok, count ] = prefix::read( is );
+            throw_btree_error( ok, RetCode::InvalidData, "Unable to read BLOB" );
+            throw_btree_error( count <= std::numeric_limits< uint64_t >::max() / element_size_, RetCode::InvalidData, "Broken BLOB length" );
+
+            size_ = count * element_size_;
+        }
+
+
+        /* (Re)opens the chain
+
+        @throw storage_file_error
+        */
+        void open()
+        {
+            // release reading handle before acquiring another one, otherwise we can wait forever
+            buffer_.reset();
+            buffer_.reset( new istreambuf( file_.get_chain_reader< char >( chain_ ) ) );
+            position_ = 0;
+        }
+
+
+        /* Moves current position to given offset
+
+        Chain is a singly linked list of chunks, so backward movement reopens the chain
+
+        @param [in] offset - desired position
+        @throw btree_error, storage_file_error
+        */
+        void seek( uint64_t offset )
+        {
+            if ( offset < position_ )
+            {
+                open();
+                throw_btree_error( buffer_->skip( prefix::PrefixSize ) == prefix::PrefixSize, RetCode::InvalidData, "Broken BLOB chain" );
+            }
+
+            position_ += buffer_->skip( offset - position_ );
+            throw_btree_error( position_ == offset, RetCode::InvalidData, "Broken BLOB chain" );
+        }
+
+
+    public:
+
+        /** The class is not default creatable/copyable...
+        */
+        BlobReader() = delete;
+        BlobReader( const BlobReader & ) = delete;
+        BlobReader & operator = ( const BlobReader & ) = delete;
+
+
+        /** ...but movable
+        */
+        BlobReader( BlobReader && ) = default;
+
+
+        /** Provides size of the value in bytes
+
+        @retval uint64_t - size
+        @throw nothing
+        */
+        auto size() const noexcept { return size_; }
+
+
+        /** Provides current reading position
+
+        @retval uint64_t - offset from the beginning of the value in bytes
+        @throw nothing
+        */
+        auto position() const noexcept { return position_; }
+
+
+        /** Visits a range of the value chunk by chunk without copying
+
+        @tparam F - visitor type, callable as f( const char * data, size_t size )
+        @param [in] offset - start of the range
+        @param [in] length - length of the range, the range is clipped by the value size
+        @param [in] f - visitor, spans given to the visitor stay valid only during the call
+        @retval uint64_t - number of visited bytes
+        @throw btree_error, storage_file_error, may throw what the visitor does
+        */
+        template < typename F >
+        uint64_t for_each_chunk( uint64_t offset, uint64_t length, F f )
+        {
+            using namespace std;
+
+            offset = min( offset, size_ );
+            length = min( length, size_ - offset );
+
+            seek( offset );
+
+            uint64_t visited = 0;
+
+            while ( visited < length )
+            {
+                auto[ data, available ] = buffer_->fetch();
+                throw_btree_error( available > 0, RetCode::InvalidData, "Broken BLOB chain" );
+
+                auto span_size = static_cast< size_t >( min< uint64_t >( available, length - visited ) );
+                f( data, span_size );
+
+                buffer_->consume( span_size );
+                visited += span_size;
+                position_ += span_size;
+            }
+
+            return visited;
+        }
+
+
+        /** Reads next portion of the value from current position
+
+        @param [out] buffer - target buffer
+        @param [in] count - maximum number of bytes to be read
+        @retval size_t - number of read bytes, 0 means end of value
+        @throw btree_error, storage_file_error
+        */
+        size_t read( void * buffer, size_t count )
+        {
+            return read( position_, buffer, count );
+        }
+
+
+        /** Reads a range of the value
+
+        @param [in] offset - start of the range
+        @param [out] buffer - target buffer
+        @param [in] count - maximum number of bytes to be read
+        @retval size_t - number of read bytes
+        @throw btree_error, storage_file_error
+        */
+        size_t read( uint64_t offset, void * buffer, size_t count )
+        {
+            auto target = static_cast< char* >( buffer );
+
+            auto read_bytes = for_each_chunk( offset, count, [&] ( const char * data, size_t size ) {
+                std::memcpy( target, data, size );
+                target += size;
+            } );
+
+            return static_cast< size_t >( read_bytes );
+        }
+    };
+}
+
+#endif
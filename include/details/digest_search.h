@@ -0,0 +1,324 @@
+#ifndef __JB__DIGEST_SEARCH__H__
+#define __JB__DIGEST_SEARCH__H__
+
+
+#include <type_traits>
+#include <cstdint>
+#include <cstddef>
+
+#if defined( _M_X64 ) || defined( __x86_64__ )
+#include <immintrin.h>
+#if defined( _MSC_VER )
+#include <intrin.h>
+#endif
+#endif
+
+
+namespace jb
+{
+    namespace details
+    {
+#if defined( _M_X64 ) || defined( __x86_64__ )
+
+        /* Instruction sets available for digest comparison
+        */
+        enum class SimdLevel { None, Sse42, Avx2 };
+
+
+        /* Number of set bits in comparison mask, portable replacement of popcnt
+        */
+        inline constexpr size_t MaskBits[] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+
+
+        /* Detects the best instruction set supported by the processor and the OS at runtime
+
+        The compiler is not required to target AVX2 or SSE4.2, the corresponding functions are
+        compiled for these sets separately and are called only if the processor supports them
+
+        @retval SimdLevel - detected level, it's detected once
+        @throw nothing
+        */
+        inline SimdLevel simd_level() noexcept
+        {
+            static const SimdLevel level = [] {
+#if defined( _MSC_VER ) && !defined( __clang__ )
+                int regs[ 4 ] = {};
+
+                __cpuid( regs, 0 );
+                const int max_leaf = regs[ 0 ];
+
+                __cpuid( regs, 1 );
+                const bool sse42 = ( regs[ 2 ] & ( 1 << 20 ) ) != 0;
+                const bool avx_os = ( regs[ 2 ] & ( 1 << 27 ) ) != 0 && ( regs[ 2 ] & ( 1 << 28 ) ) != 0 && ( _xgetbv( 0 ) & 6 ) == 6;
+
+                bool avx2 = false;
+                if ( max_leaf >= 7 )
+                {
+                    __cpuidex( regs, 7, 0 );
+                    avx2 = avx_os && ( regs[ 1 ] & ( 1 << 5 ) ) != 0;
+                }
+#else
+                __builtin_cpu_init();
+                const bool sse42 = __builtin_cpu_supports( "sse4.2" );
+                const bool avx2 = __builtin_cpu_supports( "avx2" );
+#endif
+                return avx2 ? SimdLevel::Avx2 : sse42 ? SimdLevel::Sse42 : SimdLevel::None;
+            }();
+
+            return level;
+        }
+
+
+        /* Counts 64-bit integers less than a key by AVX2, 4 per step
+
+        @param [in] first - pointer to the first element
+        @param [in] size - number of elements, the tail shorter than a step is left
+        @param [in] key - key biased to signed range
+        @param [in] bias - bias of the elements
+        @param [in/out] i - the next element
+        @retval size_t - number of elements less than the key
+        @throw nothing
+        */
+#if defined( __GNUC__ ) || defined( __clang__ )
+        __attribute__( ( target( "avx2" ) ) )
+#endif
+        inline size_t count_less_avx2( const int64_t * first, size_t size, int64_t key, int64_t bias, size_t & i ) noexcept
+        {
+            const auto k = _mm256_set1_epi64x( key );
+            const auto b = _mm256_set1_epi64x( bias );
+
+            size_t count = 0;
+
+            for ( ; i + 4 <= size; i += 4 )
+            {
+                const auto v = _mm256_xor_si256( _mm256_loadu_si256( reinterpret_cast< const __m256i* >( first + i ) ), b );
+                const auto less = _mm256_cmpgt_epi64( k, v );
+                count += MaskBits[ _mm256_movemask_pd( _mm256_castsi256_pd( less ) ) ];
+            }
+
+            return count;
+        }
+
+
+        /* Counts 64-bit integers less than a key by SSE4.2, 2 per step
+
+        @param [in] first - pointer to the first element
+        @param [in] size - number of elements, the tail shorter than a step is left
+        @param [in] key - key biased to signed range
+        @param [in] bias - bias of the elements
+        @param [in/out] i - the next element
+        @retval size_t - number of elements less than the key
+        @throw nothing
+        */
+#if defined( __GNUC__ ) || defined( __clang__ )
+        __attribute__( ( target( "sse4.2" ) ) )
+#endif
+        inline size_t count_less_sse42( const int64_t * first, size_t size, int64_t key, int64_t bias, size_t & i ) noexcept
+        {
+            const auto k = _mm_set1_epi64x( key );
+            const auto b = _mm_set1_epi64x( bias );
+
+            size_t count = 0;
+
+            for ( ; i + 2 <= size; i += 2 )
+            {
+                const auto v = _mm_xor_si128( _mm_loadu_si128( reinterpret_cast< const __m128i* >( first + i ) ), b );
+                const auto less = _mm_cmpgt_epi64( k, v );
+                count += MaskBits[ _mm_movemask_pd( _mm_castsi128_pd( less ) ) ];
+            }
+
+            return count;
+        }
+
+#endif
+
+
+        /** Counts elements less than a key in short array
+
+        Uses SIMD comparison of 64-bit integers on x64 if the processor supports AVX2 or SSE4.2, the
+        level is detected at runtime, so the build does not need to target these sets. The rest is
+        handled by branchless scalar loop
+
+        @tparam T - element type
+        @param [in] first - pointer to the first element
+        @param [in] size - number of elements
+        @param [in] key - key to compare with
+        @retval size_t - number of elements less than the key
+        @throw nothing
+        */
+        template < typename T >
+        size_t count_less( const T * first, size_t size, T key ) noexcept
+        {
+            size_t count = 0, i = 0;
+
+#if defined( _M_X64 ) || defined( __x86_64__ )
+
+            if constexpr ( std::is_integral_v< T > && sizeof( T ) == sizeof( int64_t ) )
+            {
+                // SIMD compares signed integers, so unsigned ones are shifted to signed range
+                const int64_t bias = std::is_signed_v< T > ? 0 : static_cast< int64_t >( 1ULL << 63 );
+                const int64_t k = static_cast< int64_t >( key ) ^ bias;
+                const auto data = reinterpret_cast< const int64_t* >( first );
+
+                switch ( simd_level() )
+                {
+                case SimdLevel::Avx2:
+                    count = count_less_avx2( data, size, k, bias, i );
+                    break;
+
+                case SimdLevel::Sse42:
+                    count = count_less_sse42( data, size, k, bias, i );
+                    break;
+
+                default:
+                    break;
+                }
+            }
+
+#endif
+
+            for ( ; i < size; ++i )
+            {
+                count += first[ i ] < key ? 1 : 0;
+            }
+
+            return count;
+        }
+
+
+        /** Finds position of the first element not less than a key in sorted array
+
+        Narrows the range by branchless binary search untill the rest fits a few SIMD registers and
+        counts remaining elements less than the key at once. Unlike std::lower_bound() there are no
+        unpredictable branches, and the last probes that would touch neighbouring cache lines are
+        replaced with one sequential scan
+
+        @tparam T - element type
+        @param [in] first - pointer to the first element
+        @param [in] size - number of elements
+        @param [in] key - key to be found
+        @retval size_t - position of lower bound, size if all the elements are less than the key
+        @throw nothing
+        */
+        template < typename T >
+        size_t digest_lower_bound( const T * first, size_t size, T key ) noexcept
+        {
+            // length of the range to be scanned at once: 2 cache lines of 64-bit digests
+            static constexpr size_t ScanSize = 16;
+
+            const T * base = first;
+
+            // everything before base is less than the key, lower bound is not farther than base + size
+            while ( size > ScanSize )
+            {
+                const auto half = size / 2;
+                base = base[ half ] < key ? base + half : base;
+                size -= half;
+            }
+
+            return static_cast< size_t >( base - first ) + count_less( base, size, key );
+        }
+
+
+        /** Prefetches cache line containing given address
+
+        @param [in] p - address
+        @throw nothing
+        */
+        inline void prefetch( const void * p ) noexcept
+        {
+#if defined( _M_X64 ) || defined( __x86_64__ )
+            _mm_prefetch( static_cast< const char* >( p ), _MM_HINT_T0 );
+#elif defined( __GNUC__ )
+            __builtin_prefetch( p );
+#else
+            ( void )p;
+#endif
+        }
+
+
+        /* Fills Eytzinger layout by in-order traversal of implicit tree
+
+        @param [in] sorted - sorted elements
+        @param [in] size - number of elements
+        @param [out] layout - elements in BFS order
+        @param [out] ranks - positions of the elements in sorted array
+        @param [in] k - 1-based index of the subtree root
+        @param [in/out] i - the next sorted element
+        @throw nothing
+        */
+        template < typename T, typename R >
+        void fill_eytzinger( const T * sorted, size_t size, T * layout, R * ranks, size_t k, size_t & i ) noexcept
+        {
+            if ( k > size ) return;
+
+            fill_eytzinger( sorted, size, layout, ranks, 2 * k, i );
+
+            layout[ k - 1 ] = sorted[ i ];
+            ranks[ k - 1 ] = static_cast< R >( i++ );
+
+            fill_eytzinger( sorted, size, layout, ranks, 2 * k + 1, i );
+        }
+
+
+        /** Rearranges sorted array in Eytzinger (BFS) order
+
+        The element at 1-based index k has children at 2k and 2k + 1, so binary search goes
+        through the array from the beginning and the nodes of several next levels share a few
+        adjacent cache lines, that lets them be prefetched in advance
+
+        @tparam T - element type
+        @tparam R - rank type, must represent positions up to size
+        @param [in] sorted - sorted elements
+        @param [in] size - number of elements
+        @param [out] layout - elements in BFS order, size elements
+        @param [out] ranks - positions of the layout elements in sorted array, size elements
+        @throw nothing
+        */
+        template < typename T, typename R >
+        void eytzinger_layout( const T * sorted, size_t size, T * layout, R * ranks ) noexcept
+        {
+            size_t i = 0;
+            fill_eytzinger( sorted, size, layout, ranks, 1, i );
+        }
+
+
+        /** Finds position of the first element not less than a key by Eytzinger layout
+
+        Goes down the implicit tree without branches prefetching the nodes 4 levels ahead, then
+        restores the last node where the search turned left, the node is the lower bound
+
+        @tparam T - element type
+        @tparam R - rank type
+        @param [in] layout - elements in BFS order, see eytzinger_layout()
+        @param [in] ranks - positions of the layout elements in sorted array
+        @param [in] size - number of elements
+        @param [in] key - key to be found
+        @retval size_t - position of lower bound in sorted array, size if all the elements are less
+                         than the key
+        @throw nothing
+        */
+        template < typename T, typename R >
+        size_t eytzinger_lower_bound( const T * layout, const R * ranks, size_t size, T key ) noexcept
+        {
+            // descendants 4 levels down start at 16k, a cache line holds several of them
+            static constexpr size_t PrefetchStride = 16;
+
+            size_t k = 1;
+
+            while ( k <= size )
+            {
+                if ( PrefetchStride * k <= size ) prefetch( layout + PrefetchStride * k - 1 );
+                k = 2 * k + ( layout[ k - 1 ] < key ? 1 : 0 );
+            }
+
+            // drop trailing right turns and the last left one
+            while ( k & 1 ) k >>= 1;
+            k >>= 1;
+
+            return k ? static_cast< size_t >( ranks[ k - 1 ] ) : size;
+        }
+    }
+}
+
+#endif
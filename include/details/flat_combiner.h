@@ -0,0 +1,209 @@
+#ifndef __JB__FLAT_COMBINER__H__
+#define __JB__FLAT_COMBINER__H__
+
+
+#include <vector>
+#include <optional>
+#include <stdexcept>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <limits>
+#include <utility>
+
+
+namespace jb
+{
+    namespace details
+    {
+        /** Serializes operations over shared object applying concurrent ones in batches
+
+        A thread queues its request under the mutex and either becomes the combiner or waits on the
+        condition variable. The combiner takes queued requests at once, applies them by single call
+        outside the mutex and publishes the results, then the next combiner takes requests arrived
+        meanwhile. So concurrent requests are applied in batches instead of one by one, and the
+        object is never accessed by two threads at once
+
+        Unlike classic flat combining there are no per-thread publication records scanned by the
+        combiner, the request queue is a plain lock-and-queue over the mutex. The win comes from
+        sharing the expensive apply step, not from avoiding the lock
+
+        @tparam Request - request type
+        @tparam Result - result type
+
+        @note the class is thread safe
+        */
+        template < typename Request, typename Result >
+        class flat_combiner
+        {
+            struct slot
+            {
+                Request request_;
+                std::optional< Result > result_;
+                std::exception_ptr error_;
+                bool done_ = false;
+                slot * next_ = nullptr;
+
+                explicit slot( Request && request ) : request_( std::move( request ) ) {}
+            };
+
+            std::mutex mutex_;
+            std::condition_variable cv_;
+            slot * head_ = nullptr;
+            slot * tail_ = nullptr;
+            bool combining_ = false;
+            size_t max_batch_;
+
+
+            /* Takes published requests for combining
+
+            Published slots form intrusive list, so neither publishing nor taking allocates memory
+
+            @retval slot* - the first of taken requests, they're linked in order of publication
+            @throw nothing
+            @note the caller must hold the mutex
+            */
+            slot * take_batch() noexcept
+            {
+                slot * first = head_;
+                slot * last = head_;
+
+                for ( size_t count = 1; count < max_batch_ && last->next_; ++count )
+                {
+                    last = last->next_;
+                }
+
+                head_ = last->next_;
+                if ( !head_ ) tail_ = nullptr;
+                last->next_ = nullptr;
+
+                return first;
+            }
+
+
+            /* Applies batch of requests and stores the results into the slots
+
+            @tparam F - applier type
+            @param [in] batch - the first of requests to be applied
+            @param [in] apply - applier
+            @throw nothing
+            */
+            template < typename F >
+            static void apply_batch( slot * batch, F & apply ) noexcept
+            {
+                using namespace std;
+
+                try
+                {
+                    vector< Request > requests;
+                    for ( auto s = batch; s; s = s->next_ ) requests.push_back( move( s->request_ ) );
+
+                    auto results = apply( requests );
+
+                    if ( results.size() != requests.size() ) throw logic_error( "Invalid number of results" );
+
+                    auto s = batch;
+                    for ( auto & result : results )
+                    {
+                        s->result_.emplace( move( result ) );
+                        s = s->next_;
+                    }
+                }
+                catch ( ... )
+                {
+                    // the whole batch failed
+                    for ( auto s = batch; s; s = s->next_ )
+                    {
+                        if ( !s->result_ ) s->error_ = current_exception();
+                    }
+                }
+            }
+
+
+        public:
+
+            /** Constructor
+
+            @param [in] max_batch - maximum number of requests applied at once
+            @throw nothing
+            */
+            explicit flat_combiner( size_t max_batch = std::numeric_limits< size_t >::max() ) noexcept
+                : max_batch_( max_batch ? max_batch : 1 )
+            {
+            }
+
+
+            flat_combiner( const flat_combiner & ) = delete;
+            flat_combiner & operator = ( const flat_combiner & ) = delete;
+
+
+            /** Executes a request combining it with concurrent ones
+
+            The applier receives requests in order of their publication and must return results in
+            the same order. If it throws, each request of the batch fails with the same exception
+
+            @tparam F - applier type, callable as std::vector< Result > f( std::vector< Request > & )
+            @param [in] request - request to be executed
+            @param [in] apply - applier, all the concurrent callers must provide equivalent ones
+            @retval Result - result of the request
+            @throw std::bad_alloc, may rethrow what the applier does
+            */
+            template < typename F >
+            Result execute( Request request, F && apply )
+            {
+                using namespace std;
+
+                slot own( move( request ) );
+
+                unique_lock< std::mutex > lock( mutex_ );
+
+                // publish the request, a slot is taken off the list by take_batch() before it's done, so
+                // the list never refers the slot after return, GCC cannot prove it and warns here
+#if defined( __GNUC__ ) && !defined( __clang__ ) && __GNUC__ >= 12
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdangling-pointer"
+#endif
+                ( tail_ ? tail_->next_ : head_ ) = &own;
+                tail_ = &own;
+#if defined( __GNUC__ ) && !defined( __clang__ ) && __GNUC__ >= 12
+#pragma GCC diagnostic pop
+#endif
+
+                while ( !own.done_ )
+                {
+                    if ( combining_ )
+                    {
+                        cv_.wait( lock );
+                        continue;
+                    }
+
+                    // become the combiner, own request may be beyond the batch limit and wait for the next round
+                    combining_ = true;
+                    auto batch = take_batch();
+
+                    lock.unlock();
+                    apply_batch( batch, apply );
+                    lock.lock();
+
+                    for ( auto s = batch; s; )
+                    {
+                        // a waiter may leave as soon as its slot is done
+                        auto next = s->next_;
+                        s->done_ = true;
+                        s = next;
+                    }
+
+                    combining_ = false;
+                    cv_.notify_all();
+                }
+
+                if ( own.error_ ) rethrow_exception( own.error_ );
+
+                return move( *own.result_ );
+            }
+        };
+    }
+}
+
+
+#endif
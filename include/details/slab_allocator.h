@@ -0,0 +1,532 @@
+#ifndef __JB__SLAB_ALLOCATOR__H__
+#define __JB__SLAB_ALLOCATOR__H__
+
+
+#include <array>
+#include <mutex>
+#include <new>
+#include <atomic>
+#include <iterator>
+#include <utility>
+#include <algorithm>
+#include <type_traits>
+#include <cstring>
+#include <cstddef>
+
+
+namespace jb
+{
+    namespace details
+    {
+        /** Process-wide pool of memory blocks grouped by size classes
+
+        Requested sizes are rounded up to the next power of 2 starting from MinBlockSize, each
+        class keeps released blocks in its own free list and provides them to the next requests of
+        the same class, so containers growing and shrinking repeatedly do not go to the heap. A
+        class retains not more than RetainBytes of released memory, the rest is returned to the
+        heap, so memory consumption follows live data. Blocks larger than the biggest class are
+        allocated from the heap directly
+
+        @note the class is thread safe
+        */
+        class slab_pool
+        {
+        public:
+
+            static constexpr size_t MinBlockSize = 64;
+            static constexpr size_t ClassNumber = 12;
+            static constexpr size_t MaxBlockSize = MinBlockSize << ( ClassNumber - 1 );
+            static constexpr size_t RetainBytes = 1 << 20;
+
+        private:
+
+            struct free_block
+            {
+                free_block * next_;
+            };
+
+            struct size_class
+            {
+                std::mutex mutex_;
+                free_block * head_ = nullptr;
+                size_t count_ = 0;
+            };
+
+            std::array< size_class, ClassNumber > classes_;
+
+
+            /* Provides size class for requested size
+
+            @param [in] size - requested size in bytes
+            @retval size_t - class index, ClassNumber if the size exceeds the biggest class
+            @throw nothing
+            */
+            static constexpr size_t class_of( size_t size ) noexcept
+            {
+                size_t ndx = 0;
+
+                for ( size_t block = MinBlockSize; block < size && ndx < ClassNumber; block <<= 1 )
+                {
+                    ++ndx;
+                }
+
+                return ndx;
+            }
+
+
+            slab_pool() noexcept = default;
+
+
+        public:
+
+            slab_pool( const slab_pool & ) = delete;
+            slab_pool & operator = ( const slab_pool & ) = delete;
+
+
+            /** Destructor, returns retained blocks to the heap
+            */
+            ~slab_pool()
+            {
+                for ( auto & c : classes_ )
+                {
+                    while ( c.head_ )
+                    {
+                        auto block = c.head_;
+                        c.head_ = block->next_;
+                        ::operator delete( block );
+                    }
+                }
+            }
+
+
+            /** Provides the pool instance
+
+            The instance is never destroyed, so containers released by static destructors still
+            find it alive
+
+            @retval slab_pool - the pool
+            @throw nothing
+            */
+            static slab_pool & instance() noexcept
+            {
+                static slab_pool * pool = new slab_pool;
+                return *pool;
+            }
+
+
+            /** Provides size of a block serving given request
+
+            @param [in] size - requested size in bytes
+            @retval size_t - block size
+            @throw nothing
+            */
+            static constexpr size_t block_size( size_t size ) noexcept
+            {
+                const auto ndx = class_of( size );
+                return ndx < ClassNumber ? MinBlockSize << ndx : size;
+            }
+
+
+            /** Allocates memory block
+
+            @param [in] size - requested size in bytes
+            @retval void* - the block
+            @throw std::bad_alloc
+            */
+            void * allocate( size_t size )
+            {
+                const auto ndx = class_of( size );
+                if ( ndx == ClassNumber ) return ::operator new( size );
+
+                auto & c = classes_[ ndx ];
+
+                {
+                    std::lock_guard< std::mutex > lock( c.mutex_ );
+
+                    if ( auto block = c.head_ )
+                    {
+                        c.head_ = block->next_;
+                        --c.count_;
+                        return block;
+                    }
+                }
+
+                return ::operator new( MinBlockSize << ndx );
+            }
+
+
+            /** Releases memory block
+
+            @param [in] p - the block
+            @param [in] size - size requested on allocation of the block
+            @throw nothing
+            */
+            void deallocate( void * p, size_t size ) noexcept
+            {
+                const auto ndx = class_of( size );
+
+                if ( ndx < ClassNumber )
+                {
+                    auto & c = classes_[ ndx ];
+
+                    std::lock_guard< std::mutex > lock( c.mutex_ );
+
+                    if ( ( c.count_ + 1 ) * ( MinBlockSize << ndx ) <= RetainBytes )
+                    {
+                        auto block = static_cast< free_block* >( p );
+                        block->next_ = c.head_;
+                        c.head_ = block;
+                        ++c.count_;
+                        return;
+                    }
+                }
+
+                ::operator delete( p );
+            }
+
+
+            /** Provides number of released blocks retained for given size
+
+            @param [in] size - requested size in bytes
+            @retval size_t - number of blocks in the free list of the size class
+            @throw nothing
+            */
+            size_t retained( size_t size ) noexcept
+            {
+                const auto ndx = class_of( size );
+                if ( ndx == ClassNumber ) return 0;
+
+                auto & c = classes_[ ndx ];
+
+                std::lock_guard< std::mutex > lock( c.mutex_ );
+                return c.count_;
+            }
+        };
+
+
+        /** Standard allocator over the slab pool
+
+        Lets containers which size changes with their content take memory from size classes of the
+        pool, all the instances are interchangeable
+
+        @tparam T - element type
+        */
+        template < typename T >
+        struct slab_allocator
+        {
+            static_assert( alignof( T ) <= alignof( std::max_align_t ), "Over-aligned types are not supported" );
+
+            using value_type = T;
+
+            slab_allocator() noexcept = default;
+
+            template < typename U >
+            slab_allocator( const slab_allocator< U > & ) noexcept {}
+
+            T * allocate( size_t n )
+            {
+                return static_cast< T* >( slab_pool::instance().allocate( n * sizeof( T ) ) );
+            }
+
+            void deallocate( T * p, size_t n ) noexcept
+            {
+                slab_pool::instance().deallocate( p, n * sizeof( T ) );
+            }
+
+            template < typename U >
+            friend bool operator == ( const slab_allocator &, const slab_allocator< U > & ) noexcept { return true; }
+
+            template < typename U >
+            friend bool operator != ( const slab_allocator &, const slab_allocator< U > & ) noexcept { return false; }
+        };
+
+
+        /** Array of trivially copyable items over the slab pool, readable without locking
+
+        The storage is a block of the slab pool sized to the actual number of items, it grows by
+        doubling, so memory follows the content. Unlike std::vector, outgrown blocks are not released
+        while the array lives, since a reader may still read them without locking. Such a reader takes
+        consistent pointer and number of items by view(), so a torn read never goes beyond the block
+        it reads, the result must be validated by the reader. Outgrown blocks sum up to less than the
+        current one, the storage never shrinks
+
+        @tparam T - item type
+        @tparam Capacity - maximum number of items
+        @note modifications must be serialized by the owner
+        */
+        template < typename T, size_t Capacity >
+        class slab_array
+        {
+            static_assert( std::is_trivially_copyable_v< T >, "Items must be trivially copyable" );
+
+            struct block
+            {
+                block * outgrown_;
+                size_t capacity_;
+
+                T * items() noexcept { return reinterpret_cast< T* >( this + 1 ); }
+
+                static constexpr size_t bytes( size_t capacity ) noexcept { return sizeof( block ) + capacity * sizeof( T ); }
+            };
+
+            static_assert( alignof( T ) <= alignof( block ), "Over-aligned types are not supported" );
+
+            std::atomic< block* > block_{ nullptr };
+            std::atomic< size_t > size_{ 0 };
+
+
+            /* Moves the items to a bigger block, the current one is kept till destruction
+
+            @param [in] n - required number of items
+            @throw std::bad_alloc
+            */
+            void grow( size_t n )
+            {
+                using namespace std;
+
+                if ( n > Capacity ) throw bad_alloc{};
+
+                auto current = block_.load( memory_order_relaxed );
+                const auto wanted = max( n, current ? 2 * current->capacity_ : 0 );
+
+                // take the whole size class
+                const auto fits = ( slab_pool::block_size( block::bytes( wanted ) ) - sizeof( block ) ) / sizeof( T );
+                const auto capacity = min( max( wanted, fits ), Capacity );
+
+                auto grown = static_cast< block* >( slab_pool::instance().allocate( block::bytes( capacity ) ) );
+                grown->outgrown_ = current;
+                grown->capacity_ = capacity;
+
+                if ( current ) memcpy( grown->items(), current->items(), size() * sizeof( T ) );
+
+                block_.store( grown, memory_order_release );
+            }
+
+
+            void release() noexcept
+            {
+                for ( auto b = block_.load( std::memory_order_relaxed ); b; )
+                {
+                    auto outgrown = b->outgrown_;
+                    slab_pool::instance().deallocate( b, block::bytes( b->capacity_ ) );
+                    b = outgrown;
+                }
+
+                block_.store( nullptr, std::memory_order_relaxed );
+                size_.store( 0, std::memory_order_relaxed );
+            }
+
+
+            void set_size( size_t n ) noexcept
+            {
+                size_.store( n, std::memory_order_release );
+            }
+
+
+        public:
+
+            using value_type = T;
+            using iterator = T *;
+            using const_iterator = const T *;
+
+
+            slab_array() noexcept = default;
+
+
+            slab_array( const slab_array & other ) : slab_array()
+            {
+                assign( other.begin(), other.end() );
+            }
+
+
+            slab_array( slab_array && other ) noexcept
+            {
+                block_.store( other.block_.exchange( nullptr, std::memory_order_relaxed ), std::memory_order_relaxed );
+                size_.store( other.size_.exchange( 0, std::memory_order_relaxed ), std::memory_order_relaxed );
+            }
+
+
+            slab_array & operator = ( const slab_array & other )
+            {
+                if ( this != &other ) assign( other.begin(), other.end() );
+                return *this;
+            }
+
+
+            slab_array & operator = ( slab_array && other ) noexcept
+            {
+                if ( this != &other )
+                {
+                    release();
+                    block_.store( other.block_.exchange( nullptr, std::memory_order_relaxed ), std::memory_order_relaxed );
+                    size_.store( other.size_.exchange( 0, std::memory_order_relaxed ), std::memory_order_relaxed );
+                }
+
+                return *this;
+            }
+
+
+            ~slab_array()
+            {
+                release();
+            }
+
+
+            /** Provides items for reading without locking
+
+            @retval std::pair< const T*, size_t > - items and their number, never beyond the block
+            @throw nothing
+            */
+            std::pair< const T*, size_t > view() const noexcept
+            {
+                using namespace std;
+
+                const auto b = block_.load( memory_order_acquire );
+                const auto n = size_.load( memory_order_acquire );
+
+                return b ? pair< const T*, size_t >{ b->items(), min( n, b->capacity_ ) } : pair< const T*, size_t >{ nullptr, 0 };
+            }
+
+
+            size_t size() const noexcept { return size_.load( std::memory_order_relaxed ); }
+            bool empty() const noexcept { return !size(); }
+
+            size_t capacity() const noexcept
+            {
+                const auto b = block_.load( std::memory_order_relaxed );
+                return b ? b->capacity_ : 0;
+            }
+
+            T * data() noexcept
+            {
+                const auto b = block_.load( std::memory_order_relaxed );
+                return b ? b->items() : nullptr;
+            }
+
+            const T * data() const noexcept { return const_cast< slab_array* >( this )->data(); }
+
+            iterator begin() noexcept { return data(); }
+            iterator end() noexcept { return data() + size(); }
+            const_iterator begin() const noexcept { return data(); }
+            const_iterator end() const noexcept { return data() + size(); }
+
+            T & operator [] ( size_t ndx ) noexcept { return data()[ ndx ]; }
+            const T & operator [] ( size_t ndx ) const noexcept { return data()[ ndx ]; }
+
+            T & front() noexcept { return *begin(); }
+            const T & front() const noexcept { return *begin(); }
+            T & back() noexcept { return *( end() - 1 ); }
+            const T & back() const noexcept { return *( end() - 1 ); }
+
+
+            /** Ensures storage for given number of items
+
+            @param [in] n - number of items
+            @throw std::bad_alloc
+            */
+            void reserve( size_t n )
+            {
+                if ( n > capacity() ) grow( n );
+            }
+
+
+            void resize( size_t n )
+            {
+                reserve( n );
+
+                if ( n > size() ) std::fill( end(), data() + n, T{} );
+                set_size( n );
+            }
+
+
+            void clear() noexcept
+            {
+                set_size( 0 );
+            }
+
+
+            void push_back( const T & item )
+            {
+                const auto n = size();
+
+                reserve( n + 1 );
+                data()[ n ] = item;
+                set_size( n + 1 );
+            }
+
+
+            void pop_back() noexcept
+            {
+                set_size( size() - 1 );
+            }
+
+
+            template < typename It >
+            void assign( It first, It last )
+            {
+                const auto n = static_cast< size_t >( std::distance( first, last ) );
+
+                reserve( n );
+                std::copy( first, last, data() );
+                set_size( n );
+            }
+
+
+            iterator insert( const_iterator pos, const T & item )
+            {
+                const auto ndx = static_cast< size_t >( pos - begin() );
+                const auto n = size();
+
+                reserve( n + 1 );
+
+                auto items = data();
+                std::memmove( items + ndx + 1, items + ndx, ( n - ndx ) * sizeof( T ) );
+                items[ ndx ] = item;
+                set_size( n + 1 );
+
+                return items + ndx;
+            }
+
+
+            template < typename It >
+            iterator insert( const_iterator pos, It first, It last )
+            {
+                const auto ndx = static_cast< size_t >( pos - begin() );
+                const auto count = static_cast< size_t >( std::distance( first, last ) );
+                const auto n = size();
+
+                reserve( n + count );
+
+                auto items = data();
+                std::memmove( items + ndx + count, items + ndx, ( n - ndx ) * sizeof( T ) );
+                std::copy( first, last, items + ndx );
+                set_size( n + count );
+
+                return items + ndx;
+            }
+
+
+            iterator erase( const_iterator pos ) noexcept
+            {
+                return erase( pos, pos + 1 );
+            }
+
+
+            iterator erase( const_iterator first, const_iterator last ) noexcept
+            {
+                const auto ndx = static_cast< size_t >( first - begin() );
+                const auto count = static_cast< size_t >( last - first );
+                const auto n = size();
+
+                auto items = data();
+                std::memmove( items + ndx, items + ndx + count, ( n - ndx - count ) * sizeof( T ) );
+                set_size( n - count );
+
+                return items + ndx;
+            }
+        };
+    }
+}
+
+
+#endif
@@ -3,6 +3,7 @@
 
 
 #include <functional>
+#include <cstdint>
 
 
 namespace jb
@@ -18,22 +19,22 @@ namespace jb
         template < typename T >
         constexpr size_t combine_hash( size_t seed, const T & value ) noexcept
         {
-            static constexpr std::hash< T > h{};
+            const std::hash< T > h{};
             return h( value ) + hash_constant() + ( seed << 6 ) + ( seed >> 2 );
         }
 
-        template < typename T, typename... Args >
-        size_t variadic_hash( const T & value, const Args &... args ) noexcept
+        template < typename T >
+        size_t variadic_hash( const T & value ) noexcept
         {
-            const auto seed = variadic_hash( args... );
-            return combine_hash( value, seed );
+            const std::hash< T > h{};
+            return h( value );
         }
 
-        template < typename T >
-        static auto variadic_hash( const T & value ) noexcept
+        template < typename T, typename... Args >
+        size_t variadic_hash( const T & value, const Args &... args ) noexcept
         {
-            static constexpr shd::hash< T > h{};
-            return h( value );
+            const auto seed = variadic_hash( args... );
+            return combine_hash( seed, value );
         }
     }
 }
@@ -5,6 +5,16 @@
 #include <type_traits>
 #include <variant>
 #include <iostream>
+#include <array>
+#include <vector>
+#include <tuple>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <string_view>
+#include <functional>
+#include <optional>
+#include <limits>
 
 
 #ifndef BOOST_ENDIAN_DEPRECATED_NAMES
@@ -100,6 +110,332 @@ namespace jb
     };
 
 
+    //
+    // Makes std::vector< std::byte > to be considered as BLOB type
+    //
+    template <>
+    struct is_blob_type< std::vector< std::byte > >
+    {
+        static constexpr bool value = true;
+        using StreamCharT = char;
+    };
+
+
+    //
+    // Makes std::vector< float > to be considered as BLOB type
+    //
+    template <>
+    struct is_blob_type< std::vector< float > >
+    {
+        static constexpr bool value = true;
+        using StreamCharT = char;
+    };
+
+
+    //
+    // Makes std::vector< double > to be considered as BLOB type
+    //
+    template <>
+    struct is_blob_type< std::vector< double > >
+    {
+        static constexpr bool value = true;
+        using StreamCharT = char;
+    };
+
+
+    /** Length prefix of stored BLOB
+
+    The prefix holds element count as 8 stream characters, one byte of big-endian number per
+    character, that keeps the same layout for any stream character type
+
+    @tparam CharT - stream character type
+    */
+    template < typename CharT >
+    struct blob_size_prefix
+    {
+        using traits_type = std::char_traits< CharT >;
+
+        static constexpr size_t PrefixSize = sizeof( uint64_t );
+        static constexpr size_t ReadSlice = 0x10000;
+
+
+        /** Writes length prefix to output stream
+
+        @param [in/out] os - output stream
+        @param [in] size - number of elements
+        @throw may throw what underlaying stream buffer does
+        */
+        static void write( std::basic_ostream< CharT > & os, uint64_t size )
+        {
+            std::array< CharT, PrefixSize > prefix;
+
+            for ( size_t i = 0; i < PrefixSize; ++i )
+            {
+                prefix[ i ] = static_cast< CharT >( ( size >> ( 8 * ( PrefixSize - i - 1 ) ) ) & 0xFF );
+            }
+
+            os.write( prefix.data(), static_cast< std::streamsize >( prefix.size() ) );
+        }
+
+
+        /** Reads length prefix from input stream
+
+        @param [in/out] is - input stream
+        @retval bool - true if the prefix has been read successfully
+        @retval uint64_t - number of elements
+        @throw may throw what underlaying stream buffer does
+        */
+        static std::tuple< bool, uint64_t > read( std::basic_istream< CharT > & is )
+        {
+            std::array< CharT, PrefixSize > prefix;
+
+            if ( !is.read( prefix.data(), static_cast< std::streamsize >( prefix.size() ) ) )
+            {
+                return { false, 0 };
+            }
+
+            uint64_t size = 0;
+
+            for ( auto c : prefix )
+            {
+                size = ( size << 8 ) | ( static_cast< uint64_t >( traits_type::to_int_type( c ) ) & 0xFF );
+            }
+
+            return { true, size };
+        }
+
+
+        /** Reads given number of elements following the prefix
+
+        The prefix comes from the storage and may be broken, so the length is checked against
+        address space before any arithmetic, and the target grows slice by slice as the chain
+        delivers data. Thus a corrupted prefix costs at most twice of the real chain length instead
+        of an attempt to allocate whatever number it holds
+
+        @tparam V - type of target container
+        @param [in/out] is - input stream
+        @param [out] value - target container
+        @param [in] size - number of elements declared by the prefix
+        @retval bool - true if all the elements have been read
+        @throw std::bad_alloc, may throw what underlaying stream buffer does
+        */
+        template < typename V >
+        static bool read_elements( std::basic_istream< CharT > & is, V & value, uint64_t size )
+        {
+            using namespace std;
+
+            using value_type = typename V::value_type;
+
+            static_assert( sizeof( value_type ) % sizeof( CharT ) == 0, "Element must consist of whole stream characters" );
+
+            constexpr size_t CharsPerElement = sizeof( value_type ) / sizeof( CharT );
+            constexpr uint64_t MaxElements = min< uint64_t >(
+                numeric_limits< size_t >::max() / sizeof( value_type ),
+                static_cast< uint64_t >( numeric_limits< streamsize >::max() ) / CharsPerElement );
+
+            value.clear();
+
+            if ( size > MaxElements )
+            {
+                return false;
+            }
+
+            size_t got = 0;
+
+            while ( got < size )
+            {
+                const size_t slice = static_cast< size_t >( min< uint64_t >( size - got, max( ReadSlice, got ) ) );
+                const auto chars = static_cast< streamsize >( slice * CharsPerElement );
+
+                value.resize( got + slice );
+                is.read( reinterpret_cast< CharT* >( value.data() + got ), chars );
+
+                if ( is.gcount() != chars )
+                {
+                    value.clear();
+                    return false;
+                }
+
+                got += slice;
+            }
+
+            return true;
+        }
+    };
+
+
+    /** Binary codec for BLOB values
+
+    Stores a value as a length prefix followed by raw elements, so packing and unpacking turn into
+    bulk copies through stream buffer instead of formatted i/o
+
+    @tparam T - type of value, must provide size(), data(), and resize()
+    */
+    template < typename T >
+    struct blob_codec
+    {
+        using StreamCharT = typename is_blob_type< T >::StreamCharT;
+        using prefix = blob_size_prefix< StreamCharT >;
+
+
+        /** Writes value to output stream
+
+        @param [in/out] os - output stream
+        @param [in] value - value to be written
+        @retval bool - true if the value has been written successfully
+        @throw may throw what underlaying stream buffer does
+        */
+        static bool write( std::basic_ostream< StreamCharT > & os, const T & value )
+        {
+            prefix::write( os, static_cast< uint64_t >( value.size() ) );
+            os.write( value.data(), static_cast< std::streamsize >( value.size() ) );
+
+            return os.good();
+        }
+
+
+        /** Reads value from input stream
+
+        @param [in/out] is - input stream
+        @param [out] value - read value
+        @retval bool - true if the value has been read successfully
+        @throw std::bad_alloc, may throw what underlaying stream buffer does
+        */
+        static bool read( std::basic_istream< StreamCharT > & is, T & value )
+        {
+            auto[ ok, size ] = prefix::read( is );
+
+            if ( !ok )
+            {
+                return false;
+            }
+
+            return prefix::read_elements( is, value, size );
+        }
+    };
+
+
+    /** Binary codec for arrays of trivial elements
+
+    Elements are stored as raw little-endian bytes, so on all mainstream platforms an array goes to
+    the storage and back by a single bulk copy without any per element conversion. Big-endian
+    platforms pay for byte swapping
+
+    @tparam T - element type
+    @tparam A - allocator type
+    */
+    template < typename T, typename A >
+    struct blob_codec< std::vector< T, A > >
+    {
+        static_assert( std::is_trivially_copyable_v< T >, "Array elements must be trivially copyable" );
+
+        using StreamCharT = char;
+        using prefix = blob_size_prefix< StreamCharT >;
+
+        static constexpr bool NoConversion = sizeof( T ) == 1 || boost::endian::order::native == boost::endian::order::little;
+
+
+        /** Writes array to output stream
+
+        @param [in/out] os - output stream
+        @param [in] value - array to be written
+        @retval bool - true if the array has been written successfully
+        @throw may throw what underlaying stream buffer does
+        */
+        static bool write( std::basic_ostream< StreamCharT > & os, const std::vector< T, A > & value )
+        {
+            prefix::write( os, static_cast< uint64_t >( value.size() ) );
+
+            if constexpr ( NoConversion )
+            {
+                os.write( reinterpret_cast< const char* >( value.data() ), static_cast< std::streamsize >( value.size() * sizeof( T ) ) );
+            }
+            else
+            {
+                for ( const auto & e : value )
+                {
+                    std::array< char, sizeof( T ) > bytes;
+                    std::memcpy( bytes.data(), &e, sizeof( T ) );
+                    std::reverse( bytes.begin(), bytes.end() );
+                    os.write( bytes.data(), static_cast< std::streamsize >( bytes.size() ) );
+                }
+            }
+
+            return os.good();
+        }
+
+
+        /** Reads array from input stream
+
+        @param [in/out] is - input stream
+        @param [out] value - read array
+        @retval bool - true if the array has been read successfully
+        @throw std::bad_alloc, may throw what underlaying stream buffer does
+        */
+        static bool read( std::basic_istream< StreamCharT > & is, std::vector< T, A > & value )
+        {
+            auto[ ok, size ] = prefix::read( is );
+
+            if ( !ok )
+            {
+                return false;
+            }
+
+            if ( !prefix::read_elements( is, value, size ) )
+            {
+                return false;
+            }
+
+            if constexpr ( !NoConversion )
+            {
+                for ( auto & e : value )
+                {
+                    auto first = reinterpret_cast< char* >( &e );
+                    std::reverse( first, first + sizeof( T ) );
+                }
+            }
+
+            return true;
+        }
+    };
+
+
+    /** Computes digest of BLOB content
+
+    The digest is persisted by BLOB index, so it's computed by FNV-1a over raw content instead of
+    std::hash which is allowed to differ between builds
+
+    @tparam T - type of contiguous container
+    @param [in] type_index - index of value type, values of different types must not be shared
+    @param [in] value - value
+    @retval uint64_t - digest of raw content
+    @throw nothing
+    */
+    template < typename T >
+    uint64_t blob_digest( uint64_t type_index, const T & value ) noexcept
+    {
+        constexpr uint64_t FnvOffsetBasis = 0xCBF29CE484222325ULL;
+        constexpr uint64_t FnvPrime = 0x100000001B3ULL;
+
+        uint64_t digest = FnvOffsetBasis;
+
+        for ( size_t i = 0; i < sizeof( type_index ); ++i )
+        {
+            digest = ( digest ^ ( ( type_index >> ( 8 * i ) ) & 0xFF ) ) * FnvPrime;
+        }
+
+        const auto first = reinterpret_cast< const unsigned char* >( value.data() );
+        const auto last = first + value.size() * sizeof( typename T::value_type );
+
+        for ( auto p = first; p != last; ++p )
+        {
+            digest = ( digest ^ *p ) * FnvPrime;
+        }
+
+        return digest;
+    }
+
+
     /** Represent value inside b-tree node
 
     Since the system uses B-tree for indexing, it does not seem as a good idea to hold
@@ -120,6 +456,8 @@ namespace jb
         using Value = typename Storage::Value;
         using big_uint64_t = boost::endian::big_uint64_at;
 
+        static constexpr auto BlobDedupThreshold = Policies::PhysicalVolumePolicy::BlobDedupThreshold;
+
         uint64_t type_index_;
         uint64_t value_;
 
@@ -134,7 +472,12 @@ namespace jb
         {
             using namespace std;
 
-            if ( I == type_index_ )
+            if constexpr ( I == variant_size_v< Value > )
+            {
+                throw_btree_error( false, RetCode::InvalidData, "Unable to resolve type index" );
+                return false;
+            }
+            else if ( I == type_index_ )
             {
                 using value_type = variant_alternative_t< I, Value >;
 
@@ -146,12 +489,63 @@ namespace jb
             }
         }
 
-        template <>
-        bool check_for_blob< std::variant_size_v< Value > >() const
+
+        /* Provides size of element for BLOB values which stored representation can be streamed as raw bytes
+
+        @retval size_t - size of element, 0 if the value cannot be streamed
+        @throw btree_error
+        */
+        template < size_t I >
+        size_t streamed_element_size() const
         {
-            throw_btree_error( false, RetCode::InvalidData, "Unable to resolve type index" );
+            using namespace std;
 
-            return false;
+            if constexpr ( I == variant_size_v< Value > )
+            {
+                throw_btree_error( false, RetCode::InvalidData, "Unable to resolve type index" );
+                return 0;
+            }
+            else if ( I == type_index_ )
+            {
+                using value_type = variant_alternative_t< I, Value >;
+
+                if constexpr ( is_blob_type< value_type >::value && is_same_v< typename is_blob_type< value_type >::StreamCharT, char > )
+                {
+                    return sizeof( typename value_type::value_type );
+                }
+                else
+                {
+                    return 0;
+                }
+            }
+            else
+            {
+                return streamed_element_size< I + 1 >();
+            }
+        }
+
+
+        /* Packs a value that fits uint64_t
+
+        @param [in] type_index - index of value type
+        @param [in] typed_value - value to be packed
+        @retval PackedValue - packed value
+        @throw nothing
+        */
+        template < typename T >
+        static PackedValue pack_inline( size_t type_index, const T & typed_value ) noexcept
+        {
+            using namespace std;
+
+            static_assert( sizeof( T ) <= sizeof( uint64_t ), "The value does not fit in place" );
+
+            uint64_t v_{};
+            copy(
+                reinterpret_cast< const char* >( &typed_value ),
+                reinterpret_cast< const char* >( &typed_value ) + sizeof( typed_value ),
+                reinterpret_cast< char* >( &v_ ) );
+
+            return PackedValue{ type_index, v_ };
         }
 
 
@@ -167,7 +561,12 @@ namespace jb
         {
             using namespace std;
 
-            if ( I == value.index() )
+            if constexpr ( I == variant_size_v< Value > )
+            {
+                throw_btree_error( false, RetCode::InvalidData, "Unable to resolve type index" );
+                return PackedValue( variant_npos, 0 );
+            }
+            else if ( I == value.index() )
             {
                 using value_type = variant_alternative_t< I, Value >;
                 const value_type & typed_value = std::get< I >( value );
@@ -176,25 +575,46 @@ namespace jb
                 {
                     using StreamCharT = typename is_blob_type< value_type >::StreamCharT;
 
-                    auto buffer = t.get_chain_writer< StreamCharT >();
-                    std::basic_ostream< StreamCharT > os( &buffer );
+                    const auto payload_size = typed_value.size() * sizeof( typename value_type::value_type );
+                    const auto dedup = BlobDedupThreshold && payload_size >= BlobDedupThreshold;
+                    const uint64_t digest = dedup ? blob_digest( static_cast< uint64_t >( I ), typed_value ) : 0;
+
+                    // share stored BLOB with the same content if any
+                    if ( dedup )
+                    {
+                        auto chain = t.find_blob( digest, [&] ( BlobUid candidate ) {
+                            auto buffer = t.template get_chain_reader< StreamCharT >( candidate );
+                            std::basic_istream< StreamCharT > is( &buffer );
+
+                            value_type stored;
+                            return blob_codec< value_type >::read( is, stored ) && stored == typed_value;
+                        } );
+
+                        if ( StorageFile::InvalidChunkUid != chain )
+                        {
+                            t.acquire_blob( chain );
+                            return PackedValue{ value.index(), chain };
+                        }
+                    }
+
+                    BlobUid chain;
+                    {
+                        auto buffer = t.template get_chain_writer< StreamCharT >();
+                        std::basic_ostream< StreamCharT > os( &buffer );
 
-                    os << typed_value;
-                    os.flush();
+                        throw_btree_error( blob_codec< value_type >::write( os, typed_value ), RetCode::UnknownError );
+                        os.flush();
 
-                    return PackedValue{ value.index(), t.get_first_written_chunk() };
+                        chain = t.get_first_written_chunk();
+                    }
+
+                    if ( dedup ) t.add_blob( digest, chain );
+
+                    return PackedValue{ value.index(), chain };
                 }
                 else
                 {
-                    //static_assert( ! is_blob_type< typed_value >::value || ( typed_value ) <= sizeof( uint64_t ) );
-
-                    uint64_t v_{};
-                    copy(
-                        reinterpret_cast< const char* >( &typed_value ),
-                        reinterpret_cast< const char* >( &typed_value ) + sizeof( typed_value ),
-                        reinterpret_cast< char* >( &v_ ) );
-
-                    return PackedValue{ value.index(), v_ };
+                    return pack_inline( value.index(), typed_value );
                 }
             }
             else
@@ -204,16 +624,6 @@ namespace jb
         }
 
 
-        //
-        // terminal specialization of pack<>()
-        //
-        template <>
-        static PackedValue pack< std::variant_size_v< Value > >( Transaction & t, const Value & value )
-        {
-            throw_btree_error( false, RetCode::InvalidData, "Unable to resolve type index" );
-            return PackedValue( std::variant_npos, 0 );
-        }
-
 
         /* Unpacks value
 
@@ -226,7 +636,12 @@ namespace jb
         {
             using namespace std;
 
-            if ( I == type_index_ )
+            if constexpr ( I == variant_size_v< Value > )
+            {
+                throw_btree_error( false, RetCode::InvalidData, "Unable to resolve type index" );
+                return Value{};
+            }
+            else if ( I == type_index_ )
             {
                 using value_type = variant_alternative_t< I, Value >;
 
@@ -236,9 +651,9 @@ namespace jb
                     
                     value_type value;
                     
-                    auto buffer = f.get_chain_reader< StreamCharT >( value_ );
+                    auto buffer = f.template get_chain_reader< StreamCharT >( value_ );
                     std::basic_istream< StreamCharT > is( &buffer );
-                    is >> value;
+                    throw_btree_error( blob_codec< value_type >::read( is, value ), RetCode::InvalidData, "Unable to read BLOB" );
 
                     return is_move_constructible_v< value_type > ? Value{ move( value ) } : Value{ value };
                 }
@@ -262,17 +677,86 @@ namespace jb
         }
 
 
-        //
-        // terminal specialization of unpack<>()
-        //
-        template <>
-        Value unpack< std::variant_size_v< Value > >( StorageFile & ) const
+
+        /* Applies numeric operation to inline value
+
+        @param [in] op - operation
+        @param [in] operand - operand of the same type as the value
+        @param [in] expected - value expected by NumericOp::CompareExchange
+        @retval bool - false if NumericOp::CompareExchange found unexpected value
+        @retval Value - the value before the operation
+        @retval PackedValue - updated value
+        @throw btree_error
+        */
+        template < size_t I >
+        std::tuple< bool, Value, PackedValue > update_numeric( NumericOp op, const Value & operand, const Value & expected ) const
         {
-            throw_btree_error( false, RetCode::InvalidData, "Unable to resolve type index" );
-            return Value{};
+            using namespace std;
+
+            if constexpr ( I == variant_size_v< Value > )
+            {
+                throw_btree_error( false, RetCode::InvalidData, "Unable to resolve type index" );
+                return {};
+            }
+            else if ( I == type_index_ )
+            {
+                using value_type = variant_alternative_t< I, Value >;
+
+                if constexpr ( is_blob_type< value_type >::value || !is_arithmetic_v< value_type > )
+                {
+                    throw_btree_error( false, RetCode::TypeMismatch, "The value is not numeric" );
+                    return {};
+                }
+                else
+                {
+                    throw_btree_error( I == operand.index() && ( NumericOp::CompareExchange != op || I == expected.index() ),
+                        RetCode::TypeMismatch, "Operand type differs from the value" );
+
+                    const auto & argument = std::get< I >( operand );
+
+                    value_type current;
+
+                    copy(
+                        reinterpret_cast< const char* >( &value_ ),
+                        reinterpret_cast< const char* >( &value_ ) + sizeof( current ),
+                        reinterpret_cast< char* >( &current )
+                    );
+
+                    value_type updated = current;
+                    bool applied = true;
+
+                    switch ( op )
+                    {
+                    case NumericOp::Add:
+                        // unsigned integers wrap around
+                        updated = static_cast< value_type >( current + argument );
+                        break;
+
+                    case NumericOp::Min:
+                        updated = min( current, argument );
+                        break;
+
+                    case NumericOp::Max:
+                        updated = max( current, argument );
+                        break;
+
+                    case NumericOp::CompareExchange:
+                        applied = std::get< I >( expected ) == current;
+                        updated = applied ? argument : current;
+                        break;
+                    }
+
+                    return { applied, Value{ in_place_index< I >, current }, pack_inline( I, updated ) };
+                }
+            }
+            else
+            {
+                return update_numeric< I + 1 >( op, operand, expected );
+            }
         }
 
 
+
         /* Expilcit consrutor, creates an assigned instance
 
         @param [in] type_index - index of assigned type
@@ -324,6 +808,31 @@ namespace jb
         }
 
 
+        /** Converts value into packed representation if the value does not require a BLOB
+
+        @param [in] value - value to be packed
+        @retval std::optional< PackedValue > - packed value or nothing for BLOB value
+        @throw nothing
+        */
+        static std::optional< PackedValue > make_inline( const Value & value ) noexcept
+        {
+            using namespace std;
+
+            return visit( [&] ( const auto & typed_value ) -> optional< PackedValue > {
+                using value_type = decay_t< decltype( typed_value ) >;
+
+                if constexpr ( is_blob_type< value_type >::value )
+                {
+                    return nullopt;
+                }
+                else
+                {
+                    return pack_inline( value.index(), typed_value );
+                }
+            }, value );
+        }
+
+
         /** Unpack value
 
         @param [in] f - file to be used
@@ -335,15 +844,48 @@ namespace jb
             return unpack< 0 >( f );
         }
 
+
+        /** Applies numeric operation to inline value
+
+        @param [in] op - operation
+        @param [in] operand - operand of the same type as the value
+        @param [in] expected - value expected by NumericOp::CompareExchange, ignored by others
+        @retval bool - false if NumericOp::CompareExchange found unexpected value
+        @retval Value - the value before the operation
+        @retval PackedValue - updated value
+        @throw btree_error
+        */
+        std::tuple< bool, Value, PackedValue > apply( NumericOp op, const Value & operand, const Value & expected ) const
+        {
+            return update_numeric< 0 >( op, operand, expected );
+        }
+
+
+        /** Provides streaming reader over BLOB value
+
+        @param [in] f - file to be used
+        @retval BlobReader - reader object
+        @throw btree_error, storage_file_error
+        */
+        BlobReader make_reader( StorageFile & f ) const
+        {
+            auto element_size = streamed_element_size< 0 >();
+            throw_btree_error( element_size != 0, RetCode::InvalidData, "The value cannot be streamed" );
+
+            return BlobReader( f, value_, element_size );
+        }
+
         
         /** Erases associated BLOB
 
+        Shared BLOB loses a reference and is erased only with the last one
+
         @param [in] t - transaction
         @throw storage_file_error
         */
         void erase_blob( Transaction & t ) const
         {
-            if ( check_for_blob< 0 >() )
+            if ( check_for_blob< 0 >() && t.release_blob( value_ ) )
             {
                 t.erase_chain( value_ );
             }
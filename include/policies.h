@@ -4,6 +4,8 @@
 
 #include <variant>
 #include <string>
+#include <vector>
+#include <cstddef>
 #include "windows_policy.h"
 
 
@@ -14,7 +16,16 @@ namespace jb
     {
         using KeyChar = char;
         using KeyCharTraits = std::char_traits< KeyChar >;
-        using Value = std::variant< uint32_t, uint64_t, float, double, std::string >;
+        using Value = std::variant<
+            uint32_t,
+            uint64_t,
+            float,
+            double,
+            std::string,
+            std::vector< std::byte >,
+            std::vector< float >,
+            std::vector< double >
+        >;
 
         struct VirtualVolumePolicy
         {
@@ -31,15 +42,39 @@ namespace jb
 
             static constexpr size_t BloomSize = 16 * ( 1 << 20 );   /*!< size of memory block to be used by Bloom filter */
 
-            static constexpr size_t BTreeMinPower = 128;           /*!< B-tree factor, each B-tree node (except root) MUST contains at least
-                                                                        such number of elements */
+            static constexpr size_t BTreeMinPower = 128;           /*!< B-tree factor of new files, each B-tree node (except root) MUST contains
+                                                                        at least such number of elements */
+            static constexpr size_t BTreeMaxPower = 128;            /*!< maximum B-tree factor of a file, sizes in-memory b-tree nodes. The factor
+                                                                        is chosen when a file is created, BTreeMinPower is the default */
             static constexpr size_t BTreeMaxDepth = 64;             /*!< maximum depth of BTree, we need this constant only to avoid heap usage
                                                                         and to allocate memory on stack. In reality the limitation by
                                                                         BTreeMinPower ^ BTreeDepth subkeys per each key looks enough */
             static constexpr size_t BTreeCacheSize = 1024;          /*!< capacity of BTree MRU cache */
+            static constexpr size_t BTreeDirtyLimit = 0;            /*!< maximum number of b-tree nodes modified in memory only and awaiting
+                                                                        for write-back, bounds data loss on crash, 0 means write-through */
+            static constexpr size_t BTreeFlushPeriod = 100;         /*!< period of write-back flushing in msecs */
+            static constexpr size_t BTreeBulkLoadFill = 90;         /*!< fill factor of b-tree nodes built by bulk load, in percents */
+            static constexpr bool BTreeTopDown = false;             /*!< b-tree insertion and erasing go from the root down once, splitting
+                                                                        full nodes and topping up minimal ones on the way */
+            static constexpr bool BTreeEytzinger = false;           /*!< b-tree nodes keep additional copy of digests in Eytzinger order in
+                                                                        memory, search goes through it with prefetching */
+            static constexpr size_t BTreeHotLevels = 2;             /*!< number of upper levels of pinned b-tree kept as read-only snapshot,
+                                                                        the nodes stay in the cache, so BTreeCacheSize must allow them */
+            static constexpr size_t BTreeReclaimBatch = 64;         /*!< maximum number of detached b-tree nodes released by one background
+                                                                        transaction */
+            static constexpr bool BTreeLazyErase = false;           /*!< erasing which would restructure b-tree only marks the element as
+                                                                        a tombstone, background maintenance collapses tombstones later */
+            static constexpr size_t BTreeCollapseBatch = 64;        /*!< maximum number of tombstones collapsed by one background transaction */
+            static constexpr bool ExpirationIndex = false;          /*!< subkeys with expiration mark are registered in persistent index ordered
+                                                                        by expiration, background reaper erases expired ones */
+            static constexpr size_t ExpirationReapBatch = 256;      /*!< maximum number of expired subkeys erased by one background pass */
+            static constexpr size_t BTreeCombineBatch = 128;        /*!< maximum number of combined modifications applied by one transaction */
 
             static constexpr size_t ChunkSize = 4096;               /*!< size of chunk in storage file */
+            static constexpr size_t BlobDedupThreshold = 4096;      /*!< BLOBs of such size in bytes and larger are shared between equal
+                                                                        values, 0 disables deduplication */
             static constexpr size_t ReaderNumber = 32;              /*!< maximum number of parallel readings */
+            static constexpr size_t PreservedChunkNumber = 16;      /*!< maximum number of chains overwritten in place by one transaction */
         };
 
         using Os = OsPolicy;
@@ -34,7 +34,8 @@ namespace jb
         InvalidData,            ///< Data read from storage file is invalid
         InsufficientMemory,     ///< Operation failed due to low memory
         UnknownError,           ///< Something wrong happened
-        NotYetImplemented
+        NotYetImplemented,
+        TypeMismatch            ///< Value type does not suit the operation
     };
 
     static constexpr auto Ok = RetCode::Ok;
@@ -65,6 +66,7 @@ namespace jb
     static constexpr auto InsufficientMemory = RetCode::InsufficientMemory;
     static constexpr auto UnknownError = RetCode::UnknownError;
     static constexpr auto NotYetImplemented = RetCode::NotYetImplemented;
+    static constexpr auto TypeMismatch = RetCode::TypeMismatch;
 }
 
 #endif
\ No newline at end of file
@@ -3,6 +3,7 @@
 
 
 #include "ret_codes.h"
+#include "value_span.h"
 #include "details/physical_volume.h"
 #include "details/virtual_volume.h"
 #include <mutex>
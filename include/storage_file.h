@@ -12,6 +12,9 @@
 #include <mutex>
 #include <condition_variable>
 #include <streambuf>
+#include <typeindex>
+
+#include "details/variadic_hash.h"
 
 #include <boost/container/static_vector.hpp>
 #include <boost/interprocess/sync/named_mutex.hpp>
@@ -53,7 +56,13 @@ namespace jb
         static constexpr auto MaxTreeDepth = Policies::PhysicalVolumePolicy::MaxTreeDepth;
         static constexpr auto ReaderNumber = Policies::PhysicalVolumePolicy::ReaderNumber;
         static constexpr auto BTreeMinPower = Policies::PhysicalVolumePolicy::BTreeMinPower;
+        static constexpr auto BTreeMaxPower = Policies::PhysicalVolumePolicy::BTreeMaxPower;
+        static_assert( 2 <= BTreeMinPower && BTreeMinPower <= BTreeMaxPower, "Default b-tree power must fit the maximum" );
         static constexpr auto ChunkSize = Policies::PhysicalVolumePolicy::ChunkSize;
+        static constexpr auto PreservedChunkNumber = Policies::PhysicalVolumePolicy::PreservedChunkNumber;
+        static_assert( PreservedChunkNumber > 0, "At least one preserved chunk is required" );
+
+        static constexpr uint64_t FormatVersion = 2;    //< version of data layout
 
         using io_buffer_t = std::array< char, ChunkSize >;
         using streamer_t = std::pair < Handle, std::reference_wrapper< io_buffer_t > >;
@@ -85,7 +94,21 @@ namespace jb
         //
         // needs access to private read_chunk()
         //
-        template < typename CharT > class istreambuf;
+        template < typename CharT > friend class istreambuf;
+
+
+        //
+        // index of deduplicated BLOBs
+        //
+        class BlobIndex;
+
+        /* Detached b-tree node pending reclamation and root of its b-tree
+        */
+        struct DetachedNode
+        {
+            ChunkUid uid_;
+            ChunkUid root_;
+        };
 
 
         // status
@@ -101,6 +124,9 @@ namespace jb
         io_buffer_t write_buffer_;
         streamer_t writer_;
 
+        // b-tree power of the file
+        size_t btree_power_;
+
         // bloom writer
         Handle bloom_ = InvalidHandle;
 
@@ -111,6 +137,11 @@ namespace jb
         using reader_stack_t = std::stack< streamer_t, static_vector< streamer_t, ReaderNumber > >;
         reader_stack_t reader_stack_;
 
+        // deduplicated BLOBs, detached b-trees, and expiration index as of the last commit, modified under write lock only
+        BlobIndex blob_index_;
+        std::vector< DetachedNode > detached_;
+        ChunkUid expiration_root_ = InvalidChunkUid;
+
 
         //
         // defines chunk structure
@@ -153,6 +184,7 @@ namespace jb
         struct header_t
         {
             big_uint64_t compatibility_stamp;         //< software compatibility stamp
+            big_uint64_t btree_power_;                //< b-tree power chosen on creation of the file
 
             uint8_t bloom_[ BloomSize ];              //< bloom filter data
 
@@ -160,6 +192,9 @@ namespace jb
             {
                 big_uint64_t file_size_;              //< current file size
                 big_uint64_t free_space_;             //< pointer to first free chunk (garbage collector)
+                big_uint64_t blob_index_;             //< newest chain of BLOB index journal
+                big_uint64_t detached_;               //< chain of detached b-trees list
+                big_uint64_t expiration_root_;        //< root of expiration index b-tree
             };
 
             transactional_data_t transactional_data_; //< original copy
@@ -171,7 +206,7 @@ namespace jb
                 big_uint64_t target_;                 //< target chunk uid
                 chunk_t chunk_;                       //< preserved chunk
             };
-            preserved_chunk_t overwritten__chunk_;    //< let us make one writing per transaction with preservation of original chunk uid
+            preserved_chunk_t preserved_chunks_[ PreservedChunkNumber ];  //< let us make several overwritings per transaction with preservation of original chunk uids
         };
 
 
@@ -180,11 +215,20 @@ namespace jb
         //
         enum TransactionDataOffsets
         {
-            of_FileSize = offsetof( header_t::transactional_data_t, file_size_ ),
+            of_FileSize = offsetof( typename header_t::transactional_data_t, file_size_ ),
             sz_FileSize = sizeof( header_t::transactional_data_t::file_size_ ),
 
-            of_FreeSpace = offsetof( header_t::transactional_data_t, free_space_ ),
+            of_FreeSpace = offsetof( typename header_t::transactional_data_t, free_space_ ),
             sz_FreeSpace = sizeof( header_t::transactional_data_t::free_space_ ),
+
+            of_BlobIndex = offsetof( typename header_t::transactional_data_t, blob_index_ ),
+            sz_BlobIndex = sizeof( header_t::transactional_data_t::blob_index_ ),
+
+            of_Detached = offsetof( typename header_t::transactional_data_t, detached_ ),
+            sz_Detached = sizeof( header_t::transactional_data_t::detached_ ),
+
+            of_ExpirationRoot = offsetof( typename header_t::transactional_data_t, expiration_root_ ),
+            sz_ExpirationRoot = sizeof( header_t::transactional_data_t::expiration_root_ ),
         };
 
 
@@ -193,10 +237,10 @@ namespace jb
         //
         enum PreservedChunkOffsets
         {
-            of_Target = offsetof( header_t::preserved_chunk_t, target_ ),
+            of_Target = offsetof( typename header_t::preserved_chunk_t, target_ ),
             sz_Target = sizeof( header_t::preserved_chunk_t::target_ ),
 
-            of_Chunk = offsetof( header_t::preserved_chunk_t, chunk_ ),
+            of_Chunk = offsetof( typename header_t::preserved_chunk_t, chunk_ ),
             sz_Chunk = sizeof( header_t::preserved_chunk_t::chunk_ )
         };
 
@@ -209,6 +253,9 @@ namespace jb
             of_CompatibilityStamp = offsetof( header_t, compatibility_stamp ),
             sz_CompatibilityStamp = sizeof( header_t::compatibility_stamp ),
 
+            of_BTreePower = offsetof( header_t, btree_power_ ),
+            sz_BTreePower = sizeof( header_t::btree_power_ ),
+
             of_Bloom = offsetof( header_t, bloom_ ),
             sz_Bloom = sizeof( header_t::bloom_ ),
 
@@ -221,8 +268,8 @@ namespace jb
             of_TransactionCrc = offsetof( header_t, transaction_crc_ ),
             sz_TransactionCrc = sizeof( header_t::transaction_crc_ ),
 
-            of_PreservedChunk = offsetof( header_t, overwritten__chunk_ ),
-            sz_PreservedChunk = sizeof( header_t::overwritten__chunk_ ),
+            of_PreservedChunk = offsetof( header_t, preserved_chunks_ ),
+            sz_PreservedChunk = sizeof( typename header_t::preserved_chunk_t ),
 
             of_Root = sizeof( header_t )
         };
@@ -287,6 +334,17 @@ namespace jb
         }
 
 
+        /* Checks if b-tree power fits node containers
+
+        @param [in] power - b-tree power
+        @throw storage_file_error
+        */
+        static void check_btree_power( size_t power )
+        {
+            throw_storage_file_error( 2 <= power && power <= BTreeMaxPower, RetCode::IncompatibleFile, "Invalid b-tree power" );
+        }
+
+
         /* Generates compatibility stamp basing on the system policies
 
         @retval unique stamp of software settings
@@ -295,7 +353,7 @@ namespace jb
         static uint64_t generate_compatibility_stamp() noexcept
         {
             using namespace std;
-            auto hash = variadic_hash( type_index( typeid( Key ) ), type_index( typeid( ValueT ) ), BloomSize, MaxTreeDepth, BTreeMinPower, ChunkSize );
+            auto hash = details::variadic_hash( FormatVersion, type_index( typeid( Key ) ), type_index( typeid( ValueT ) ), BloomSize, MaxTreeDepth, ChunkSize, PreservedChunkNumber );
             return hash;
         }
 
@@ -323,6 +381,20 @@ namespace jb
             }
 
             throw_storage_file_error( stamp == generate_compatibility_stamp(), RetCode::IncompatibleFile );
+
+            // the power of the file must fit node containers
+            big_uint64_t power;
+            {
+                auto[ ok, pos ] = Os::seek_file( handle, HeaderOffsets::of_BTreePower );
+                throw_storage_file_error( ok && pos == HeaderOffsets::of_BTreePower, RetCode::IoError );
+            }
+            {
+                auto[ ok, read ] = Os::read_file( handle, &power, sizeof( power ) );
+                throw_storage_file_error( ok && read == sizeof( power ), RetCode::IoError );
+            }
+
+            check_btree_power( static_cast< size_t >( power ) );
+            btree_power_ = static_cast< size_t >( power );
         }
 
 
@@ -356,6 +428,18 @@ namespace jb
                 throw_storage_file_error( ok && written == sizeof( stamp ), RetCode::IoError );
             }
 
+            // write b-tree power
+            {
+                auto[ ok, pos ] = Os::seek_file( handle, HeaderOffsets::of_BTreePower );
+                throw_storage_file_error( ok && pos == HeaderOffsets::of_BTreePower, RetCode::IoError );
+            }
+            {
+                big_uint64_t power = btree_power_;
+
+                auto[ ok, written ] = Os::write_file( handle, &power, sizeof( power ) );
+                throw_storage_file_error( ok && written == sizeof( power ), RetCode::IoError );
+            }
+
             // write file size
             {
                 auto[ ok, pos ] = Os::seek_file( handle, HeaderOffsets::of_TransactionalData + TransactionDataOffsets::of_FileSize );
@@ -379,13 +463,27 @@ namespace jb
                 throw_storage_file_error( ok && written == sizeof( free_space ), RetCode::IoError );
             }
 
+            // invalidate BLOB index, detached b-trees, and expiration index
+            {
+                auto[ ok, pos ] = Os::seek_file( handle, HeaderOffsets::of_TransactionalData + TransactionDataOffsets::of_BlobIndex );
+                throw_storage_file_error( ok && pos == HeaderOffsets::of_TransactionalData + TransactionDataOffsets::of_BlobIndex, RetCode::IoError );
+            }
+            {
+                big_uint64_t indices[] = { InvalidChunkUid, InvalidChunkUid, InvalidChunkUid };
+                static_assert( TransactionDataOffsets::of_Detached == TransactionDataOffsets::of_BlobIndex + sizeof( big_uint64_t ), "Unexpected layout" );
+                static_assert( TransactionDataOffsets::of_ExpirationRoot == TransactionDataOffsets::of_Detached + sizeof( big_uint64_t ), "Unexpected layout" );
+
+                auto[ ok, written ] = Os::write_file( handle, indices, sizeof( indices ) );
+                throw_storage_file_error( ok && written == sizeof( indices ), RetCode::IoError );
+            }
+
             // invalidate transaction
             {
                 auto[ ok, pos ] = Os::seek_file( handle, HeaderOffsets::of_TransactionCrc );
                 throw_storage_file_error( ok && pos == HeaderOffsets::of_TransactionCrc, RetCode::IoError );
             }
             {
-                boost::endian::big_uint64_t invalid_crc = variadic_hash( HeaderOffsets::of_Root, InvalidChunkUid ) + 1;
+                boost::endian::big_uint64_t invalid_crc = details::variadic_hash( HeaderOffsets::of_Root, InvalidChunkUid, InvalidChunkUid, InvalidChunkUid, InvalidChunkUid ) + 1;
 
                 auto[ ok, written ] = Os::write_file( handle, &invalid_crc, sizeof( invalid_crc ) );
                 throw_storage_file_error( ok && written == sizeof( invalid_crc ), RetCode::IoError );
@@ -393,6 +491,21 @@ namespace jb
         }
 
 
+        /* Computes CRC of transactional data
+
+        @param [in] data - transactional data
+        @retval uint64_t - CRC
+        @throw nothing
+        */
+        static uint64_t transaction_hash( const typename header_t::transactional_data_t & data ) noexcept
+        {
+            uint64_t file_size = data.file_size_, free_space = data.free_space_, blob_index = data.blob_index_;
+            uint64_t detached = data.detached_, expiration_root = data.expiration_root_;
+
+            return details::variadic_hash( file_size, free_space, blob_index, detached, expiration_root );
+        }
+
+
         /* Commit transaction
 
         Applies all the changes that have been done during last successful transaction
@@ -408,7 +521,7 @@ namespace jb
             throw_logic_error( InvalidHandle != handle, "Invalid file handle" );
 
             // read transaction data
-            header_t::transactional_data_t transaction;
+            typename header_t::transactional_data_t transaction;
             {
                 auto[ ok, pos ] = Os::seek_file( handle, HeaderOffsets::of_Transaction );
                 throw_storage_file_error( ok && pos == HeaderOffsets::of_Transaction, RetCode::IoError );
@@ -430,32 +543,38 @@ namespace jb
             }
 
             // validate transaction
-            uint64_t file_size = transaction.file_size_, free_space = transaction.free_space_;
-            auto valid_transaction = ( transaction_crc == variadic_hash( file_size, free_space ) );
+            auto valid_transaction = ( transaction_crc == transaction_hash( transaction ) );
 
             // if we have valid transaction
             if ( valid_transaction )
             {
-                // read preserved chunk target
-                big_uint64_t preserved_target;
+                // restore preserved chunks
+                for ( size_t slot = 0; slot < PreservedChunkNumber; ++slot )
                 {
-                    auto[ ok, pos ] = Os::seek_file( handle, HeaderOffsets::of_PreservedChunk + PreservedChunkOffsets::of_Target );
-                    throw_storage_file_error( ok && pos == HeaderOffsets::of_PreservedChunk + PreservedChunkOffsets::of_Target, RetCode::IoError );
-                }
+                    const uint64_t slot_offset = HeaderOffsets::of_PreservedChunk + slot * HeaderOffsets::sz_PreservedChunk;
 
-                {
-                    auto[ ok, read ] = Os::read_file( handle, &preserved_target, sizeof( preserved_target ) );
-                    throw_storage_file_error( ok && read == sizeof( preserved_target ), RetCode::IoError );
-                }
+                    // read preserved chunk target
+                    big_uint64_t preserved_target;
+                    {
+                        auto[ ok, pos ] = Os::seek_file( handle, slot_offset + PreservedChunkOffsets::of_Target );
+                        throw_storage_file_error( ok && pos == slot_offset + PreservedChunkOffsets::of_Target, RetCode::IoError );
+                    }
+                    {
+                        auto[ ok, read ] = Os::read_file( handle, &preserved_target, sizeof( preserved_target ) );
+                        throw_storage_file_error( ok && read == sizeof( preserved_target ), RetCode::IoError );
+                    }
+
+                    // slots are occupied sequentially
+                    if ( preserved_target == InvalidChunkUid )
+                    {
+                        break;
+                    }
 
-                // if there is preserved chunk
-                if ( preserved_target != InvalidChunkUid )
-                {
                     // read preserved chunk
                     chunk_t preserved_chunk;
                     {
-                        auto[ ok, pos ] = Os::seek_file( handle, HeaderOffsets::of_PreservedChunk + PreservedChunkOffsets::of_Chunk );
-                        throw_storage_file_error( ok && pos == HeaderOffsets::of_PreservedChunk + PreservedChunkOffsets::of_Chunk, RetCode::IoError );
+                        auto[ ok, pos ] = Os::seek_file( handle, slot_offset + PreservedChunkOffsets::of_Chunk );
+                        throw_storage_file_error( ok && pos == slot_offset + PreservedChunkOffsets::of_Chunk, RetCode::IoError );
                     }
                     {
                         auto[ ok, read ] = Os::read_file( handle, &preserved_chunk, sizeof( preserved_chunk ) );
@@ -489,8 +608,7 @@ namespace jb
                     throw_storage_file_error( ok && pos == HeaderOffsets::of_TransactionCrc, RetCode::IoError );
                 }
                 {
-                    uint64_t file_size = transaction.file_size_, free_space = transaction.free_space_;
-                    boost::endian::big_uint64_t invalid_crc = variadic_hash( file_size, free_space ) + 1;
+                    boost::endian::big_uint64_t invalid_crc = transaction_hash( transaction ) + 1;
 
                     auto[ ok, written ] = Os::write_file( handle, &invalid_crc, sizeof( invalid_crc ) );
                     throw_storage_file_error( ok && written == sizeof( invalid_crc ), RetCode::IoError );
@@ -535,6 +653,117 @@ namespace jb
         }
 
 
+        /* Loads index of deduplicated BLOBs, list of detached b-trees, and root of expiration index
+
+        BLOB index is stored as a journal, the newest chain refers to the previous one down to the
+        snapshot, so the chains are collected first and then loaded from the oldest one
+
+        @throw storage_file_error
+        @note function does not imply concurrent execution
+        */
+        auto load_indices()
+        {
+            using namespace std;
+
+            throw_logic_error( RetCode::Ok == status_, "Invalid file object" );
+
+            Handle handle = writer_.first;
+            throw_logic_error( InvalidHandle != handle, "Invalid file handle" );
+
+            typename header_t::transactional_data_t data;
+            {
+                auto[ ok, pos ] = Os::seek_file( handle, HeaderOffsets::of_TransactionalData );
+                throw_storage_file_error( ok && pos == HeaderOffsets::of_TransactionalData, RetCode::IoError );
+            }
+            {
+                auto[ ok, read ] = Os::read_file( handle, &data, sizeof( data ) );
+                throw_storage_file_error( ok && read == sizeof( data ), RetCode::IoError );
+            }
+
+            // collect journal of BLOB index
+            vector< ChunkUid > journal;
+
+            for ( ChunkUid chain = data.blob_index_; InvalidChunkUid != chain; )
+            {
+                throw_storage_file_error( HeaderOffsets::of_Root <= chain && journal.size() * sizeof( chunk_t ) < data.file_size_, RetCode::InvalidData, "Broken BLOB index" );
+                journal.push_back( chain );
+
+                auto buffer = get_chain_reader< char >( chain );
+                istream is( &buffer );
+
+                auto[ ok, previous, snapshot ] = BlobIndex::load_header( is );
+                throw_storage_file_error( ok, RetCode::InvalidData, "Unable to read BLOB index" );
+
+                chain = snapshot ? InvalidChunkUid : previous;
+            }
+
+            for ( auto chain = journal.rbegin(); chain != journal.rend(); ++chain )
+            {
+                auto buffer = get_chain_reader< char >( *chain );
+                istream is( &buffer );
+                throw_storage_file_error( blob_index_.load( is, *chain ), RetCode::InvalidData, "Unable to read BLOB index" );
+            }
+
+            // load detached b-trees
+            if ( InvalidChunkUid != data.detached_ )
+            {
+                auto buffer = get_chain_reader< char >( data.detached_ );
+                istream is( &buffer );
+                throw_storage_file_error( load_detached( is, detached_ ), RetCode::InvalidData, "Unable to read detached b-trees" );
+            }
+
+            expiration_root_ = data.expiration_root_;
+        }
+
+
+        /* Serializes list of detached b-trees
+
+        @param [in/out] os - output stream
+        @param [in] detached - detached nodes
+        @retval bool - if the operation succeeded
+        @throw may throw what underlaying stream buffer does
+        */
+        static bool save_detached( std::ostream & os, const std::vector< DetachedNode > & detached )
+        {
+            big_uint64_t count = detached.size();
+            os.write( reinterpret_cast< const char* >( &count ), sizeof( count ) );
+
+            for ( const auto & node : detached )
+            {
+                big_uint64_t record[] = { node.uid_, node.root_ };
+                os.write( reinterpret_cast< const char* >( record ), sizeof( record ) );
+            }
+
+            return os.good();
+        }
+
+
+        /* Deserializes list of detached b-trees
+
+        @param [in/out] is - input stream
+        @param [out] detached - detached nodes
+        @retval bool - if the operation succeeded
+        @throw std::bad_alloc, may throw what underlaying stream buffer does
+        */
+        static bool load_detached( std::istream & is, std::vector< DetachedNode > & detached )
+        {
+            detached.clear();
+
+            big_uint64_t count;
+            if ( !is.read( reinterpret_cast< char* >( &count ), sizeof( count ) ) ) return false;
+
+            for ( uint64_t i = 0; i < count; ++i )
+            {
+                big_uint64_t record[ 2 ];
+                if ( !is.read( reinterpret_cast< char* >( record ), sizeof( record ) ) ) return false;
+
+                detached.push_back( DetachedNode{ record[ 0 ], record[ 1 ] } );
+            }
+
+            return true;
+        }
+
+
         /* Reads another chunk of a chain
 
         @param [in] handle - file handle to be used
@@ -592,6 +821,47 @@ namespace jb
         }
 
 
+        /* Reads header of a chunk without reading its data
+
+        Let us skip through a chain without transferring data that is not needed
+
+        @param [in] handle - file handle to be used
+        @param [in] chunk - uid of chunk
+        @retval size_t - number of utilized bytes in the chunk
+        @retval ChunkUid - the next chunk in the chain
+        @throw storage_file_error
+        */
+        [[ nodiscard ]]
+        std::tuple< size_t, ChunkUid > read_chunk_header( Handle handle, ChunkUid chunk )
+        {
+            throw_logic_error( RetCode::Ok == status_, "Invalid file object" );
+            throw_logic_error( InvalidHandle != handle, "Invalid file handle" );
+            throw_logic_error( InvalidChunkUid != chunk && chunk >= HeaderOffsets::of_Root, "Invalid chunk" );
+
+            // used size and next used are neighbours, so read them at once
+            static_assert( ChunkOffsets::of_NextUsed == ChunkOffsets::of_UsedSize + ChunkOffsets::sz_UsedSize, "Unexpected chunk layout" );
+
+            struct
+            {
+                boost::endian::big_uint32_t used_size_;     // unaligned types keep the struct packed
+                boost::endian::big_uint64_t next_used_;
+            } header;
+
+            static_assert( sizeof( header ) == ChunkOffsets::sz_UsedSize + ChunkOffsets::sz_NextUsed, "Unexpected chunk header layout" );
+
+            {
+                auto[ ok, pos ] = Os::seek_file( handle, chunk + ChunkOffsets::of_UsedSize );
+                throw_storage_file_error( ok && pos == chunk + ChunkOffsets::of_UsedSize, RetCode::IoError );
+            }
+            {
+                auto[ ok, read ] = Os::read_file( handle, &header, sizeof( header ) );
+                throw_storage_file_error( ok && read == sizeof( header ), RetCode::IoError );
+            }
+
+            return { static_cast< size_t >( header.used_size_ ), static_cast< ChunkUid >( header.next_used_ ) };
+        }
+
+
     public:
 
         /** The class is not default creatable/copyable/movable
@@ -602,15 +872,29 @@ namespace jb
 
         /** Constructs an instance
 
-        @param [in] path - path to physical file@param [in] suppress_lock - do not lock the file (test mode)
+        @param [in] path - path to physical file
+        @param [in] suppress_lock - do not lock the file (test mode)
+        @param [in] btree_power - b-tree power for newly created file, existing file keeps its own
         @throw nothing
         */
-        explicit StorageFile( const std::filesystem::path & path, bool suppress_lock = false ) noexcept try
+        explicit StorageFile( const std::filesystem::path & path, bool suppress_lock = false, size_t btree_power = BTreeMinPower ) noexcept try
             : file_lock_name_( "jb_lock_" + std::to_string( std::filesystem::hash_value( path ) ) )
             , writer_( InvalidHandle, std::ref( write_buffer_ ) )
+            , btree_power_( btree_power )
         {
             using namespace std;
 
+            // check requested b-tree power
+            try
+            {
+                check_btree_power( btree_power_ );
+            }
+            catch ( const storage_file_error & e )
+            {
+                status_ = e.code();
+                return;
+            }
+
             //
             // Unfortunately MS does not care about standards as usual and HANDLED exceptions easily leaves
             // try-catch constructors by an rethrow. That is why I have to use such workaround
@@ -667,6 +951,9 @@ namespace jb
 
                 reader_stack_.push( streamer_t{ handle, ref( read_buffers_[ i ] ) } );
             }
+
+            // load index of deduplicated BLOBs, detached b-trees, and expiration index
+            if ( !newly_created_ ) load_indices();
         }
         catch ( const storage_file_error & e )
         {
@@ -729,6 +1016,40 @@ namespace jb
         auto newly_created() const noexcept { return newly_created_; }
 
 
+        /** Provides b-tree power of the file
+
+        @retval size_t - minimum number of links of non-root b-tree node
+        @throw nothing
+        */
+        auto btree_power() const noexcept { return btree_power_; }
+
+
+        /** Provides root of expiration index b-tree as of the last commit
+
+        @retval ChunkUid - uid of root node or InvalidChunkUid if the index is not created yet
+        @throw nothing
+        @note must not be called by a thread holding a transaction
+        */
+        auto expiration_index() const noexcept
+        {
+            std::lock_guard< std::mutex > lock( write_mutex_ );
+            return expiration_root_;
+        }
+
+
+        /** Provides number of detached b-tree nodes pending reclamation as of the last commit
+
+        @retval size_t - number of nodes
+        @throw nothing
+        @note must not be called by a thread holding a transaction
+        */
+        auto detached_btrees() const noexcept
+        {
+            std::lock_guard< std::mutex > lock( write_mutex_ );
+            return detached_.size();
+        }
+
+
         /** Reads data for Bloom filter
 
         @param [out] bloom_buffer - target buffer for Bloom data
@@ -800,7 +1121,7 @@ namespace jb
             using namespace std;
 
             throw_logic_error( RetCode::Ok == status_, "Invalid file" );
-            return Transaction{ *this, move( writer_ ), move( unique_lock{ write_mutex_ } ) };
+            return Transaction{ *this, writer_, unique_lock{ write_mutex_ } };
         }
 
 
@@ -833,6 +1154,7 @@ namespace jb
 
 #include "transaction.h"
 #include "streambufs.h"
+#include "blob_index.h"
 
 
 #endif
@@ -5,6 +5,9 @@
 #include <streambuf>
 #include <limits>
 #include <type_traits>
+#include <tuple>
+#include <algorithm>
+#include <assert.h>
 
 #ifndef BOOST_ENDIAN_DEPRECATED_NAMES
 #define BOOST_ENDIAN_DEPRECATED_NAMES
@@ -123,7 +126,7 @@ namespace jb
             // initialize pointer like all data is currently read-out
             auto start = buffer_.data();
             auto end = start + BufferSize;
-            setg( start, end, end );
+            this->setg( start, end, end );
         }
 
         //
@@ -140,9 +143,9 @@ namespace jb
             }
 
             // we still have something to get
-            if ( gptr() < egptr() )
+            if ( this->gptr() < this->egptr() )
             {
-                return *gptr();
+                return traits_type::to_int_type( *this->gptr() );
             }
 
             if ( InvalidChunkUid == current_chunk_ )
@@ -207,12 +210,12 @@ namespace jb
             }
 
             // set pointers
-            setg( buffer_.data(), buffer_.data(), buffer_.data() + read_chars );
+            this->setg( buffer_.data(), buffer_.data(), buffer_.data() + read_chars );
 
             // return char if available
             if ( read_chars > 0 )
             {
-                return *gptr();
+                return traits_type::to_int_type( *this->gptr() );
             }
             else
             {
@@ -221,6 +224,33 @@ namespace jb
         }
 
 
+        //
+        // bulk reading: copies data chunk by chunk instead of character by character extraction
+        //
+        virtual std::streamsize xsgetn( CharT * s, std::streamsize count ) override
+        {
+            using namespace std;
+
+            streamsize copied = 0;
+
+            while ( copied < count )
+            {
+                // refill buffer if it's exhausted
+                if ( this->gptr() == this->egptr() && traits_type::eq_int_type( underflow(), traits_type::eof() ) )
+                {
+                    break;
+                }
+
+                auto available = min< streamsize >( this->egptr() - this->gptr(), count - copied );
+                traits_type::copy( s + copied, this->gptr(), static_cast< size_t >( available ) );
+                this->gbump( static_cast< int >( available ) );
+                copied += available;
+            }
+
+            return copied;
+        }
+
+
     public:
 
         /** The class is not default creatable/copyable
@@ -236,6 +266,78 @@ namespace jb
         istreambuf & operator = ( istreambuf&& ) = default;
 
 
+        /** Provides data currently available in the buffer, reads next chunk if the buffer is exhausted
+
+        @retval const CharT* - pointer to available data
+        @retval size_t - number of available characters, 0 means end of chain
+        @throw storage_file_error
+        */
+        std::tuple< const CharT*, size_t > fetch()
+        {
+            if ( this->gptr() == this->egptr() && traits_type::eq_int_type( underflow(), traits_type::eof() ) )
+            {
+                return { nullptr, 0 };
+            }
+
+            return { this->gptr(), static_cast< size_t >( this->egptr() - this->gptr() ) };
+        }
+
+
+        /** Marks given number of fetched characters as consumed
+
+        @param [in] count - number of characters, must not exceed what fetch() provided
+        @throw nothing
+        */
+        void consume( size_t count ) noexcept
+        {
+            assert( count <= static_cast< size_t >( this->egptr() - this->gptr() ) );
+            this->gbump( static_cast< int >( count ) );
+        }
+
+
+        /** Skips given number of characters
+
+        Whole chunks are skipped by reading their headers only, so the data before desired position
+        is not transferred
+
+        @param [in] count - number of characters to be skipped
+        @retval uint64_t - number of actually skipped characters, less than count means end of chain
+        @throw storage_file_error
+        */
+        uint64_t skip( uint64_t count )
+        {
+            using namespace std;
+
+            // consume buffered data
+            uint64_t skipped = min< uint64_t >( static_cast< uint64_t >( this->egptr() - this->gptr() ), count );
+            this->gbump( static_cast< int >( skipped ) );
+
+            // skip whole chunks that precede desired position
+            while ( skipped < count && InvalidChunkUid != current_chunk_ )
+            {
+                auto[ used_size, next_chunk ] = file_.read_chunk_header( handle_, current_chunk_ );
+                auto chars = static_cast< uint64_t >( used_size / sizeof( StoredType ) );
+
+                // the position is inside this chunk
+                if ( skipped + chars > count ) break;
+
+                skipped += chars;
+                current_chunk_ = next_chunk;
+            }
+
+            // move to the position inside current chunk
+            if ( skipped < count )
+            {
+                auto[ data, available ] = fetch();
+                auto rest = min< uint64_t >( count - skipped, available );
+                consume( static_cast< size_t >( rest ) );
+                skipped += rest;
+            }
+
+            return skipped;
+        }
+
+
         /** Destructor, releases allocated handle
 
         @throw nothing
@@ -284,7 +386,7 @@ namespace jb
         {
             auto const start = buffer_.data();
             auto const end = start + BufferSize;
-            setp( start, end - 1 );
+            this->setp( start, end - 1 );
         }
 
     protected:
@@ -296,8 +398,8 @@ namespace jb
         {
             if ( c != traits_type::eof() )
             {
-                *pptr() = c;
-                pbump( 1 );
+                *this->pptr() = c;
+                this->pbump( 1 );
                 return sync() == 0 ? c : traits_type::eof();
             }
             return traits_type::eof();
@@ -311,13 +413,13 @@ namespace jb
             using namespace std;
 
             // nothing to write
-            if ( pptr() == pbase() )
+            if ( this->pptr() == this->pbase() )
             {
                 return 0;
             }
 
-            assert( pptr() - pbase() > 0 );
-            size_t elements_to_write = static_cast< size_t >( pptr() - pbase() );
+            assert( this->pptr() - this->pbase() > 0 );
+            size_t elements_to_write = static_cast< size_t >( this->pptr() - this->pbase() );
             size_t elements_written = 0;
 
             if constexpr ( is_same_v< CharT, StoredType > )
@@ -350,7 +452,7 @@ namespace jb
 
             if ( elements_written )
             {
-                pbump( -static_cast< int >( elements_written ) );
+                this->pbump( -static_cast< int >( elements_written ) );
                 return 0;
             }
             {
@@ -359,6 +461,33 @@ namespace jb
         }
 
 
+        //
+        // bulk writing: fills the buffer by whole pieces and sends it to transaction when it's full
+        //
+        virtual std::streamsize xsputn( const CharT * s, std::streamsize count ) override
+        {
+            using namespace std;
+
+            streamsize written = 0;
+
+            while ( written < count )
+            {
+                // flush buffer if it's full
+                if ( this->pptr() == this->epptr() && sync() != 0 )
+                {
+                    break;
+                }
+
+                auto room = min< streamsize >( this->epptr() - this->pptr(), count - written );
+                traits_type::copy( this->pptr(), s + written, static_cast< size_t >( room ) );
+                this->pbump( static_cast< int >( room ) );
+                written += room;
+            }
+
+            return written;
+        }
+
+
     public:
 
         /** Default constructor, creates dummy buffer
@@ -3,6 +3,11 @@
 
 
 #include <mutex>
+#include <optional>
+#include <algorithm>
+#include <vector>
+#include <functional>
+#include <memory>
 
 #ifndef BOOST_ENDIAN_DEPRECATED_NAMES
 #define BOOST_ENDIAN_DEPRECATED_NAMES
@@ -43,12 +48,18 @@ namespace jb
         streamer_t & writer_;
         uint64_t file_size_;
         ChunkUid free_space_;
+        ChunkUid blob_index_chain_;
+        bool blob_index_snapshot_ = false;
+        ChunkUid detached_chain_;
+        std::optional< std::vector< DetachedNode > > detached_;
+        ChunkUid expiration_root_;
         ChunkUid released_head_ = InvalidChunkUid, released_tile_ = InvalidChunkUid;
         ChunkUid first_written_chunk = InvalidChunkUid;
         ChunkUid last_written_chunk_ = InvalidChunkUid;
-        ChunkUid overwritten_chunk_ = InvalidChunkUid;
-        bool overwriting_used_ = false;
+        static_vector< ChunkUid, PreservedChunkNumber > overwritten_chunks_;
         bool overwriting_first_chunk_ = false;
+        std::vector< std::function< void() > > rollback_actions_;
+        std::vector< std::shared_ptr< const void > > kept_;
         bool commited_ = false;
 
 
@@ -107,7 +118,21 @@ namespace jb
             }
             free_space_ = free_space;
 
-            // invalidate preserved chunk
+            // ... and BLOB index, detached b-trees, and expiration index
+            big_uint64_t indices[ 3 ];
+            {
+                auto[ ok, pos ] = Os::seek_file( handle, HeaderOffsets::of_TransactionalData + TransactionDataOffsets::of_BlobIndex );
+                throw_storage_file_error( ok && pos == HeaderOffsets::of_TransactionalData + TransactionDataOffsets::of_BlobIndex, RetCode::IoError );
+            }
+            {
+                auto[ ok, read ] = Os::read_file( handle, indices, sizeof( indices ) );
+                throw_storage_file_error( ok && read == sizeof( indices ), RetCode::IoError );
+            }
+            blob_index_chain_ = indices[ 0 ];
+            detached_chain_ = indices[ 1 ];
+            expiration_root_ = indices[ 2 ];
+
+            // invalidate preserved chunks, the slots are occupied sequentially so the first one is enough
             {
                 auto[ ok, pos ] = Os::seek_file( handle, HeaderOffsets::of_PreservedChunk + PreservedChunkOffsets::of_Target );
                 throw_storage_file_error( ok && pos == HeaderOffsets::of_PreservedChunk + PreservedChunkOffsets::of_Target, RetCode::IoError );
@@ -120,6 +145,18 @@ namespace jb
         }
 
 
+        /* Provides offset of preserved chunk slot in the header
+
+        @param [in] slot - slot number
+        @retval uint64_t - offset of the slot
+        @throw nothing
+        */
+        static constexpr uint64_t preserved_slot_offset( size_t slot ) noexcept
+        {
+            return HeaderOffsets::of_PreservedChunk + slot * HeaderOffsets::sz_PreservedChunk;
+        }
+
+
         /* Provides next available chunk uid
 
         @retval uint64_t - next available chunk
@@ -138,7 +175,7 @@ namespace jb
             // if preserved writting: return reserved chunk offset
             if ( overwriting_first_chunk_ )
             {
-                available_chunk = HeaderOffsets::of_PreservedChunk + PreservedChunkOffsets::of_Chunk;
+                available_chunk = preserved_slot_offset( overwritten_chunks_.size() - 1 ) + PreservedChunkOffsets::of_Chunk;
                 overwriting_first_chunk_ = false;
             }
             // if there is free space
@@ -177,6 +214,86 @@ namespace jb
         }
 
 
+        /* Provides list of detached b-trees to be modified by the transaction
+
+        The list is copied on first modification, so the file keeps original list untill commit
+
+        @retval std::vector< DetachedNode >& - transactional copy of the list
+        @throw std::bad_alloc
+        */
+        std::vector< DetachedNode > & detached()
+        {
+            if ( !detached_ ) detached_.emplace( file_.detached_ );
+            return *detached_;
+        }
+
+
+        /* Persists modifications of BLOB index
+
+        Appends the modifications to the index journal or, if the journal outgrows the index, writes
+        the index as a snapshot and releases the journal
+
+        @throw storage_file_error
+        */
+        void save_blob_index()
+        {
+            auto & index = file_.blob_index_;
+
+            index.prepare_commit();
+
+            blob_index_snapshot_ = index.compaction_due();
+
+            auto buffer = get_chain_writer< char >();
+            std::ostream os( &buffer );
+
+            if ( blob_index_snapshot_ )
+            {
+                const bool written = index.save_snapshot( os );
+                os.flush();
+                throw_storage_file_error( os.good(), RetCode::IoError );
+
+                blob_index_chain_ = written ? get_first_written_chunk() : InvalidChunkUid;
+
+                for ( auto chain : index.stored() ) erase_chain( chain );
+            }
+            else
+            {
+                index.save_journal( os );
+                os.flush();
+                throw_storage_file_error( os.good(), RetCode::IoError );
+
+                blob_index_chain_ = get_first_written_chunk();
+            }
+        }
+
+
+        /* Writes modified list of detached b-trees to new chain and releases the old one
+
+        @throw storage_file_error
+        */
+        void save_detached()
+        {
+            auto old_chain = detached_chain_;
+
+            if ( detached_->empty() )
+            {
+                detached_chain_ = InvalidChunkUid;
+            }
+            else
+            {
+                auto buffer = get_chain_writer< char >();
+                std::ostream os( &buffer );
+
+                throw_storage_file_error( StorageFile::save_detached( os, *detached_ ), RetCode::IoError );
+                os.flush();
+
+                detached_chain_ = get_first_written_chunk();
+            }
+
+            if ( InvalidChunkUid != old_chain ) erase_chain( old_chain );
+        }
+
+
         /* Writes data coming from output stream
 
         @param [in] buffer - buffer to be written
@@ -277,19 +394,64 @@ namespace jb
 
         /** Destructor
 
-        Rolls back uncomited transaction and releases write lock over the file
+        Rolls back uncomited transaction, does registered rollback actions, and releases write lock
+        over the file
 
         @throw nothing
         */
         ~Transaction()
         {
-            if ( !commited_ ) file_.rollback();
+            // moved-out object owns nothing
+            if ( commited_ || !write_lock_.owns_lock() ) return;
+
+            file_.rollback();
+            file_.blob_index_.rollback();
+
+            for ( auto action = rollback_actions_.rbegin(); action != rollback_actions_.rend(); ++action )
+            {
+                ( *action )();
+            }
+        }
+
+
+        /** Registers an action to be done after the transaction is rolled back
+
+        Lets the caller restore memory state depending on the file when the file is already restored.
+        The actions are done in reverse order of registration, commit forgets them
+
+        @param [in] action - action to be done, must not throw
+        @throw std::bad_alloc
+        */
+        void on_rollback( std::function< void() > action )
+        {
+            throw_logic_error( !commited_, "Transaction is already finalized" );
+
+            rollback_actions_.push_back( std::move( action ) );
+        }
+
+
+        /** Keeps an object alive till the transaction is finalized
+
+        The file provides overwritten chains as they were till the commit, so a cached object
+        holding new content must not be dropped and reloaded meanwhile
+
+        @param [in] object - object to be kept
+        @throw std::bad_alloc
+        */
+        void keep( std::shared_ptr< const void > object )
+        {
+            throw_logic_error( !commited_, "Transaction is already finalized" );
+
+            kept_.push_back( std::move( object ) );
         }
 
 
         /** Provides streaming buffer for overwriting of existing chain with preservation of start chunk uid
 
         @tparam CharT - type of character to be used by stream
+        Each chain can be overwritten once per transaction, the number of overwritings per transaction
+        is limited by the number of preserved chunks
+
         @param [in] uid - uid of chain to be overwritten
         @retval output stream buffer object
         @throw storage_file_error
@@ -297,35 +459,52 @@ namespace jb
         template< typename CharT >
         ostreambuf< CharT > get_chain_overwriter( ChunkUid uid )
         {
+            using namespace std;
+
             throw_logic_error( RetCode::Ok == file_.status(), "Invalid file" );
             throw_logic_error( !commited_, "Transaction is already finalized" );
-            throw_logic_error( !overwriting_used_, "Overwriting already used" );
+            throw_logic_error( overwritten_chunks_.size() < PreservedChunkNumber, "Overwriting limit exceeded" );
+            throw_logic_error( find( begin( overwritten_chunks_ ), end( overwritten_chunks_ ), uid ) == end( overwritten_chunks_ ), "The chain is already overwritten" );
 
             Handle & handle = writer_.first;
             throw_logic_error( InvalidHandle != handle, "Invalid file handle" );
 
             // initializing
-            overwriting_used_ = true;
+            const auto slot = overwritten_chunks_.size();
+            overwritten_chunks_.push_back( uid );
             overwriting_first_chunk_ = true;
-            overwritten_chunk_ = uid;
             first_written_chunk = last_written_chunk_ = InvalidChunkUid;
 
             // write uid to be overwritten
             {
-                auto[ ok, pos ] = Os::seek_file( handle, HeaderOffsets::of_PreservedChunk + PreservedChunkOffsets::of_Target );
-                throw_storage_file_error( ok && pos == HeaderOffsets::of_PreservedChunk + PreservedChunkOffsets::of_Target, RetCode::IoError );
+                auto[ ok, pos ] = Os::seek_file( handle, preserved_slot_offset( slot ) + PreservedChunkOffsets::of_Target );
+                throw_storage_file_error( ok && pos == preserved_slot_offset( slot ) + PreservedChunkOffsets::of_Target, RetCode::IoError );
             }
             {
-                big_uint64_t preserved_chunk = overwritten_chunk_;
+                big_uint64_t preserved_chunk = uid;
                 auto[ ok, written ] = Os::write_file( handle, &preserved_chunk, sizeof( preserved_chunk ) );
                 throw_storage_file_error( ok && written == sizeof( preserved_chunk ), RetCode::IoError );
             }
 
+            // terminate sequence of occupied slots
+            if ( slot + 1 < PreservedChunkNumber )
+            {
+                {
+                    auto[ ok, pos ] = Os::seek_file( handle, preserved_slot_offset( slot + 1 ) + PreservedChunkOffsets::of_Target );
+                    throw_storage_file_error( ok && pos == preserved_slot_offset( slot + 1 ) + PreservedChunkOffsets::of_Target, RetCode::IoError );
+                }
+                {
+                    big_uint64_t target = InvalidChunkUid;
+                    auto[ ok, written ] = Os::write_file( handle, &target, sizeof( target ) );
+                    throw_storage_file_error( ok && written == sizeof( target ), RetCode::IoError );
+                }
+            }
+
             // mark 2nd and futher chunks of overwritten chain as released
             big_uint64_t second_chunk;
             {
-                auto[ ok, pos ] = Os::seek_file( handle, overwritten_chunk_ + ChunkOffsets::of_NextUsed );
-                throw_storage_file_error( ok && pos == overwritten_chunk_ + ChunkOffsets::of_NextUsed, RetCode::IoError );
+                auto[ ok, pos ] = Os::seek_file( handle, uid + ChunkOffsets::of_NextUsed );
+                throw_storage_file_error( ok && pos == uid + ChunkOffsets::of_NextUsed, RetCode::IoError );
             }
             {
                 auto[ ok, read ] = Os::read_file( handle, &second_chunk, sizeof( second_chunk ) );
@@ -350,6 +529,7 @@ namespace jb
             throw_logic_error( RetCode::Ok == file_.status(), "Invalid file" );
             throw_logic_error( !commited_, "Transaction is already finalized" );
 
+            overwriting_first_chunk_ = false;
             first_written_chunk = last_written_chunk_ = InvalidChunkUid;
 
             // provide streambuf object
@@ -357,6 +537,17 @@ namespace jb
         }
 
 
+        /** Provides number of overwritings available for the transaction
+
+        @retval size_t - number of chains that still can be overwritten
+        @throw nothing
+        */
+        auto overwritings_left() const noexcept
+        {
+            return PreservedChunkNumber - overwritten_chunks_.size();
+        }
+
+
         /** Provides uid of the first chunk in written chain
 
         @retval ChunkUid - uid of the first written chunk
@@ -371,6 +562,190 @@ namespace jb
         }
 
 
+        /** Provides streaming buffer for reading a chain
+
+        Let us check content of already stored data during the transaction
+
+        @tparam CharT - type of character to be used by stream
+        @param [in] chain - uid of start chunk of chain to be read
+        @retval input stream buffer object
+        @throw storage_file_error
+        */
+        template < typename CharT >
+        auto get_chain_reader( ChunkUid chain )
+        {
+            throw_logic_error( !commited_, "Transaction is already finalized" );
+
+            return file_.get_chain_reader< CharT >( chain );
+        }
+
+
+        /** Looks for stored BLOB with the same content
+
+        @tparam F - predicate type, callable as bool f( ChunkUid )
+        @param [in] digest - content digest
+        @param [in] equal - compares content of candidate chain with the value to be stored
+        @retval ChunkUid - uid of found chain or InvalidChunkUid
+        @throw storage_file_error, may throw what the predicate does
+        */
+        template < typename F >
+        ChunkUid find_blob( uint64_t digest, F && equal ) const
+        {
+            throw_logic_error( !commited_, "Transaction is already finalized" );
+
+            return file_.blob_index_.find( digest, std::forward< F >( equal ) );
+        }
+
+
+        /** Registers just written chain as shareable BLOB
+
+        @param [in] digest - content digest
+        @param [in] chain - uid of the chain
+        @throw std::bad_alloc
+        */
+        void add_blob( uint64_t digest, ChunkUid chain )
+        {
+            throw_logic_error( !commited_, "Transaction is already finalized" );
+
+            file_.blob_index_.insert( digest, chain );
+        }
+
+
+        /** Adds a reference to shared BLOB
+
+        @param [in] chain - uid of the chain
+        @throw std::bad_alloc
+        */
+        void acquire_blob( ChunkUid chain )
+        {
+            throw_logic_error( !commited_, "Transaction is already finalized" );
+
+            file_.blob_index_.acquire( chain );
+        }
+
+
+        /** Drops a reference to BLOB chain
+
+        @param [in] chain - uid of the chain
+        @retval bool - true if the chain is not referenced anymore and must be erased
+        @throw std::bad_alloc
+        */
+        bool release_blob( ChunkUid chain )
+        {
+            throw_logic_error( !commited_, "Transaction is already finalized" );
+
+            // not shared chain belongs to single value
+            if ( !file_.blob_index_.contains( chain ) ) return true;
+
+            return file_.blob_index_.release( chain );
+        }
+
+
+        /** Registers detached b-tree to be reclaimed later
+
+        @param [in] root - uid of root node of the b-tree
+        @throw std::bad_alloc
+        */
+        void detach_btree( ChunkUid root )
+        {
+            detach_node( root, root );
+        }
+
+
+        /** Registers detached node of b-tree to be reclaimed later
+
+        The root is kept with the node, so reclamation knows which b-tree the node belonged to
+
+        @param [in] uid - uid of the node
+        @param [in] root - uid of root node of the b-tree
+        @throw std::bad_alloc
+        */
+        void detach_node( ChunkUid uid, ChunkUid root )
+        {
+            throw_logic_error( !commited_, "Transaction is already finalized" );
+
+            detached().push_back( DetachedNode{ uid, root } );
+        }
+
+
+        /** Returns detached b-tree node that cannot be reclaimed yet
+
+        The node goes to the head of the list, so it is taken after the other ones
+
+        @param [in] node - the node
+        @throw std::bad_alloc
+        */
+        void defer_detached_btree( const DetachedNode & node )
+        {
+            throw_logic_error( !commited_, "Transaction is already finalized" );
+
+            auto & list = detached();
+            list.insert( list.begin(), node );
+        }
+
+
+        /** Takes detached b-tree nodes for reclamation
+
+        The caller is responsible to release the nodes and to detach their children within the same
+        transaction
+
+        @param [in] limit - maximum number of nodes to be taken
+        @retval std::vector< DetachedNode > - taken nodes
+        @throw std::bad_alloc
+        */
+        std::vector< DetachedNode > take_detached_btrees( size_t limit )
+        {
+            throw_logic_error( !commited_, "Transaction is already finalized" );
+
+            using namespace std;
+
+            if ( !detached_btrees() ) return {};
+
+            // take from the end, so children detached by reclamation of their parent are taken first
+            auto & list = detached();
+            const auto count = min( limit, list.size() );
+            vector< DetachedNode > taken( list.end() - count, list.end() );
+            list.resize( list.size() - count );
+
+            return taken;
+        }
+
+
+        /** Provides number of detached b-tree nodes pending reclamation
+
+        @retval size_t - number of nodes
+        @throw nothing
+        */
+        auto detached_btrees() const noexcept
+        {
+            return detached_ ? detached_->size() : file_.detached_.size();
+        }
+
+
+        /** Provides root of expiration index b-tree
+
+        @retval ChunkUid - uid of root node or InvalidChunkUid if the index is not created yet
+        @throw nothing
+        */
+        auto expiration_index() const noexcept
+        {
+            return expiration_root_;
+        }
+
+
+        /** Registers root of expiration index b-tree
+
+        @param [in] root - uid of root node
+        @throw std::bad_alloc
+        */
+        void set_expiration_index( ChunkUid root )
+        {
+            throw_logic_error( !commited_, "Transaction is already finalized" );
+
+            expiration_root_ = root;
+        }
+
+
         /** Marks a chain started from given chunk as released
 
         @param [in] chunk - staring chunk
@@ -445,6 +820,10 @@ namespace jb
             Handle & handle = writer_.first;
             throw_logic_error( InvalidHandle != handle, "Invalid file handle" );
 
+            // persist modified indices, they may release old chains, so do it first
+            if ( file_.blob_index_.modified() ) save_blob_index();
+            if ( detached_ ) save_detached();
+
             // if there is released space - glue released chunks with remaining free space
             if ( released_head_ != InvalidChunkUid )
             {
@@ -455,7 +834,7 @@ namespace jb
                     throw_storage_file_error( ok && pos == released_tile_ + ChunkOffsets::of_NextFree, RetCode::IoError );
                 }
                 {
-                    big_uint64_t next_free = InvalidChunkUid;
+                    big_uint64_t next_free = free_space_;
                     auto[ ok, written ] = Os::write_file( handle, &next_free, sizeof( next_free ) );
                     throw_storage_file_error( ok && written == sizeof( next_free ), RetCode::IoError );
                 }
@@ -463,7 +842,7 @@ namespace jb
             }
 
             // write transaction
-            header_t::transactional_data_t transaction{ file_size_, free_space_ };
+            typename header_t::transactional_data_t transaction{ file_size_, free_space_, blob_index_chain_, detached_chain_, expiration_root_ };
 
             {
                 auto[ ok, pos ] = Os::seek_file( handle, HeaderOffsets::of_Transaction );
@@ -480,7 +859,7 @@ namespace jb
                 throw_storage_file_error( ok && pos == HeaderOffsets::of_TransactionCrc, RetCode::IoError );
             }
             {
-                boost::endian::big_uint64_t crc = variadic_hash( ( uint64_t )transaction.file_size_, ( uint64_t )transaction.free_space_ );
+                boost::endian::big_uint64_t crc = StorageFile::transaction_hash( transaction );
                 auto[ ok, written ] = Os::write_file( handle, &crc, sizeof( crc ) );
                 throw_storage_file_error( ok && written == sizeof( crc ), RetCode::IoError );
             }
@@ -492,8 +871,15 @@ namespace jb
             // force file to apply commit
             file_.commit();
 
+            // publish modified indices
+            if ( file_.blob_index_.modified() ) file_.blob_index_.commit( blob_index_chain_, blob_index_snapshot_ );
+            if ( detached_ ) file_.detached_ = std::move( *detached_ );
+            file_.expiration_root_ = expiration_root_;
+
             // mark transaction as commited
             commited_ = true;
+            rollback_actions_.clear();
+            kept_.clear();
         }
     };
 }
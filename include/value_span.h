@@ -0,0 +1,40 @@
+#ifndef __JB__VALUE_SPAN__H__
+#define __JB__VALUE_SPAN__H__
+
+
+#include <variant>
+#include <boost/range/iterator_range.hpp>
+
+
+namespace jb
+{
+    /** Provides contiguous view over array-like alternative of a value
+
+    Gives direct access to elements of raw byte and numeric arrays (as well as to characters of
+    strings) without copying and per element conversion. If the value does not hold requested
+    alternative the function returns empty range
+
+    @tparam ArrayT - array-like alternative, e.g. std::vector< float >
+    @tparam Value - variant type
+    @param [in] value - value to be viewed
+    @retval boost::iterator_range - range of array elements, valid until the value is modified
+    @throw nothing
+    */
+    template < typename ArrayT, typename Value >
+    auto value_span( const Value & value ) noexcept
+    {
+        using element_type = typename ArrayT::value_type;
+        using range_type = boost::iterator_range< const element_type * >;
+
+        if ( auto array = std::get_if< ArrayT >( &value ) )
+        {
+            return range_type{ array->data(), array->data() + array->size() };
+        }
+        else
+        {
+            return range_type{};
+        }
+    }
+}
+
+#endif
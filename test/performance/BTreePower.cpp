@@ -0,0 +1,27 @@
+#include "test.h"
+#include <policies.h>
+
+
+using namespace std;
+
+
+template < size_t CacheSize >
+struct BTreePower : public ::jb::DefaultPolicy<>
+{
+    struct PhysicalVolumePolicy : public ::jb::DefaultPolicy<>::PhysicalVolumePolicy
+    {
+        static constexpr size_t BloomSize = 1 << 20;
+        static constexpr size_t BTreeMaxPower = 128;
+        static constexpr size_t BTreeCacheSize = CacheSize;
+    };
+};
+
+
+void b_tree_power_test()
+{
+    // the power is chosen per file, each power keeps its own cache size
+    performance_test< BTreePower< 128 > >( 16 );
+    performance_test< BTreePower< 32 > >( 32 );
+    performance_test< BTreePower< 32 > >( 64 );
+    performance_test< BTreePower< 32 > >( 128 );
+}
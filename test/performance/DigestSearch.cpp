@@ -0,0 +1,105 @@
+#include <details/digest_search.h>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <chrono>
+
+
+using namespace std;
+
+
+// keeps the searches from being optimized out
+static volatile size_t sink;
+
+
+/* Measures average time of a search
+
+@param [in] name - search method name
+@param [in] count - number of searches per round
+@param [in] search - search method, callable as search( i ) for i-th search
+*/
+template < typename F >
+static void measure( const char * name, size_t count, F search )
+{
+    static constexpr size_t Rounds = 100;
+
+    size_t checksum = 0;
+
+    const auto start = chrono::high_resolution_clock::now();
+
+    for ( size_t round = 0; round < Rounds; ++round )
+    {
+        for ( size_t i = 0; i < count; ++i ) checksum += search( i );
+    }
+
+    const auto end = chrono::high_resolution_clock::now();
+    const auto ns = chrono::duration_cast< chrono::nanoseconds >( end - start ).count() / static_cast< double >( Rounds * count );
+
+    sink = checksum;
+
+    cout << "    " << name << ": " << ns << " ns" << endl;
+}
+
+
+void digest_search_test()
+{
+    static constexpr size_t NodeNumber = 4096;
+    static constexpr size_t KeyNumber = 100000;
+
+    cout << endl;
+    cout << "************************************************************" << endl;
+    cout << endl;
+    cout << "In-node digest search" << endl;
+    cout << endl;
+    cout << "************************************************************" << endl;
+
+    mt19937_64 rnd( 1 );
+
+    for ( size_t power : { 16, 32, 64, 128 } )
+    {
+        // full nodes, many of them, so the searches go through cold cache lines as in real b-tree
+        const size_t node_size = 2 * power - 1;
+
+        vector< uint64_t > sorted( NodeNumber * node_size );
+        generate( begin( sorted ), end( sorted ), [&] { return rnd(); } );
+
+        vector< uint64_t > layout( sorted.size() );
+        vector< uint16_t > ranks( sorted.size() );
+
+        for ( size_t n = 0; n < NodeNumber; ++n )
+        {
+            auto node = sorted.data() + n * node_size;
+            sort( node, node + node_size );
+            jb::details::eytzinger_layout( node, node_size, layout.data() + n * node_size, ranks.data() + n * node_size );
+        }
+
+        vector< uint64_t > keys( KeyNumber );
+        vector< size_t > nodes( KeyNumber );
+        for ( size_t i = 0; i < KeyNumber; ++i )
+        {
+            nodes[ i ] = rnd() % NodeNumber;
+            keys[ i ] = sorted[ nodes[ i ] * node_size + rnd() % node_size ];
+        }
+
+        cout << endl << "B-tree power " << power << ", " << node_size << " digests per node:" << endl;
+
+        measure( "std::lower_bound", KeyNumber, [&] ( size_t i ) {
+            const auto node = sorted.data() + nodes[ i ] * node_size;
+            return static_cast< size_t >( lower_bound( node, node + node_size, keys[ i ] ) - node );
+        } );
+
+        measure( "SIMD linear count", KeyNumber, [&] ( size_t i ) {
+            return jb::details::count_less( sorted.data() + nodes[ i ] * node_size, node_size, keys[ i ] );
+        } );
+
+        measure( "branchless + SIMD", KeyNumber, [&] ( size_t i ) {
+            return jb::details::digest_lower_bound( sorted.data() + nodes[ i ] * node_size, node_size, keys[ i ] );
+        } );
+
+        measure( "Eytzinger + prefetch", KeyNumber, [&] ( size_t i ) {
+            const auto offset = nodes[ i ] * node_size;
+            return jb::details::eytzinger_lower_bound( layout.data() + offset, ranks.data() + offset, node_size, keys[ i ] );
+        } );
+    }
+}
@@ -4,7 +4,7 @@
 #include <storage.h>
 
 
-template < typename Policy > void performance_test()
+template < typename Policy > void performance_test( size_t btree_power = Policy::PhysicalVolumePolicy::BTreeMinPower )
 {
     using Storage = ::jb::Storage< Policy >;
     using RetCode = typename Storage::RetCode;
@@ -17,7 +17,7 @@ template < typename Policy > void performance_test()
     std::cout << std::endl;
     std::cout << "Performance test with the following parameters:" << std::endl;
     std::cout << std::endl;
-    std::cout << "B-tree power: " << Policy::PhysicalVolumePolicy::BTreeMinPower << std::endl;
+    std::cout << "B-tree power: " << btree_power << std::endl;
     std::cout << "B-tree cache size: " << Policy::PhysicalVolumePolicy::BTreeCacheSize << " node" << std::endl;
     std::cout << "Storage file chunk size: " << Policy::PhysicalVolumePolicy::ChunkSize << " bytes" << std::endl;
     std::cout << "Bloom filter size: " << Policy::PhysicalVolumePolicy::BloomSize << " bytes" << std::endl;
@@ -36,7 +36,7 @@ template < typename Policy > void performance_test()
 
     cleanup();
 
-    auto[ rc, pv ] = Storage::OpenPhysicalVolume( "Performance.jb" );
+    auto[ rc, pv ] = Storage::OpenPhysicalVolume( "Performance.jb", 0, btree_power );
     assert( RetCode::Ok == rc );
 
     auto[ rc1, vv ] = Storage::OpenVirtualVolume();
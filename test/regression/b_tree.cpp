@@ -0,0 +1,1414 @@
+#include "physical_volume_impl.h"
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+#include <optional>
+#include <limits>
+#include <random>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <set>
+
+
+namespace jb
+{
+    template < typename Policies >
+    class TestBTree : public ::testing::Test
+    {
+    protected:
+
+        using Impl = typename Storage< Policies >::PhysicalVolumeImpl;
+        using StorageFile = typename Impl::StorageFile;
+        using BTree = typename Impl::BTree;
+        using BTreeCache = typename Impl::BTreeCache;
+        using BTreeP = typename BTree::BTreeP;
+        using BTreePath = typename BTree::BTreePath;
+        using Digest = typename Impl::Bloom::Digest;
+        using Key = typename Storage< Policies >::Key;
+        using Value = typename Storage< Policies >::Value;
+        using NodeUid = typename BTree::NodeUid;
+
+        static constexpr auto RootNodeUid = BTree::RootNodeUid;
+        static constexpr auto InvalidNodeUid = BTree::InvalidNodeUid;
+
+        std::filesystem::path path_;
+        std::unique_ptr< StorageFile > file_;
+        std::unique_ptr< BTreeCache > cache_;
+
+
+        void SetUp() override
+        {
+            path_ = ::testing::UnitTest::GetInstance()->current_test_info()->name();
+            MemoryFilePolicy::remove_file( path_ );
+
+            open();
+
+            // deploy root b-tree as physical volume does
+            BTree root( *file_, *cache_ );
+            auto t = file_->open_transaction();
+            root.save( t );
+            t.commit();
+
+            ASSERT_EQ( RootNodeUid, root.uid() );
+        }
+
+
+        void TearDown() override
+        {
+            close();
+            MemoryFilePolicy::remove_file( path_ );
+        }
+
+
+        void open()
+        {
+            file_ = std::make_unique< StorageFile >( path_, true );
+            ASSERT_EQ( RetCode::Ok, file_->status() );
+
+            cache_ = std::make_unique< BTreeCache >( *file_ );
+            ASSERT_EQ( RetCode::Ok, cache_->status() );
+        }
+
+
+        void close()
+        {
+            cache_.reset();
+            file_.reset();
+        }
+
+
+        void reopen()
+        {
+            close();
+            open();
+        }
+
+
+        /* Starts the test again with empty b-tree
+        */
+        void reopen_empty()
+        {
+            close();
+            MemoryFilePolicy::remove_file( path_ );
+            SetUp();
+        }
+
+
+        BTreeP root()
+        {
+            return cache_->get_node( RootNodeUid );
+        }
+
+
+        static Key name( Digest digest )
+        {
+            return std::to_string( digest );
+        }
+
+
+        void insert( Digest digest, const Value & value, bool overwrite = false )
+        {
+            root()->insert_subkey( digest, name( digest ), value, 0, overwrite );
+        }
+
+
+        bool erase( Digest digest )
+        {
+            return root()->erase_subkey( digest );
+        }
+
+
+        auto packed( Digest digest )
+        {
+            BTreePath bpath;
+            EXPECT_TRUE( root()->find_digest( digest, bpath ) );
+
+            auto node = cache_->get_node( bpath.back().first );
+            return node->elements_[ bpath.back().second ].value_;
+        }
+
+
+        /* Checks b-tree invariants, returns number of elements
+        */
+        size_t validate()
+        {
+            return validate( root() );
+        }
+
+
+        size_t validate( const BTreeP & tree )
+        {
+            std::optional< size_t > leaf_depth;
+            return validate( *tree, 0, leaf_depth, 0, std::numeric_limits< Digest >::max() );
+        }
+
+
+        size_t validate( const BTree & node, size_t depth, std::optional< size_t > & leaf_depth, Digest low, Digest high )
+        {
+            const auto & elements = node.elements_;
+            const auto & links = node.links_;
+
+            EXPECT_EQ( elements.size() + 1, links.size() );
+            EXPECT_LT( elements.size(), node.btree_max_ );
+            if ( depth ) { EXPECT_GE( elements.size(), node.btree_min_ ); }
+
+            for ( size_t i = 0; i < elements.size(); ++i )
+            {
+                EXPECT_LE( low, elements[ i ].digest_ );
+                EXPECT_GE( high, elements[ i ].digest_ );
+                if ( i ) { EXPECT_LT( elements[ i - 1 ].digest_, elements[ i ].digest_ ); }
+            }
+
+            size_t count = elements.size();
+
+            if ( node.is_leaf() )
+            {
+                if ( !leaf_depth ) leaf_depth = depth;
+                EXPECT_EQ( *leaf_depth, depth );
+            }
+            else
+            {
+                for ( size_t i = 0; i < links.size(); ++i )
+                {
+                    auto child = cache_->get_node( links[ i ] );
+                    count += validate( *child, depth + 1, leaf_depth, i ? elements[ i - 1 ].digest_ : low, i < elements.size() ? elements[ i ].digest_ : high );
+                }
+            }
+
+            return count;
+        }
+
+
+        /* Provides number of elements of a node as it's stored in the file
+        */
+        size_t stored_size( NodeUid uid )
+        {
+            BTree node( *file_, *cache_ );
+            node.load( uid );
+            return node.elements_.size();
+        }
+
+
+        /* Provides children b-tree of a subkey, deploys the b-tree if missing
+        */
+        BTreeP children( Digest digest )
+        {
+            return children( root(), digest );
+        }
+
+
+        BTreeP children( const BTreeP & tree, Digest digest )
+        {
+            BTreePath bpath;
+            EXPECT_TRUE( tree->find_digest( digest, bpath ) );
+
+            auto node = cache_->get_node( bpath.back().first );
+            auto & e = node->elements_[ bpath.back().second ];
+
+            if ( InvalidNodeUid == e.children_ )
+            {
+                BTree children( *file_, *cache_ );
+                auto t = file_->open_transaction();
+                children.save( t );
+                e.children_ = children.uid();
+                node->overwrite( t );
+                t.commit();
+            }
+
+            return cache_->get_node( e.children_ );
+        }
+
+
+        /* Provides root uid of children b-tree of a subkey of root b-tree
+        */
+        NodeUid children_uid( Digest digest )
+        {
+            BTreePath bpath;
+            EXPECT_TRUE( root()->find_digest( digest, bpath ) );
+
+            return cache_->get_node( bpath.back().first )->elements_[ bpath.back().second ].children_;
+        }
+
+
+        /* Provides node and position of a subkey of root b-tree
+        */
+        std::pair< BTreeP, typename BTree::Pos > locate( Digest digest )
+        {
+            BTreePath bpath;
+            EXPECT_TRUE( root()->find_digest( digest, bpath ) );
+
+            return { cache_->get_node( bpath.back().first ), bpath.back().second };
+        }
+
+
+        /* Provides number of tombstones left by lazy erasing in root b-tree
+        */
+        size_t tombstones()
+        {
+            auto tree = root();
+
+            // background collapsing takes exclusive key lock
+            boost::shared_lock< boost::upgrade_mutex > key{ tree->guard() };
+            return tombstones( *tree );
+        }
+
+
+        size_t tombstones( const BTree & node )
+        {
+            size_t count = std::count_if( node.elements_.begin(), node.elements_.end(), [] ( const auto & e ) { return BTree::Tombstone == e.good_before_; } );
+
+            if ( !node.is_leaf() )
+            {
+                for ( auto link : node.links_ ) count += tombstones( *cache_->get_node( link ) );
+            }
+
+            return count;
+        }
+
+
+        /* Checks if a subkey of root b-tree is left as a tombstone
+        */
+        bool buried( Digest digest )
+        {
+            auto[ node, pos ] = locate( digest );
+            return BTree::Tombstone == node->elements_[ pos ].good_before_;
+        }
+
+
+        /* Provides the first digest of root b-tree from given one on which is stored in inner node
+        */
+        Digest inner( Digest digest, Digest step )
+        {
+            while ( locate( digest ).first->is_leaf() ) digest += step;
+            return digest;
+        }
+
+
+        /* Waits till background maintenance collapses all the tombstones
+        */
+        void wait_collapsed()
+        {
+            const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds( 10 );
+            while ( tombstones() && std::chrono::steady_clock::now() < deadline )
+            {
+                std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+            }
+
+            EXPECT_EQ( 0, tombstones() );
+        }
+
+
+        /* Provides number of detached b-tree nodes awaiting reclamation
+        */
+        size_t detached()
+        {
+            return file_->open_transaction().detached_btrees();
+        }
+
+
+        /* Waits till background reclamation releases all detached b-trees
+        */
+        void wait_reclaimed()
+        {
+            const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds( 10 );
+            while ( detached() && std::chrono::steady_clock::now() < deadline )
+            {
+                std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+            }
+
+            EXPECT_EQ( 0, detached() );
+        }
+
+
+        /* Provides references of expiration index entries: b-tree root, subkey digest, expiration mark
+        */
+        auto expirations()
+        {
+            std::set< std::tuple< NodeUid, Digest, uint64_t > > entries;
+            if ( InvalidNodeUid != file_->expiration_index() ) collect_expirations( *cache_->get_node( file_->expiration_index() ), entries );
+            return entries;
+        }
+
+
+        void collect_expirations( const BTree & node, std::set< std::tuple< NodeUid, Digest, uint64_t > > & entries )
+        {
+            for ( const auto & e : node.elements_ )
+            {
+                auto reference = BTree::parse_expiration_entry_name( e.name_ );
+                EXPECT_TRUE( reference );
+                if ( reference ) entries.insert( *reference );
+            }
+
+            if ( node.is_leaf() ) return;
+
+            for ( auto link : node.links_ ) collect_expirations( *cache_->get_node( link ), entries );
+        }
+
+
+        size_t file_size()
+        {
+            auto[ guard, files ] = MemoryFilePolicy::files();
+            std::lock_guard< std::mutex > lock( guard );
+
+            auto & file = *files.at( path_.string() );
+            std::lock_guard< std::mutex > file_lock( file.guard_ );
+            return file.data_.size();
+        }
+
+
+        std::optional< Value > get( Digest digest )
+        {
+            BTreePath bpath;
+            if ( !root()->find_digest( digest, bpath ) ) return std::nullopt;
+
+            auto node = cache_->get_node( bpath.back().first );
+            return node->value( bpath.back().second );
+        }
+    };
+
+
+    using TestPolicies = ::testing::Types<
+        TestPolicy< 2 >,
+        TestPolicy< 5 >
+    >;
+
+    TYPED_TEST_SUITE( TestBTree, TestPolicies );
+
+
+    TYPED_TEST( TestBTree, StringValues )
+    {
+        using Value = typename TestFixture::Value;
+
+        const std::vector< std::string > strings{
+            "",
+            "single",
+            "with whitespaces\tand\nnew lines",
+            std::string( "with\0zero", 9 ),
+            std::string( 1000, 'x' ),
+            std::string( 100000, 'y' )
+        };
+
+        for ( size_t i = 0; i < strings.size(); ++i ) this->insert( i + 1, Value{ strings[ i ] } );
+
+        for ( size_t pass = 0; pass < 2; ++pass )
+        {
+            for ( size_t i = 0; i < strings.size(); ++i )
+            {
+                auto value = this->get( i + 1 );
+                ASSERT_TRUE( value );
+                EXPECT_EQ( Value{ strings[ i ] }, *value );
+            }
+
+            // the values are read from the file
+            this->reopen();
+        }
+    }
+
+
+    TYPED_TEST( TestBTree, InlineValues )
+    {
+        using Value = typename TestFixture::Value;
+
+        const std::vector< Value > values{
+            Value{ uint32_t{ 7 } },
+            Value{ uint64_t{ 1ULL << 40 } },
+            Value{ 1.5f },
+            Value{ -2.25 }
+        };
+
+        for ( size_t i = 0; i < values.size(); ++i ) this->insert( i + 1, values[ i ] );
+
+        this->reopen();
+
+        for ( size_t i = 0; i < values.size(); ++i )
+        {
+            auto value = this->get( i + 1 );
+            ASSERT_TRUE( value );
+            EXPECT_EQ( values[ i ], *value );
+        }
+    }
+
+
+    TYPED_TEST( TestBTree, OverwriteString )
+    {
+        using Value = typename TestFixture::Value;
+
+        this->insert( 1, Value{ std::string( 5000, 'a' ) } );
+        EXPECT_THROW( this->insert( 1, Value{ std::string( "b" ) } ), typename TestFixture::BTree::btree_error );
+
+        this->insert( 1, Value{ std::string( "b" ) }, true );
+        this->reopen();
+
+        auto value = this->get( 1 );
+        ASSERT_TRUE( value );
+        EXPECT_EQ( Value{ std::string( "b" ) }, *value );
+    }
+
+
+    TYPED_TEST( TestBTree, ArrayValues )
+    {
+        using Value = typename TestFixture::Value;
+
+        std::vector< std::byte > bytes( 3000 );
+        for ( size_t i = 0; i < bytes.size(); ++i ) bytes[ i ] = static_cast< std::byte >( i );
+
+        std::vector< float > floats( 1000 );
+        for ( size_t i = 0; i < floats.size(); ++i ) floats[ i ] = i * 0.5f;
+
+        std::vector< double > doubles( 100 );
+        for ( size_t i = 0; i < doubles.size(); ++i ) doubles[ i ] = -1.0 * i / 3;
+
+        const std::vector< Value > values{
+            Value{ std::vector< std::byte >{} },
+            Value{ std::vector< float >{} },
+            Value{ std::vector< double >{ 1.0 } },
+            Value{ bytes },
+            Value{ floats },
+            Value{ doubles }
+        };
+
+        for ( size_t i = 0; i < values.size(); ++i ) this->insert( i + 1, values[ i ] );
+
+        this->reopen();
+
+        for ( size_t i = 0; i < values.size(); ++i )
+        {
+            auto value = this->get( i + 1 );
+            ASSERT_TRUE( value );
+            EXPECT_EQ( values[ i ], *value );
+        }
+    }
+
+
+    TYPED_TEST( TestBTree, BlobReader )
+    {
+        using Value = typename TestFixture::Value;
+
+        std::string blob( 10000, ' ' );
+        for ( size_t i = 0; i < blob.size(); ++i ) blob[ i ] = static_cast< char >( 'a' + i % 26 );
+
+        this->insert( 1, Value{ blob } );
+        this->insert( 2, Value{ std::vector< double >{ 1.0, 2.0, 3.0 } } );
+        this->insert( 3, Value{ uint32_t{ 1 } } );
+        this->reopen();
+
+        typename TestFixture::BTreePath bpath;
+        ASSERT_TRUE( this->root()->find_digest( 1, bpath ) );
+        auto node = this->cache_->get_node( bpath.back().first );
+
+        auto reader = node->value_reader( bpath.back().second );
+        EXPECT_EQ( blob.size(), reader.size() );
+
+        // sequential reading
+        std::string read;
+        char buffer[ 333 ];
+        while ( auto count = reader.read( buffer, sizeof( buffer ) ) ) read.append( buffer, count );
+        EXPECT_EQ( blob, read );
+        EXPECT_EQ( blob.size(), reader.position() );
+
+        // ranges, including backward ones and ones clipped by the end
+        for ( uint64_t offset : { 9000, 17, 5000, 9990 } )
+        {
+            EXPECT_EQ( std::min< size_t >( 100, blob.size() - offset ), reader.read( offset, buffer, 100 ) );
+            EXPECT_EQ( 0, blob.compare( offset, 10, buffer, 10 ) );
+        }
+
+        // spans
+        std::string visited;
+        EXPECT_EQ( 3000, reader.for_each_chunk( 1000, 3000, [&] ( const char * data, size_t size ) { visited.append( data, size ); } ) );
+        EXPECT_EQ( blob.substr( 1000, 3000 ), visited );
+
+        // numeric array
+        bpath.clear();
+        ASSERT_TRUE( this->root()->find_digest( 2, bpath ) );
+        node = this->cache_->get_node( bpath.back().first );
+        auto array_reader = node->value_reader( bpath.back().second );
+        EXPECT_EQ( 3 * sizeof( double ), array_reader.size() );
+
+        // inline value cannot be streamed
+        bpath.clear();
+        ASSERT_TRUE( this->root()->find_digest( 3, bpath ) );
+        node = this->cache_->get_node( bpath.back().first );
+        EXPECT_THROW( node->value_reader( bpath.back().second ), typename TestFixture::BTree::btree_error );
+    }
+
+
+    TYPED_TEST( TestBTree, BlobDedup )
+    {
+        using Value = typename TestFixture::Value;
+
+        const Value shared{ std::string( 2000, 'z' ) };
+        const Value other{ std::string( 2000, 'w' ) };
+
+        this->insert( 1, shared );
+        this->insert( 2, shared );
+        this->insert( 3, other );
+
+        const auto chain = this->packed( 1 ).value_;
+        EXPECT_EQ( chain, this->packed( 2 ).value_ );
+        EXPECT_NE( chain, this->packed( 3 ).value_ );
+
+        // the index survives reopening
+        this->reopen();
+        this->insert( 4, shared );
+        EXPECT_EQ( chain, this->packed( 4 ).value_ );
+
+        // the chain lives till the last reference
+        EXPECT_TRUE( this->erase( 1 ) );
+        EXPECT_TRUE( this->erase( 2 ) );
+        this->reopen();
+        EXPECT_EQ( shared, *this->get( 4 ) );
+        EXPECT_EQ( other, *this->get( 3 ) );
+
+        EXPECT_TRUE( this->erase( 4 ) );
+        this->insert( 5, shared );
+        this->reopen();
+        EXPECT_EQ( shared, *this->get( 5 ) );
+    }
+
+
+    TYPED_TEST( TestBTree, BlobIndexCompaction )
+    {
+        using Value = typename TestFixture::Value;
+
+        // each transaction appends the journal, so the index gets compacted into a snapshot
+        for ( size_t i = 0; i < 700; ++i )
+        {
+            this->insert( 1, Value{ std::string( 1000 + i % 3, 'c' ) }, true );
+            this->insert( 2, Value{ std::string( 1000 + i % 5, 'c' ) }, true );
+        }
+
+        this->reopen();
+
+        EXPECT_EQ( Value{ std::string( 1000 + 699 % 3, 'c' ) }, *this->get( 1 ) );
+        EXPECT_EQ( Value{ std::string( 1000 + 699 % 5, 'c' ) }, *this->get( 2 ) );
+
+        this->insert( 3, Value{ std::string( 1000 + 699 % 3, 'c' ) } );
+        EXPECT_EQ( this->packed( 1 ).value_, this->packed( 3 ).value_ );
+    }
+
+
+    TYPED_TEST( TestBTree, EraseRebalance )
+    {
+        using Value = typename TestFixture::Value;
+
+        std::vector< uint64_t > digests( 300 );
+        for ( size_t i = 0; i < digests.size(); ++i ) digests[ i ] = i + 1;
+
+        std::mt19937 rng( 7 );
+        std::shuffle( digests.begin(), digests.end(), rng );
+
+        for ( auto d : digests ) this->insert( d, Value{ uint64_t{ d } } );
+        EXPECT_EQ( digests.size(), this->validate() );
+
+        std::shuffle( digests.begin(), digests.end(), rng );
+
+        for ( size_t i = 0; i < digests.size(); ++i )
+        {
+            ASSERT_TRUE( this->erase( digests[ i ] ) );
+            EXPECT_FALSE( this->erase( digests[ i ] ) );
+
+            if ( i % 50 == 0 )
+            {
+                this->reopen();
+                ASSERT_EQ( digests.size() - i - 1, this->validate() );
+
+                for ( size_t j = 0; j < digests.size(); ++j )
+                {
+                    auto value = this->get( digests[ j ] );
+                    EXPECT_EQ( j > i, value.has_value() );
+                    if ( value ) { EXPECT_EQ( Value{ uint64_t{ digests[ j ] } }, *value ); }
+                }
+            }
+        }
+
+        EXPECT_EQ( 0, this->validate() );
+    }
+
+
+    template < typename Policies >
+    class TestBTreeWriteBack : public TestBTree< Policies >
+    {
+    };
+
+    using WriteBackPolicies = ::testing::Types<
+        TestPolicy< 2, WriteBack >,
+        TestPolicy< 5, WriteBack >
+    >;
+
+    TYPED_TEST_SUITE( TestBTreeWriteBack, WriteBackPolicies );
+
+
+    TYPED_TEST( TestBTreeWriteBack, DeferredChanges )
+    {
+        using Value = typename TestFixture::Value;
+
+        // the 1st insertion into empty root leaf stays in memory
+        this->insert( 1, Value{ uint32_t{ 1 } } );
+        EXPECT_TRUE( this->cache_->is_dirty( this->root().get() ) );
+        EXPECT_EQ( Value{ uint32_t{ 1 } }, *this->get( 1 ) );
+
+        // overwriting and erasing too
+        this->insert( 1, Value{ uint32_t{ 2 } }, true );
+        this->insert( 2, Value{ 2.0 } );
+        EXPECT_TRUE( this->erase( 2 ) );
+
+        // closing writes the nodes
+        this->reopen();
+        EXPECT_FALSE( this->cache_->is_dirty( this->root().get() ) );
+        EXPECT_EQ( Value{ uint32_t{ 2 } }, *this->get( 1 ) );
+        EXPECT_FALSE( this->get( 2 ) );
+    }
+
+
+    TYPED_TEST( TestBTreeWriteBack, PeriodicFlush )
+    {
+        using Value = typename TestFixture::Value;
+
+        this->insert( 1, Value{ uint32_t{ 1 } } );
+
+        // the flusher writes the node in the background
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds( 10 );
+        while ( this->cache_->is_dirty( this->root().get() ) && std::chrono::steady_clock::now() < deadline )
+        {
+            std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+        }
+
+        EXPECT_FALSE( this->cache_->is_dirty( this->root().get() ) );
+        EXPECT_EQ( 1, this->stored_size( TestFixture::RootNodeUid ) );
+    }
+
+
+    TYPED_TEST( TestBTreeWriteBack, MixedWithRegularWrites )
+    {
+        using Value = typename TestFixture::Value;
+
+        // inline values go to the cache, BLOBs and splits are written through
+        for ( uint64_t d = 1; d <= 200; ++d )
+        {
+            if ( d % 7 ) this->insert( d, Value{ uint64_t{ d } } );
+            else this->insert( d, Value{ std::string( d, 's' ) } );
+        }
+
+        for ( uint64_t d = 1; d <= 200; d += 3 ) this->insert( d, Value{ uint64_t{ d * 10 } }, true );
+        for ( uint64_t d = 2; d <= 200; d += 5 ) EXPECT_TRUE( this->erase( d ) );
+
+        EXPECT_EQ( 200 - 40, this->validate() );
+
+        this->reopen();
+
+        EXPECT_EQ( 200 - 40, this->validate() );
+
+        for ( uint64_t d = 1; d <= 200; ++d )
+        {
+            auto value = this->get( d );
+
+            if ( d % 5 == 2 ) { EXPECT_FALSE( value ); continue; }
+
+            ASSERT_TRUE( value );
+            if ( d % 3 == 1 ) { EXPECT_EQ( Value{ uint64_t{ d * 10 } }, *value ); }
+            else if ( d % 7 ) { EXPECT_EQ( Value{ uint64_t{ d } }, *value ); }
+            else { EXPECT_EQ( Value{ std::string( d, 's' ) }, *value ); }
+        }
+    }
+
+
+    TYPED_TEST( TestBTree, BulkLoad )
+    {
+        using Value = typename TestFixture::Value;
+        using BulkItem = typename TestFixture::BTree::BulkItem;
+
+        const size_t capacity = 2 * this->file_->btree_power() - 2;
+
+        for ( size_t count : { size_t{ 0 }, size_t{ 1 }, capacity, capacity + 1, size_t{ 1000 } } )
+        {
+            this->reopen_empty();
+
+            std::vector< BulkItem > items;
+            for ( uint64_t d = count; d > 0; --d ) items.emplace_back( d * 2, Value{ uint64_t{ d } }, 0, this->name( d * 2 ) );
+
+            // the last of repeated digests wins
+            if ( count ) items.emplace_back( 2, Value{ std::string( 600, 'r' ) }, 0, this->name( 2 ) );
+
+            this->root()->bulk_load( items );
+            ASSERT_EQ( count, this->validate() );
+
+            this->reopen();
+            ASSERT_EQ( count, this->validate() );
+
+            for ( uint64_t d = 1; d <= count; ++d )
+            {
+                auto value = this->get( d * 2 );
+                ASSERT_TRUE( value );
+                EXPECT_EQ( d == 1 ? Value{ std::string( 600, 'r' ) } : Value{ uint64_t{ d } }, *value );
+                EXPECT_FALSE( this->get( d * 2 + 1 ) );
+            }
+
+            // loaded b-tree takes regular modifications
+            for ( uint64_t d = 1; d <= count; d += 2 ) this->insert( d * 2 + 1, Value{ uint64_t{ d } } );
+            for ( uint64_t d = 1; d <= count; d += 3 ) EXPECT_TRUE( this->erase( d * 2 ) );
+
+            EXPECT_EQ( count + ( count + 1 ) / 2 - ( count + 2 ) / 3, this->validate() );
+        }
+    }
+
+
+    TYPED_TEST( TestBTree, Batches )
+    {
+        using Value = typename TestFixture::Value;
+        using BulkItem = typename TestFixture::BTree::BulkItem;
+
+        std::vector< BulkItem > items;
+        for ( uint64_t d = 1; d <= 300; ++d ) items.emplace_back( ( d * 7919 ) % 1000, Value{ uint64_t{ d } }, 0, this->name( ( d * 7919 ) % 1000 ) );
+        items.emplace_back( 5, Value{ std::string( 700, 'b' ) }, 0, this->name( 5 ) );
+
+        this->root()->insert_batch( items, false );
+        EXPECT_EQ( 301, this->validate() );
+
+        // existing subkey fails whole batch
+        std::vector< BulkItem > repeated{ BulkItem{ 1001, Value{}, 0, this->name( 1001 ) }, BulkItem{ 5, Value{}, 0, this->name( 5 ) } };
+        EXPECT_THROW( this->root()->insert_batch( repeated, false ), typename TestFixture::BTree::btree_error );
+        EXPECT_FALSE( this->get( 1001 ) );
+
+        this->root()->insert_batch( repeated, true );
+        EXPECT_EQ( Value{}, *this->get( 5 ) );
+        EXPECT_EQ( 302, this->validate() );
+
+        // erase every other subkey and some missing ones
+        std::vector< typename TestFixture::Digest > digests;
+        for ( size_t i = 0; i < items.size(); i += 2 ) digests.push_back( std::get< 0 >( items[ i ] ) );
+        digests.push_back( 100000 );
+        digests.push_back( 5 );
+        digests.push_back( 5 );
+
+        this->root()->erase_batch( digests );
+        EXPECT_EQ( 302 - 151, this->validate() );
+
+        this->reopen();
+        EXPECT_EQ( 302 - 151, this->validate() );
+
+        for ( size_t i = 0; i < 300; ++i )
+        {
+            auto value = this->get( std::get< 0 >( items[ i ] ) );
+            EXPECT_EQ( i % 2 == 1, value.has_value() );
+            if ( value ) { EXPECT_EQ( Value{ uint64_t{ i + 1 } }, *value ); }
+        }
+
+        EXPECT_TRUE( this->get( 1001 ) );
+        EXPECT_FALSE( this->get( 5 ) );
+    }
+
+
+    TYPED_TEST( TestBTreeWriteBack, BatchOverDirtyNodes )
+    {
+        using Value = typename TestFixture::Value;
+        using BulkItem = typename TestFixture::BTree::BulkItem;
+
+        // deferred changes in cached nodes
+        for ( uint64_t d = 1; d <= 100; ++d ) this->insert( d * 10, Value{ uint64_t{ d } } );
+        for ( uint64_t d = 1; d <= 100; d += 4 ) this->insert( d * 10, Value{ uint64_t{ d + 1 } }, true );
+
+        std::vector< BulkItem > items;
+        for ( uint64_t d = 1; d <= 100; ++d ) items.emplace_back( d * 10 + 1, Value{ uint64_t{ d } }, 0, this->name( d * 10 + 1 ) );
+
+        this->root()->insert_batch( items, false );
+
+        std::vector< typename TestFixture::Digest > digests;
+        for ( uint64_t d = 1; d <= 100; d += 2 ) digests.push_back( d * 10 );
+        this->root()->erase_batch( digests );
+
+        this->reopen();
+        EXPECT_EQ( 150, this->validate() );
+
+        for ( uint64_t d = 1; d <= 100; ++d )
+        {
+            EXPECT_EQ( Value{ uint64_t{ d } }, *this->get( d * 10 + 1 ) );
+
+            auto value = this->get( d * 10 );
+            EXPECT_EQ( d % 2 == 0, value.has_value() );
+            if ( value ) { EXPECT_EQ( Value{ uint64_t{ d % 4 == 1 ? d + 1 : d } }, *value ); }
+        }
+    }
+
+
+    TYPED_TEST( TestBTree, OptimisticReads )
+    {
+        using Value = typename TestFixture::Value;
+
+        for ( uint64_t d = 2; d <= 400; d += 2 ) this->insert( d, Value{ uint64_t{ d } } );
+
+        std::atomic< bool > stop{ false };
+        std::atomic< size_t > misses{ 0 };
+
+        // readers do not lock the nodes while the writer restructures the b-tree around them
+        std::vector< std::thread > readers;
+        for ( size_t r = 0; r < 3; ++r )
+        {
+            readers.emplace_back( [&, r] {
+                auto root = this->root();
+
+                for ( uint64_t i = r; !stop; ++i )
+                {
+                    typename TestFixture::BTreePath bpath;
+                    if ( !root->find_digest( 2 + 2 * ( i % 200 ), bpath ) ) ++misses;
+
+                    bpath.clear();
+                    if ( root->find_digest( 100000 + i % 100, bpath ) ) ++misses;
+                }
+            } );
+        }
+
+        for ( size_t pass = 0; pass < 5; ++pass )
+        {
+            for ( uint64_t d = 1; d <= 400; d += 2 ) this->insert( d, Value{ uint64_t{ d } } );
+            for ( uint64_t d = 1; d <= 400; d += 2 ) EXPECT_TRUE( this->erase( d ) );
+        }
+
+        stop = true;
+        for ( auto & reader : readers ) reader.join();
+
+        EXPECT_EQ( 0, misses );
+        EXPECT_EQ( 200, this->validate() );
+    }
+
+
+    TYPED_TEST( TestBTree, Cursor )
+    {
+        using Value = typename TestFixture::Value;
+        using Key = typename TestFixture::Key;
+        using Cursor = typename TestFixture::BTree::Cursor;
+
+        // empty b-tree
+        {
+            Cursor cursor( this->root(), 10 );
+            EXPECT_TRUE( cursor.next_page().empty() );
+            EXPECT_TRUE( cursor.done() );
+        }
+
+        for ( uint64_t d = 1; d <= 500; ++d ) this->insert( d * 3, Value{ uint64_t{ d } } );
+
+        // the names are stored with the subkeys
+        this->reopen();
+
+        std::vector< Key > names;
+        {
+            Cursor cursor( this->root(), 7 );
+
+            while ( !cursor.done() )
+            {
+                auto page = cursor.next_page();
+                EXPECT_GE( 7, page.size() );
+                names.insert( names.end(), page.begin(), page.end() );
+            }
+        }
+
+        ASSERT_EQ( 500, names.size() );
+        for ( uint64_t d = 1; d <= 500; ++d ) EXPECT_EQ( this->name( d * 3 ), names[ d - 1 ] );
+
+        // modifications between pages do not break enumeration of untouched subkeys
+        Cursor cursor( this->root(), 13 );
+        std::multiset< Key > provided;
+
+        for ( uint64_t pass = 0; !cursor.done(); ++pass )
+        {
+            for ( auto & name : cursor.next_page() ) provided.insert( name );
+
+            for ( uint64_t d = pass * 20 + 1; d <= std::min< uint64_t >( pass * 20 + 20, 500 ); ++d )
+            {
+                if ( d * 3 <= 1500 && d % 2 ) this->erase( d * 3 );
+                this->insert( d * 3 + 1, Value{ uint64_t{ d } } );
+            }
+        }
+
+        for ( uint64_t d = 1; d <= 500; ++d )
+        {
+            if ( d % 2 == 0 ) { EXPECT_EQ( 1, provided.count( this->name( d * 3 ) ) ); }
+            else { EXPECT_GE( 1, provided.count( this->name( d * 3 ) ) ); }
+        }
+
+        for ( auto & name : provided ) EXPECT_EQ( 1, provided.count( name ) );
+    }
+
+
+    TYPED_TEST( TestBTree, EraseSubtree )
+    {
+        using Value = typename TestFixture::Value;
+        using BTreePath = typename TestFixture::BTreePath;
+
+        for ( uint64_t d = 1; d <= 20; ++d ) this->insert( d, Value{ uint64_t{ d } } );
+
+        // subtree of two levels with BLOBs
+        const auto build = [&] {
+            auto children = this->children( 10 );
+            for ( uint64_t d = 1; d <= 200; ++d )
+            {
+                const auto value = d % 10 ? Value{ uint64_t{ d } } : Value{ std::string( 2000, static_cast< char >( 'a' + d / 10 ) ) };
+                children->insert_subkey( d, this->name( d ), value, 0, false );
+            }
+
+            auto grandchildren = this->children( children, 5 );
+            for ( uint64_t d = 1; d <= 50; ++d ) grandchildren->insert_subkey( d, this->name( d ), Value{ d }, 0, false );
+        };
+
+        const auto before_build = this->file_size();
+        build();
+        const auto built = this->file_size();
+
+        // the subkey with children is erased by a single call, a leaf subkey too
+        for ( uint64_t d : { 10, 11 } )
+        {
+            BTreePath bpath;
+            ASSERT_TRUE( this->root()->find_digest( d, bpath ) );
+
+            const auto[ uid, pos ] = bpath.back();
+            bpath.pop_back();
+            this->cache_->get_node( uid )->erase_subtree( pos, bpath );
+        }
+
+        this->wait_reclaimed();
+
+        this->reopen();
+        EXPECT_EQ( 18, this->validate() );
+
+        for ( uint64_t d = 1; d <= 20; ++d )
+        {
+            auto value = this->get( d );
+            EXPECT_EQ( d != 10 && d != 11, value.has_value() );
+        }
+
+        // released chunks are reused by the same subtree
+        this->insert( 10, Value{ uint64_t{ 10 } } );
+
+        const auto erased = this->file_size();
+        build();
+        EXPECT_GT( ( built - before_build ) / 2, this->file_size() - erased );
+
+        this->reopen();
+        EXPECT_EQ( 19, this->validate() );
+        EXPECT_EQ( 200, this->validate( this->children( 10 ) ) );
+    }
+
+
+    TYPED_TEST( TestBTree, MoveSubkey )
+    {
+        using Value = typename TestFixture::Value;
+
+        // renaming within single root node writes the node once
+        this->insert( 1, Value{ uint64_t{ 1 } } );
+        this->insert( 2, Value{ std::string( 1000, 'b' ) } );
+
+        auto root = this->root();
+        root->move_subkey( 1, *root, 5, this->name( 5 ), false, {} );
+        EXPECT_FALSE( this->get( 1 ) );
+        EXPECT_EQ( Value{ uint64_t{ 1 } }, *this->get( 5 ) );
+
+        EXPECT_THROW( root->move_subkey( 5, *root, 2, this->name( 2 ), false, {} ), typename TestFixture::BTree::btree_error );
+        EXPECT_THROW( root->move_subkey( 7, *root, 8, this->name( 8 ), false, {} ), typename TestFixture::BTree::btree_error );
+
+        root->move_subkey( 2, *root, 5, this->name( 5 ), true, {} );
+        root.reset();
+
+        this->reopen();
+        EXPECT_EQ( 1, this->validate() );
+        EXPECT_EQ( Value{ std::string( 1000, 'b' ) }, *this->get( 5 ) );
+
+        // renaming restructures multilevel b-tree
+        for ( uint64_t d = 1; d <= 300; ++d ) this->insert( d * 2, Value{ d * 2 } );
+
+        root = this->root();
+        for ( uint64_t d = 1; d <= 300; d += 3 ) root->move_subkey( d * 2, *root, d * 2 + 1001, this->name( d * 2 + 1001 ), false, {} );
+        root.reset();
+
+        this->reopen();
+        EXPECT_EQ( 301, this->validate() );
+
+        for ( uint64_t d = 1; d <= 300; ++d )
+        {
+            const bool moved = d % 3 == 1;
+            EXPECT_EQ( !moved, this->get( d * 2 ).has_value() );
+            EXPECT_EQ( moved, this->get( d * 2 + 1001 ).has_value() );
+            if ( moved ) { EXPECT_EQ( Value{ d * 2 }, *this->get( d * 2 + 1001 ) ); }
+        }
+
+        // the subtree goes with the subkey, and the subkey goes to another b-tree
+        auto children = this->children( 4 );
+        for ( uint64_t d = 1; d <= 30; ++d ) children->insert_subkey( d, this->name( d ), Value{ d }, 0, false );
+        const auto children_uid = children->uid();
+        children.reset();
+
+        root = this->root();
+        root->move_subkey( 4, *root, 5000, this->name( 5000 ), false, {} );
+
+        children = this->children( 5000 );
+        EXPECT_EQ( children_uid, children->uid() );
+        EXPECT_EQ( 30, this->validate( children ) );
+
+        EXPECT_THROW( root->move_subkey( 5000, *children, 100, this->name( 100 ), false, { TestFixture::RootNodeUid, children_uid } ), typename TestFixture::BTree::btree_error );
+
+        root->move_subkey( 6, *children, 100, this->name( 100 ), false, { TestFixture::RootNodeUid, children_uid } );
+        root->move_subkey( 10, *children, 1, this->name( 1 ), true, { TestFixture::RootNodeUid, children_uid } );
+        root.reset();
+        children.reset();
+
+        this->reopen();
+        EXPECT_EQ( 299, this->validate() );
+
+        children = this->children( 5000 );
+        EXPECT_EQ( 31, this->validate( children ) );
+        EXPECT_FALSE( this->get( 6 ) );
+        EXPECT_FALSE( this->get( 10 ) );
+
+        typename TestFixture::BTreePath bpath;
+        ASSERT_TRUE( children->find_digest( 1, bpath ) );
+        EXPECT_EQ( Value{ uint64_t{ 10 } }, this->cache_->get_node( bpath.back().first )->value( bpath.back().second ) );
+    }
+
+
+    template < typename Policies >
+    class TestBTreeExpiration : public TestBTree< Policies >
+    {
+    };
+
+    using ExpirationPolicies = ::testing::Types<
+        TestPolicy< 2, Expiration >,
+        TestPolicy< 5, Expiration >
+    >;
+
+    TYPED_TEST_SUITE( TestBTreeExpiration, ExpirationPolicies );
+
+
+    TYPED_TEST( TestBTreeExpiration, MoveSubkey )
+    {
+        using Value = typename TestFixture::Value;
+
+        const auto root_uid = TestFixture::RootNodeUid;
+        const uint64_t good_before = std::chrono::duration_cast< std::chrono::milliseconds >( std::chrono::system_clock::now().time_since_epoch() ).count() + 3600000;
+
+        auto root = this->root();
+        root->insert_subkey( 1, this->name( 1 ), Value{ uint64_t{ 1 } }, good_before, false );
+        root->insert_subkey( 2, this->name( 2 ), Value{ uint64_t{ 2 } }, good_before + 1, false );
+
+        // the index is modified by both erasing and insertion, its root is written once
+        root->move_subkey( 1, *root, 3, this->name( 3 ), false, {} );
+        root.reset();
+
+        this->reopen();
+
+        using Entries = decltype( this->expirations() );
+        EXPECT_EQ( ( Entries{ { root_uid, 2, good_before + 1 }, { root_uid, 3, good_before } } ), this->expirations() );
+
+        for ( uint64_t d = 10; d < 200; ++d ) this->root()->insert_subkey( d, this->name( d ), Value{ d }, good_before + d, false );
+
+        root = this->root();
+        for ( uint64_t d = 10; d < 200; d += 2 ) root->move_subkey( d, *root, d + 1000, this->name( d + 1000 ), false, {} );
+        root.reset();
+
+        this->reopen();
+
+        const auto entries = this->expirations();
+        EXPECT_EQ( 192, entries.size() );
+
+        for ( uint64_t d = 10; d < 200; ++d )
+        {
+            EXPECT_EQ( 1, entries.count( { root_uid, d % 2 ? d : d + 1000, good_before + d } ) );
+        }
+    }
+
+
+    TYPED_TEST( TestBTreeExpiration, Reaper )
+    {
+        using Value = typename TestFixture::Value;
+        using BTreeP = typename TestFixture::BTreeP;
+
+        const auto root_uid = TestFixture::RootNodeUid;
+        const uint64_t now = std::chrono::duration_cast< std::chrono::milliseconds >( std::chrono::system_clock::now().time_since_epoch() ).count();
+
+        // odd subkeys expire soon, even ones live for an hour, the rest never expire
+        auto root = this->root();
+        for ( uint64_t d = 1; d <= 200; ++d ) root->insert_subkey( d, this->name( d ), Value{ std::string( d % 10 ? 10 : 1000, 'v' ) }, d % 2 ? now + 50 : now + 3600000, false );
+        for ( uint64_t d = 201; d <= 220; ++d ) root->insert_subkey( d, this->name( d ), Value{ d }, 0, false );
+
+        // the reaper waits for the key lock
+        auto count = [&] {
+            boost::shared_lock< boost::upgrade_mutex > key{ root->guard() };
+            return this->validate( root );
+        };
+
+        auto wait_reaped = [&] ( size_t expected ) {
+            const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds( 10 );
+            while ( count() != expected && std::chrono::steady_clock::now() < deadline )
+            {
+                std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+            }
+
+            EXPECT_EQ( expected, count() );
+        };
+
+        // reaping is off till the key lock is provided
+        std::this_thread::sleep_for( std::chrono::milliseconds( 100 ) );
+        EXPECT_EQ( 220, count() );
+        EXPECT_EQ( 200, this->expirations().size() );
+
+        {
+            // busy b-tree is skipped
+            boost::shared_lock< boost::upgrade_mutex > key{ root->guard() };
+
+            this->cache_->set_reap_lock( [] ( const BTreeP & root ) {
+                return boost::unique_lock< boost::upgrade_mutex >{ root->guard(), boost::try_to_lock };
+            } );
+
+            std::this_thread::sleep_for( std::chrono::milliseconds( 50 ) );
+            EXPECT_EQ( 220, this->validate( root ) );
+        }
+
+        wait_reaped( 120 );
+
+        // expired subkeys are unregistered with their erasing
+        {
+            const auto entries = this->expirations();
+            EXPECT_EQ( 100, entries.size() );
+            for ( uint64_t d = 2; d <= 200; d += 2 ) EXPECT_EQ( 1, entries.count( { root_uid, d, now + 3600000 } ) );
+        }
+
+        // rewritten subkey is not reaped by its previous mark
+        root->insert_subkey( 2, this->name( 2 ), Value{ uint64_t{ 2 } }, 0, true );
+        root->insert_subkey( 4, this->name( 4 ), Value{ uint64_t{ 4 } }, now + 50, true );
+
+        wait_reaped( 119 );
+        root.reset();
+
+        this->reopen();
+        EXPECT_EQ( 119, this->validate() );
+
+        // entries of rewritten subkeys stay till their previous marks pass
+        {
+            const auto entries = this->expirations();
+            EXPECT_EQ( 100, entries.size() );
+            EXPECT_EQ( 0, entries.count( { root_uid, 4, now + 50 } ) );
+        }
+
+        for ( uint64_t d = 1; d <= 220; ++d ) EXPECT_EQ( d > 200 || ( d % 2 == 0 && d != 4 ), this->get( d ).has_value() );
+    }
+
+
+    TYPED_TEST( TestBTree, ChildrenOnDemand )
+    {
+        using Value = typename TestFixture::Value;
+
+        for ( uint64_t d = 1; d <= 20; ++d ) this->insert( d, Value{ d } );
+
+        // leaf subkeys take no children b-tree
+        for ( uint64_t d = 1; d <= 20; ++d ) EXPECT_EQ( TestFixture::InvalidNodeUid, this->children_uid( d ) );
+
+        // the b-tree is created with the first child
+        {
+            auto[ node, pos ] = this->locate( 7 );
+            node->insert_first_child( pos, 100, this->name( 100 ), Value{ std::string( "first" ) }, 0 );
+        }
+
+        const auto children_uid = this->children_uid( 7 );
+        ASSERT_NE( TestFixture::InvalidNodeUid, children_uid );
+        EXPECT_EQ( 1, this->stored_size( children_uid ) );
+
+        this->reopen();
+
+        auto children = this->children( 7 );
+        EXPECT_EQ( 1, this->validate( children ) );
+
+        for ( uint64_t d = 101; d <= 150; ++d ) children->insert_subkey( d, this->name( d ), Value{ d }, 0, false );
+
+        // b-tree with children is not collapsed
+        {
+            auto[ node, pos ] = this->locate( 7 );
+            EXPECT_FALSE( node->collapse_children( pos ) );
+        }
+
+        for ( uint64_t d = 100; d <= 150; ++d ) EXPECT_TRUE( children->erase_subkey( d ) );
+        EXPECT_EQ( 0, this->validate( children ) );
+
+        // held root is not collapsed
+        {
+            auto[ node, pos ] = this->locate( 7 );
+            EXPECT_FALSE( node->collapse_children( pos ) );
+        }
+
+        children.reset();
+
+        {
+            auto[ node, pos ] = this->locate( 7 );
+            EXPECT_TRUE( node->collapse_children( pos ) );
+            EXPECT_FALSE( node->collapse_children( pos ) );
+        }
+
+        EXPECT_EQ( TestFixture::InvalidNodeUid, this->children_uid( 7 ) );
+        this->wait_reclaimed();
+
+        this->reopen();
+        EXPECT_EQ( 20, this->validate() );
+        EXPECT_EQ( TestFixture::InvalidNodeUid, this->children_uid( 7 ) );
+        EXPECT_EQ( Value{ uint64_t{ 7 } }, *this->get( 7 ) );
+
+        // released chunks are reused
+        const auto released = this->file_size();
+        {
+            auto[ node, pos ] = this->locate( 7 );
+            node->insert_first_child( pos, 100, this->name( 100 ), Value{ uint64_t{ 1 } }, 0 );
+        }
+
+        EXPECT_EQ( released, this->file_size() );
+    }
+
+
+    template < typename Policies >
+    class TestBTreeTopDown : public TestBTree< Policies >
+    {
+    };
+
+    using TopDownPolicies = ::testing::Types<
+        TestPolicy< 2, TopDown >,
+        TestPolicy< 5, TopDown >,
+        TestPolicy< 5, TopDown | WriteBack >
+    >;
+
+    TYPED_TEST_SUITE( TestBTreeTopDown, TopDownPolicies );
+
+
+    TYPED_TEST( TestBTreeTopDown, InsertErase )
+    {
+        using Value = typename TestFixture::Value;
+
+        std::vector< uint64_t > digests( 500 );
+        for ( size_t i = 0; i < digests.size(); ++i ) digests[ i ] = i + 1;
+
+        std::mt19937 rng( 11 );
+        std::shuffle( digests.begin(), digests.end(), rng );
+
+        for ( size_t i = 0; i < digests.size(); ++i )
+        {
+            this->insert( digests[ i ], Value{ digests[ i ] } );
+            if ( i % 100 == 0 ) { ASSERT_EQ( i + 1, this->validate() ); }
+        }
+
+        // overwriting makes no structural changes
+        for ( uint64_t d = 1; d <= 500; d += 7 ) this->insert( d, Value{ std::string( 300, 'o' ) }, true );
+
+        this->reopen();
+        EXPECT_EQ( digests.size(), this->validate() );
+
+        for ( uint64_t d = 1; d <= 500; ++d )
+        {
+            auto value = this->get( d );
+            ASSERT_TRUE( value );
+            EXPECT_EQ( d % 7 == 1 ? Value{ std::string( 300, 'o' ) } : Value{ d }, *value );
+        }
+
+        std::shuffle( digests.begin(), digests.end(), rng );
+
+        for ( size_t i = 0; i < digests.size(); ++i )
+        {
+            ASSERT_TRUE( this->erase( digests[ i ] ) );
+            EXPECT_FALSE( this->erase( digests[ i ] ) );
+
+            if ( i % 100 == 0 )
+            {
+                this->reopen();
+                ASSERT_EQ( digests.size() - i - 1, this->validate() );
+
+                for ( size_t j = 0; j < digests.size(); j += 5 ) EXPECT_EQ( j > i, this->get( digests[ j ] ).has_value() );
+            }
+        }
+
+        this->reopen();
+        EXPECT_EQ( 0, this->validate() );
+
+        // the b-tree grows again from the empty root
+        for ( uint64_t d = 1; d <= 100; ++d ) this->insert( d * 5, Value{ d } );
+        EXPECT_EQ( 100, this->validate() );
+    }
+
+
+    TYPED_TEST( TestBTreeTopDown, Ascending )
+    {
+        using Value = typename TestFixture::Value;
+
+        // each insertion goes to the rightmost path, so each level is split on the way down
+        for ( uint64_t d = 1; d <= 400; ++d ) this->insert( d, Value{ d } );
+
+        this->reopen();
+        EXPECT_EQ( 400, this->validate() );
+
+        // and each erasing tops up the leftmost path
+        for ( uint64_t d = 1; d <= 400; ++d )
+        {
+            ASSERT_TRUE( this->erase( d ) );
+            if ( d % 50 == 0 ) { ASSERT_EQ( 400 - d, this->validate() ); }
+        }
+
+        this->reopen();
+        EXPECT_EQ( 0, this->validate() );
+    }
+
+
+    template < typename Policies >
+    class TestBTreeLazyErase : public TestBTree< Policies >
+    {
+    };
+
+    using LazyErasePolicies = ::testing::Types<
+        TestPolicy< 2, LazyErase >,
+        TestPolicy< 5, LazyErase >
+    >;
+
+    TYPED_TEST_SUITE( TestBTreeLazyErase, LazyErasePolicies );
+
+
+    TYPED_TEST( TestBTreeLazyErase, Tombstones )
+    {
+        using Value = typename TestFixture::Value;
+
+        for ( uint64_t d = 1; d <= 300; ++d ) this->insert( d, Value{ d } );
+
+        const auto inner = this->inner( 2, 2 );
+        const auto revived = this->inner( inner + 2, 2 );
+
+        {
+            // the collapsing waits for the key lock
+            auto tree = this->root();
+            boost::shared_lock< boost::upgrade_mutex > key{ tree->guard() };
+
+            // erasing from inner node writes the node only
+            const auto uid = this->locate( inner ).first->uid();
+            const auto size = this->stored_size( uid );
+
+            EXPECT_TRUE( this->erase( inner ) );
+            EXPECT_EQ( size, this->stored_size( uid ) );
+            EXPECT_TRUE( this->buried( inner ) );
+            EXPECT_FALSE( this->erase( inner ) );
+
+            for ( uint64_t d = 1; d <= 300; d += 2 ) EXPECT_TRUE( this->erase( d ) );
+            for ( uint64_t d = 1; d <= 300; d += 2 ) EXPECT_FALSE( this->erase( d ) );
+
+            // tombstone is replaced by insertion without overwriting
+            EXPECT_TRUE( this->erase( revived ) );
+            EXPECT_TRUE( this->buried( revived ) );
+            this->insert( revived, Value{ std::string( "again" ) } );
+            EXPECT_FALSE( this->buried( revived ) );
+            EXPECT_EQ( Value{ std::string( "again" ) }, this->get( revived ) );
+
+            // the tombstones keep the b-tree balanced
+            EXPECT_LT( 0, this->tombstones( *tree ) );
+            EXPECT_EQ( 149 + this->tombstones( *tree ), this->validate() );
+        }
+
+        this->wait_collapsed();
+        EXPECT_EQ( 149, this->validate() );
+
+        this->reopen();
+        EXPECT_EQ( 149, this->validate() );
+
+        for ( uint64_t d = 1; d <= 300; ++d ) EXPECT_EQ( d % 2 == 0 && d != inner, this->get( d ).has_value() );
+        EXPECT_EQ( Value{ std::string( "again" ) }, this->get( revived ) );
+    }
+}
@@ -0,0 +1,128 @@
+#include <details/digest_search.h>
+#include <gtest/gtest.h>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <limits>
+
+
+template < typename T >
+struct digest_search_test : public ::testing::Test
+{
+    static std::vector< T > make_digests( size_t size, std::mt19937_64 & rnd )
+    {
+        std::uniform_int_distribution< T > dist( std::numeric_limits< T >::min(), std::numeric_limits< T >::max() );
+
+        std::vector< T > digests( size );
+        std::generate( digests.begin(), digests.end(), [&] { return dist( rnd ); } );
+        std::sort( digests.begin(), digests.end() );
+        digests.erase( std::unique( digests.begin(), digests.end() ), digests.end() );
+
+        return digests;
+    }
+
+    static size_t expected( const std::vector< T > & digests, T key )
+    {
+        return static_cast< size_t >( std::lower_bound( digests.begin(), digests.end(), key ) - digests.begin() );
+    }
+};
+
+typedef ::testing::Types<
+    uint64_t,
+    int64_t,
+    uint32_t
+> TestingPolicies;
+
+
+TYPED_TEST_CASE( digest_search_test, TestingPolicies );
+
+
+TYPED_TEST( digest_search_test, empty )
+{
+    using digest_t = TypeParam;
+
+    digest_t key{};
+    EXPECT_EQ( 0U, jb::details::digest_lower_bound< digest_t >( nullptr, 0, key ) );
+}
+
+
+TYPED_TEST( digest_search_test, lower_bound )
+{
+    using digest_t = TypeParam;
+
+    std::mt19937_64 rnd( 1 );
+
+    for ( size_t size = 1; size < 300; ++size )
+    {
+        auto digests = TestFixture::make_digests( size, rnd );
+
+        for ( auto d : digests )
+        {
+            // existing digests and their neighbours
+            EXPECT_EQ( TestFixture::expected( digests, d ), jb::details::digest_lower_bound( digests.data(), digests.size(), d ) );
+
+            if ( d != std::numeric_limits< digest_t >::max() )
+            {
+                digest_t next = d + 1;
+                EXPECT_EQ( TestFixture::expected( digests, next ), jb::details::digest_lower_bound( digests.data(), digests.size(), next ) );
+            }
+        }
+
+        // extremes
+        for ( auto key : { std::numeric_limits< digest_t >::min(), std::numeric_limits< digest_t >::max() } )
+        {
+            EXPECT_EQ( TestFixture::expected( digests, key ), jb::details::digest_lower_bound( digests.data(), digests.size(), key ) );
+        }
+    }
+}
+
+
+TYPED_TEST( digest_search_test, count_less )
+{
+    using digest_t = TypeParam;
+
+    std::vector< digest_t > digests{ 1, 1, 2, 3, 5, 8, 13, 21, 34 };
+
+    EXPECT_EQ( 0U, jb::details::count_less< digest_t >( digests.data(), digests.size(), 1 ) );
+    EXPECT_EQ( 2U, jb::details::count_less< digest_t >( digests.data(), digests.size(), 2 ) );
+    EXPECT_EQ( 5U, jb::details::count_less< digest_t >( digests.data(), digests.size(), 6 ) );
+    EXPECT_EQ( 9U, jb::details::count_less< digest_t >( digests.data(), digests.size(), 35 ) );
+}
+
+
+TYPED_TEST( digest_search_test, eytzinger )
+{
+    using digest_t = TypeParam;
+
+    std::mt19937_64 rnd( 2 );
+
+    for ( size_t size = 0; size < 300; ++size )
+    {
+        auto digests = TestFixture::make_digests( size, rnd );
+
+        std::vector< digest_t > layout( digests.size() );
+        std::vector< uint16_t > ranks( digests.size() );
+        jb::details::eytzinger_layout( digests.data(), digests.size(), layout.data(), ranks.data() );
+
+        for ( size_t i = 0; i < ranks.size(); ++i )
+        {
+            EXPECT_EQ( digests[ ranks[ i ] ], layout[ i ] );
+        }
+
+        for ( auto d : digests )
+        {
+            EXPECT_EQ( TestFixture::expected( digests, d ), jb::details::eytzinger_lower_bound( layout.data(), ranks.data(), layout.size(), d ) );
+
+            if ( d != std::numeric_limits< digest_t >::max() )
+            {
+                digest_t next = d + 1;
+                EXPECT_EQ( TestFixture::expected( digests, next ), jb::details::eytzinger_lower_bound( layout.data(), ranks.data(), layout.size(), next ) );
+            }
+        }
+
+        for ( auto key : { std::numeric_limits< digest_t >::min(), std::numeric_limits< digest_t >::max() } )
+        {
+            EXPECT_EQ( TestFixture::expected( digests, key ), jb::details::eytzinger_lower_bound( layout.data(), ranks.data(), layout.size(), key ) );
+        }
+    }
+}
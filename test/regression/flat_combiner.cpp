@@ -0,0 +1,99 @@
+#include <details/flat_combiner.h>
+#include <gtest/gtest.h>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <stdexcept>
+#include <numeric>
+
+
+using combiner_t = jb::details::flat_combiner< int, int >;
+
+
+TEST( flat_combiner, single )
+{
+    combiner_t combiner;
+
+    size_t calls = 0;
+    auto square = [&] ( std::vector< int > & requests ) {
+        ++calls;
+
+        std::vector< int > results;
+        for ( auto r : requests ) results.push_back( r * r );
+        return results;
+    };
+
+    EXPECT_EQ( 4, combiner.execute( 2, square ) );
+    EXPECT_EQ( 9, combiner.execute( 3, square ) );
+    EXPECT_EQ( 2, calls );
+}
+
+
+TEST( flat_combiner, error )
+{
+    combiner_t combiner;
+
+    auto fail = [] ( std::vector< int > & ) -> std::vector< int > { throw std::runtime_error( "failed" ); };
+    EXPECT_THROW( combiner.execute( 1, fail ), std::runtime_error );
+
+    auto short_results = [] ( std::vector< int > & ) { return std::vector< int >{}; };
+    EXPECT_THROW( combiner.execute( 1, short_results ), std::logic_error );
+
+    // the combiner stays usable
+    auto echo = [] ( std::vector< int > & requests ) { return requests; };
+    EXPECT_EQ( 5, combiner.execute( 5, echo ) );
+}
+
+
+TEST( flat_combiner, concurrency )
+{
+    static constexpr int ThreadNumber = 8;
+    static constexpr int RequestNumber = 10000;
+    static constexpr size_t MaxBatch = 16;
+
+    combiner_t combiner( MaxBatch );
+
+    // the applier is never entered concurrently
+    std::atomic< int > inside = 0;
+    size_t calls = 0, applied = 0, max_batch = 0;
+    int total = 0;
+
+    auto accumulate = [&] ( std::vector< int > & requests ) {
+        EXPECT_EQ( 1, ++inside );
+
+        ++calls;
+        applied += requests.size();
+        max_batch = std::max( max_batch, requests.size() );
+
+        std::vector< int > results;
+        for ( auto r : requests ) results.push_back( total += r );
+
+        --inside;
+        return results;
+    };
+
+    std::vector< std::thread > threads;
+    std::vector< char > monotonic( ThreadNumber, true );
+
+    for ( int t = 0; t < ThreadNumber; ++t )
+    {
+        threads.emplace_back( [&, t] {
+            int last = 0;
+            for ( int i = 0; i < RequestNumber; ++i )
+            {
+                const auto sum = combiner.execute( 1, accumulate );
+                if ( sum <= last ) monotonic[ t ] = false;
+                last = sum;
+            }
+        } );
+    }
+
+    for ( auto & t : threads ) t.join();
+
+    EXPECT_EQ( ThreadNumber * RequestNumber, total );
+    EXPECT_EQ( static_cast< size_t >( ThreadNumber * RequestNumber ), applied );
+    EXPECT_LE( calls, applied );
+    EXPECT_LE( max_batch, MaxBatch );
+
+    for ( auto m : monotonic ) EXPECT_TRUE( m );
+}
@@ -0,0 +1,269 @@
+#ifndef __JB__TEST__PHYSICAL_VOLUME_IMPL__H__
+#define __JB__TEST__PHYSICAL_VOLUME_IMPL__H__
+
+
+#include <ret_codes.h>
+#include <details/variadic_hash.h>
+#include <string>
+#include <vector>
+#include <variant>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <unordered_map>
+#include <filesystem>
+#include <algorithm>
+#include <cstring>
+#include <cstddef>
+
+
+namespace jb
+{
+    /** In-memory file system for the storage engine tests
+
+    Files survive closing of all their handles, so a test may reopen a file, each handle has its
+    own position as OS file handles do
+    */
+    struct MemoryFilePolicy
+    {
+        struct File
+        {
+            std::mutex guard_;
+            std::vector< char > data_;
+        };
+
+        struct Handle
+        {
+            std::shared_ptr< File > file_;
+            uint64_t position_ = 0;
+        };
+
+        using HandleT = Handle *;
+
+        inline static const HandleT InvalidHandle = nullptr;
+
+        enum class SeekMethod
+        {
+            Begin,
+            Current,
+            End
+        };
+
+
+        static auto files() noexcept
+        {
+            static std::mutex guard;
+            static std::unordered_map< std::string, std::shared_ptr< File > > files;
+            return std::forward_as_tuple( guard, files );
+        }
+
+
+        static void remove_file( const std::filesystem::path & path ) noexcept
+        {
+            auto[ guard, files ] = MemoryFilePolicy::files();
+            std::lock_guard< std::mutex > lock( guard );
+            files.erase( path.string() );
+        }
+
+
+        static std::tuple< bool, bool, HandleT > open_file( const std::filesystem::path & path ) noexcept
+        {
+            try
+            {
+                auto[ guard, files ] = MemoryFilePolicy::files();
+                std::lock_guard< std::mutex > lock( guard );
+
+                auto & file = files[ path.string() ];
+                const bool creating = !file;
+                if ( creating ) file = std::make_shared< File >();
+
+                return { true, creating, new Handle{ file } };
+            }
+            catch ( ... )
+            {
+            }
+
+            return { false, false, InvalidHandle };
+        }
+
+
+        static std::tuple< bool > close_file( HandleT handle ) noexcept
+        {
+            delete handle;
+            return { true };
+        }
+
+
+        static std::tuple< bool, int64_t > seek_file( HandleT handle, int64_t offset, SeekMethod origin = SeekMethod::Begin ) noexcept
+        {
+            std::lock_guard< std::mutex > lock( handle->file_->guard_ );
+
+            int64_t base = 0;
+            if ( SeekMethod::Current == origin ) base = handle->position_;
+            if ( SeekMethod::End == origin ) base = handle->file_->data_.size();
+
+            if ( base + offset < 0 ) return { false, 0 };
+
+            handle->position_ = base + offset;
+            return { true, base + offset };
+        }
+
+
+        static std::tuple< bool, uint64_t > write_file( HandleT handle, const void * buffer, size_t size ) noexcept
+        {
+            try
+            {
+                std::lock_guard< std::mutex > lock( handle->file_->guard_ );
+
+                auto & data = handle->file_->data_;
+                if ( data.size() < handle->position_ + size ) data.resize( handle->position_ + size );
+
+                std::memcpy( data.data() + handle->position_, buffer, size );
+                handle->position_ += size;
+
+                return { true, size };
+            }
+            catch ( ... )
+            {
+            }
+
+            return { false, 0 };
+        }
+
+
+        static std::tuple< bool, size_t > read_file( HandleT handle, void * buffer, size_t size ) noexcept
+        {
+            std::lock_guard< std::mutex > lock( handle->file_->guard_ );
+
+            const auto & data = handle->file_->data_;
+            const size_t read = handle->position_ < data.size() ? std::min< size_t >( size, data.size() - handle->position_ ) : 0;
+
+            std::memcpy( buffer, data.data() + handle->position_, read );
+            handle->position_ += read;
+
+            return { true, read };
+        }
+
+
+        static std::tuple< bool, uint64_t > resize_file( HandleT handle, uint64_t size ) noexcept
+        {
+            try
+            {
+                std::lock_guard< std::mutex > lock( handle->file_->guard_ );
+                handle->file_->data_.resize( size );
+                return { true, size };
+            }
+            catch ( ... )
+            {
+            }
+
+            return { false, 0 };
+        }
+    };
+
+
+    /** Switches of b-tree policies for the storage engine tests
+    */
+    enum TestPolicyFlags : unsigned
+    {
+        WriteBack = 1,      ///< write-back node cache
+        TopDown = 2,        ///< single-pass top-down insertion and erasing
+        Eytzinger = 4,      ///< Eytzinger in-node digest layout
+        LazyErase = 8,      ///< erasing leaves tombstones
+        Expiration = 16     ///< expiration index
+    };
+
+
+    /** Settings of the storage engine tests
+
+    Small nodes and small cache let a few hundreds of subkeys build multilevel b-trees and make
+    the cache evict nodes
+
+    @tparam Power - b-tree power
+    @tparam Flags - policy switches, see TestPolicyFlags
+    */
+    template < size_t Power, unsigned Flags = 0 >
+    struct TestPolicy
+    {
+        using KeyCharT = char;
+        using KeyCharTraits = std::char_traits< KeyCharT >;
+        using Value = std::variant<
+            uint32_t,
+            uint64_t,
+            float,
+            double,
+            std::string,
+            std::vector< std::byte >,
+            std::vector< float >,
+            std::vector< double >
+        >;
+
+        struct PhysicalVolumePolicy
+        {
+            static constexpr size_t MaxTreeDepth = 256;
+            static constexpr size_t BloomSize = 1024;
+            static constexpr size_t BTreeMinPower = Power;
+            static constexpr size_t BTreeMaxPower = Power;
+            static constexpr size_t BTreeMaxDepth = 64;
+            static constexpr size_t BTreeCacheSize = 64;
+            static constexpr size_t BTreeDirtyLimit = ( Flags & WriteBack ) ? 16 : 0;
+            static constexpr size_t BTreeFlushPeriod = 10;
+            static constexpr size_t BTreeBulkLoadFill = 90;
+            static constexpr bool BTreeTopDown = ( Flags & TopDown ) != 0;
+            static constexpr bool BTreeEytzinger = ( Flags & Eytzinger ) != 0;
+            static constexpr size_t BTreeHotLevels = 2;
+            static constexpr size_t BTreeReclaimBatch = 8;
+            static constexpr bool BTreeLazyErase = ( Flags & LazyErase ) != 0;
+            static constexpr size_t BTreeCollapseBatch = 8;
+            static constexpr bool ExpirationIndex = ( Flags & Expiration ) != 0;
+            static constexpr size_t ExpirationReapBatch = 16;
+            static constexpr size_t BTreeCombineBatch = 16;
+            static constexpr size_t ChunkSize = 256;
+            static constexpr size_t BlobDedupThreshold = 512;
+            static constexpr size_t ReaderNumber = 4;
+            static constexpr size_t PreservedChunkNumber = 16;
+        };
+
+        using Os = MemoryFilePolicy;
+    };
+
+
+    /** Enclosing scope of the storage engine
+
+    Storage file, b-tree, and b-tree cache are declared as nested classes of physical volume
+    implementation, that is not a part of Storage yet, so the tests declare the scope on their own
+
+    @tparam Policies - global settings
+    */
+    template < typename Policies >
+    class Storage
+    {
+    public:
+
+        using RetCode = ::jb::RetCode;
+        using Key = std::basic_string< typename Policies::KeyCharT, typename Policies::KeyCharTraits >;
+        using Value = typename Policies::Value;
+
+        class PhysicalVolumeImpl
+        {
+        public:
+
+            class Bloom
+            {
+            public:
+
+                using Digest = uint64_t;
+            };
+
+            class StorageFile;
+            class BTree;
+            class BTreeCache;
+        };
+    };
+}
+
+
+#include <b_tree_cache.h>
+
+
+#endif
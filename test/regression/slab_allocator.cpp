@@ -0,0 +1,165 @@
+#include <details/slab_allocator.h>
+#include <gtest/gtest.h>
+#include <vector>
+#include <string>
+#include <thread>
+
+
+using slab_pool = jb::details::slab_pool;
+
+
+TEST( slab_allocator, block_size )
+{
+    EXPECT_EQ( slab_pool::MinBlockSize, slab_pool::block_size( 1 ) );
+    EXPECT_EQ( slab_pool::MinBlockSize, slab_pool::block_size( slab_pool::MinBlockSize ) );
+    EXPECT_EQ( 2 * slab_pool::MinBlockSize, slab_pool::block_size( slab_pool::MinBlockSize + 1 ) );
+    EXPECT_EQ( 4096, slab_pool::block_size( 3000 ) );
+    EXPECT_EQ( slab_pool::MaxBlockSize, slab_pool::block_size( slab_pool::MaxBlockSize ) );
+    EXPECT_EQ( slab_pool::MaxBlockSize + 1, slab_pool::block_size( slab_pool::MaxBlockSize + 1 ) );
+}
+
+
+TEST( slab_allocator, reuse )
+{
+    auto & pool = slab_pool::instance();
+
+    // the blocks of the same class are interchangeable
+    auto p = pool.allocate( 1000 );
+    pool.deallocate( p, 1000 );
+
+    const auto retained = pool.retained( 1000 );
+    EXPECT_LE( 1, retained );
+
+    auto q = pool.allocate( 600 );
+    EXPECT_EQ( p, q );
+    EXPECT_EQ( retained - 1, pool.retained( 1000 ) );
+
+    pool.deallocate( q, 600 );
+}
+
+
+TEST( slab_allocator, retain_limit )
+{
+    auto & pool = slab_pool::instance();
+
+    static constexpr size_t size = slab_pool::MaxBlockSize;
+    static constexpr size_t limit = slab_pool::RetainBytes / size;
+
+    std::vector< void* > blocks( limit + 4 );
+    for ( auto & b : blocks ) b = pool.allocate( size );
+    for ( auto b : blocks ) pool.deallocate( b, size );
+
+    EXPECT_EQ( limit, pool.retained( size ) );
+
+    // huge blocks go to the heap directly
+    auto p = pool.allocate( size + 1 );
+    pool.deallocate( p, size + 1 );
+    EXPECT_EQ( 0, pool.retained( size + 1 ) );
+}
+
+
+TEST( slab_allocator, container )
+{
+    std::vector< std::string, jb::details::slab_allocator< std::string > > v;
+
+    for ( size_t i = 0; i < 1000; ++i )
+    {
+        v.push_back( std::to_string( i ) );
+    }
+
+    v.erase( v.begin(), v.begin() + 500 );
+    v.shrink_to_fit();
+
+    ASSERT_EQ( 500, v.size() );
+    EXPECT_EQ( "500", v.front() );
+    EXPECT_EQ( "999", v.back() );
+
+    std::vector< std::string, jb::details::slab_allocator< std::string > > w( v );
+    EXPECT_EQ( v, w );
+}
+
+
+TEST( slab_allocator, concurrency )
+{
+    std::vector< std::thread > threads;
+
+    for ( size_t t = 0; t < 8; ++t )
+    {
+        threads.emplace_back( [t] {
+            for ( size_t i = 0; i < 10000; ++i )
+            {
+                std::vector< uint64_t, jb::details::slab_allocator< uint64_t > > v( ( i + t ) % 300 + 1, i );
+                EXPECT_EQ( i, v.back() );
+            }
+        } );
+    }
+
+    for ( auto & t : threads ) t.join();
+}
+
+
+TEST( slab_allocator, array )
+{
+    using array = jb::details::slab_array< uint64_t, 1000 >;
+
+    array a;
+    EXPECT_TRUE( a.empty() );
+    EXPECT_EQ( 0, a.capacity() );
+    EXPECT_EQ( 0, a.view().second );
+
+    for ( uint64_t i = 0; i < 10; ++i ) a.push_back( 2 * i );
+
+    ASSERT_EQ( 10, a.size() );
+    EXPECT_LE( 10, a.capacity() );
+
+    const uint64_t tail[] = { 100, 101 };
+    a.insert( a.begin() + 1, 1 );
+    a.insert( a.end(), std::begin( tail ), std::end( tail ) );
+    a.erase( a.begin() + 3, a.begin() + 5 );
+    EXPECT_EQ( ( std::vector< uint64_t >{ 0, 1, 2, 8, 10, 12, 14, 16, 18, 100, 101 } ), std::vector< uint64_t >( a.begin(), a.end() ) );
+
+    a.pop_back();
+    EXPECT_EQ( 100, a.back() );
+    EXPECT_EQ( 0, a.front() );
+
+    a.resize( 12 );
+    EXPECT_EQ( 0, a[ 11 ] );
+
+    // copies are independent
+    array b( a );
+    b[ 0 ] = 7;
+    EXPECT_EQ( 0, a[ 0 ] );
+    EXPECT_EQ( 12, b.size() );
+
+    array c( std::move( b ) );
+    EXPECT_TRUE( b.empty() );
+    EXPECT_EQ( 7, c[ 0 ] );
+
+    a.clear();
+    EXPECT_TRUE( a.empty() );
+    EXPECT_LE( 12, a.capacity() );
+}
+
+
+TEST( slab_allocator, array_growth )
+{
+    jb::details::slab_array< uint32_t, 100 > a;
+
+    a.push_back( 1 );
+    auto [ items, size ] = a.view();
+    ASSERT_EQ( 1, size );
+
+    // outgrown block stays readable by a reader that took it before the growth
+    while ( a.capacity() < 100 ) a.push_back( 2 );
+    EXPECT_NE( items, a.data() );
+    EXPECT_EQ( 1, items[ 0 ] );
+
+    // the view never goes beyond the block it provides
+    auto [ grown, grown_size ] = a.view();
+    EXPECT_EQ( a.data(), grown );
+    EXPECT_EQ( a.size(), grown_size );
+
+    a.resize( 100 );
+    EXPECT_THROW( a.push_back( 3 ), std::bad_alloc );
+    EXPECT_EQ( 100, a.size() );
+}